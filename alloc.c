@@ -19,6 +19,7 @@
 #if HAVE_SYS_QUEUE
 # include <sys/queue.h>
 #endif 
+#include <sys/mman.h>
 #include <sys/socket.h>
 
 #include <assert.h>
@@ -30,10 +31,12 @@
 # include <fcntl.h>
 #endif
 #include <poll.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include <sqlite3.h>
@@ -51,6 +54,12 @@ sqlbox_res_clear(struct sqlbox_res *p)
 
 	free(p->set);
 	free(p->buf);
+	if (p->map != NULL)
+		munmap(p->map, p->mapsz);
+	if (p->prev != NULL) {
+		sqlbox_res_clear(p->prev);
+		free(p->prev);
+	}
 	memset(p, 0, sizeof(struct sqlbox_res));
 }
 
@@ -78,17 +87,32 @@ sqlbox_clear(struct sqlbox *box, int intent)
 {
 	struct sqlbox_db 	*db;
 	struct sqlbox_stmt	*stmt;
+	struct sqlbox_blob	*b;
 
 	if (box == NULL)
 		return;
+
+	/* Stop the watcher before it can see closed databases. */
+
+	sqlbox_ctl_stop(box);
+
 	if (box->fd != -1)
 		close(box->fd);
+	if (box->ctlfd != -1)
+		close(box->ctlfd);
 
 	while ((db = TAILQ_FIRST(&box->dbq)) != NULL) {
 		if (!intent)
 			sqlbox_warnx(&box->cfg, "%s: source %zu "
 				"still open on exit", 
 				db->src->fname, db->idx);
+		while ((b = TAILQ_FIRST(&db->blobq)) != NULL) {
+			sqlbox_warnx(&box->cfg, "%s: blob %zu "
+				"source %zu not closed on exit",
+				db->src->fname, b->idx, db->idx);
+			TAILQ_REMOVE(&db->blobq, b, entries);
+			sqlbox_blob_free(box, db, b);
+		}
 		while ((stmt = TAILQ_FIRST(&db->stmtq)) != NULL) {
 			sqlbox_warnx(&box->cfg, "%s: stmt %zu "
 				"source %zu not finalised on exit", 
@@ -112,9 +136,8 @@ sqlbox_clear(struct sqlbox *box, int intent)
 				"%zu still open on exit (auto rollback)", 
 				db->src->fname, db->trans);
 		TAILQ_REMOVE(&box->dbq, db, entries);
-		sqlbox_debug(&box->cfg, 
-			"sqlite3_close: %s", db->src->fname);
-		sqlite3_close(db->db);
+		if (db->db != NULL)
+			sqlbox_wrap_close(box, db);
 		free(db);
 	}
 
@@ -131,6 +154,8 @@ sqlbox_clear(struct sqlbox *box, int intent)
 		sqlbox_stmt_free(stmt);
 	}
 
+	sqlbox_res_clear(&box->rows);
+
 	if (box->free_msg_dat)
 		free(box->cfg.msg.dat);
 	if (box->cfg_free_fp != NULL)
@@ -145,6 +170,26 @@ sqlbox_free(struct sqlbox *box)
 	free(box);
 }
 
+/*
+ * Check that "val", if not NULL, is one of the NULL-terminated "vals"
+ * (case insensitive).
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_cfg_vrfy_pragma(const struct sqlbox_cfg *cfg, size_t idx,
+	const char *name, const char *val, const char *const *vals)
+{
+
+	if (val == NULL)
+		return 1;
+	for ( ; *vals != NULL; vals++)
+		if (strcasecmp(val, *vals) == 0)
+			return 1;
+	sqlbox_warnx(cfg, "source %zu has invalid "
+		"%s: %s", idx, name, val);
+	return 0;
+}
+
 /*
  * Verify internal consistency.
  * Returns FALSE on failure, TRUE on success.
@@ -152,7 +197,15 @@ sqlbox_free(struct sqlbox *box)
 static int
 sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 {
-	size_t	 i, j;
+	size_t				 i, j, k;
+	const struct sqlbox_tune	*t;
+	const struct sqlbox_progstep	*st;
+	static const char *const	 journals[] = { "DELETE",
+		"TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF", NULL };
+	static const char *const	 syncs[] = { "OFF", "NORMAL",
+		"FULL", "EXTRA", NULL };
+	static const char *const	 temps[] = { "DEFAULT", "FILE",
+		"MEMORY", NULL };
 
 	if (cfg == NULL)
 		return 1;
@@ -166,6 +219,51 @@ sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 			return 0;
 		}
 
+	/* Only writable preloaded sources may be saved. */
+
+	for (i = 0; i < cfg->srcs.srcsz; i++) {
+		if (!(cfg->srcs.srcs[i].flags & SQLBOX_SRC_SAVE))
+			continue;
+		if (!(cfg->srcs.srcs[i].flags & SQLBOX_SRC_PRELOAD)) {
+			sqlbox_warnx(cfg, "source %zu saves "
+				"but is not preloaded", i);
+			return 0;
+		}
+		if (cfg->srcs.srcs[i].mode == SQLBOX_SRC_RO ||
+		    cfg->srcs.srcs[i].mode == SQLBOX_SRC_IMMUTABLE) {
+			sqlbox_warnx(cfg, "source %zu saves "
+				"but is read-only", i);
+			return 0;
+		}
+	}
+
+	/* Only writable sources may batch writes. */
+
+	for (i = 0; i < cfg->srcs.srcsz; i++)
+		if ((cfg->srcs.srcs[i].flags & SQLBOX_SRC_BATCH) &&
+		    (cfg->srcs.srcs[i].mode == SQLBOX_SRC_RO ||
+		     cfg->srcs.srcs[i].mode == SQLBOX_SRC_IMMUTABLE)) {
+			sqlbox_warnx(cfg, "source %zu batches "
+				"but is read-only", i);
+			return 0;
+		}
+
+	/* 
+	 * Tuning strings are put directly into statements, so make sure
+	 * they're what we expect.
+	 */
+
+	for (i = 0; i < cfg->srcs.srcsz; i++) {
+		t = &cfg->srcs.srcs[i].tune;
+		if (!sqlbox_cfg_vrfy_pragma(cfg, i, 
+		    "journal_mode", t->journal_mode, journals) ||
+		    !sqlbox_cfg_vrfy_pragma(cfg, i,
+		    "synchronous", t->synchronous, syncs) ||
+		    !sqlbox_cfg_vrfy_pragma(cfg, i,
+		    "temp_store", t->temp_store, temps))
+			return 0;
+	}
+
 	/* We mustn't have a NULL statement. */
 
 	for (i = 0; i < cfg->stmts.stmtsz; i++)
@@ -179,6 +277,21 @@ sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 			return 0;
 		}
 
+	/* Blob columns must be fully named. */
+
+	for (i = 0; i < cfg->blobs.blobsz; i++)
+		if (cfg->blobs.blobs[i].table == NULL ||
+		    cfg->blobs.blobs[i].table[0] == '\0') {
+			sqlbox_warnx(cfg, 
+				"blob %zu has no table", i);
+			return 0;
+		} else if (cfg->blobs.blobs[i].column == NULL ||
+		    cfg->blobs.blobs[i].column[0] == '\0') {
+			sqlbox_warnx(cfg, 
+				"blob %zu has no column", i);
+			return 0;
+		}
+
 	/* The default role, if specified, must be valid. */
 
 	if (cfg->roles.defrole &&
@@ -191,8 +304,8 @@ sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 	}
 
 	/* 
-	 * Make sure that the statements, sources, and transitional
-	 * roles available to each role are valid.
+	 * Make sure that the statements, sources, blob columns, and
+	 * transitional roles available to each role are valid.
 	 */
 
 	for (i = 0; i < cfg->roles.rolesz; i++) {
@@ -226,6 +339,26 @@ sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 					cfg->srcs.srcsz);
 				return 0;
 			}
+		for (j = 0; j < cfg->roles.roles[i].blobsz; j++)
+			if (cfg->roles.roles[i].blobs[j] >= 
+			    cfg->blobs.blobsz) {
+				sqlbox_warnx(cfg,
+					"role %zu references invalid "
+					"blob %zu (have %zu)", i,
+					cfg->roles.roles[i].blobs[j],
+					cfg->blobs.blobsz);
+				return 0;
+			}
+		for (j = 0; j < cfg->roles.roles[i].wblobsz; j++)
+			if (cfg->roles.roles[i].wblobs[j] >= 
+			    cfg->blobs.blobsz) {
+				sqlbox_warnx(cfg,
+					"role %zu references invalid "
+					"blob %zu (have %zu)", i,
+					cfg->roles.roles[i].wblobs[j],
+					cfg->blobs.blobsz);
+				return 0;
+			}
 	}
 
 	for (i = 0; i < cfg->filts.filtsz; i++)
@@ -241,18 +374,57 @@ sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 			return 0;
 		}
 
+	/* 
+	 * Program steps must reference valid statements and may only
+	 * use the row identifiers of steps already run.
+	 */
+
+	for (i = 0; i < cfg->progs.progsz; i++)
+		for (j = 0; j < cfg->progs.progs[i].stepsz; j++) {
+			st = &cfg->progs.progs[i].steps[j];
+			if (st->stmt >= cfg->stmts.stmtsz) {
+				sqlbox_warnx(cfg, "program %zu step "
+					"%zu references invalid stmt "
+					"%zu (have %zu)", i, j, 
+					st->stmt, cfg->stmts.stmtsz);
+				return 0;
+			}
+			for (k = 0; k < st->parmsz; k++)
+				if (st->parms[k].type == 
+				    SQLBOX_PROGP_INPUT)
+					continue;
+				else if (st->parms[k].type != 
+				    SQLBOX_PROGP_LASTID) {
+					sqlbox_warnx(cfg, "program "
+						"%zu step %zu has bad "
+						"parameter %zu type", 
+						i, j, k);
+					return 0;
+				} else if (st->parms[k].idx >= j) {
+					sqlbox_warnx(cfg, "program "
+						"%zu step %zu references "
+						"later step %zu", i, j,
+						st->parms[k].idx);
+					return 0;
+				}
+		}
+
 	return 1;
 }
 
 /*
  * Zero and initialise the memory required by an sqlbox.
  * Call sqlbox_clear() regardless of the return value.
- * Returns FALSE on memory allocation failure and TRUE otherwise.
+ * Returns FALSE on failure and TRUE otherwise.
  */
 static int
 sqlbox_init(struct sqlbox *box, const struct sqlbox_cfg *cfg, int fd,
-	pid_t pid, sqlbox_cfg_free fp)
+	int ctlfd, pid_t pid, sqlbox_cfg_free fp)
 {
+#ifdef SOCK_SEQPACKET
+	int		 type, bufsz;
+	socklen_t	 len;
+#endif
 
 	memset(box, 0, sizeof(struct sqlbox));
 
@@ -263,11 +435,36 @@ sqlbox_init(struct sqlbox *box, const struct sqlbox_cfg *cfg, int fd,
 
 	box->role = box->cfg.roles.defrole;
 	box->fd = fd;
+	box->ctlfd = ctlfd;
 	box->pid = pid;
 	box->cfg_free_fp = fp;
 
 	TAILQ_INIT(&box->dbq);
 	TAILQ_INIT(&box->stmtq);
+
+#ifdef SOCK_SEQPACKET
+	/*
+	 * Packets can't be larger than the send buffer, so limit our
+	 * records to half of it (some systems double the size set).
+	 */
+
+	len = sizeof(int);
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1) {
+		sqlbox_warn(&box->cfg, "getsockopt");
+		return 0;
+	} else if (type != SOCK_SEQPACKET)
+		return 1;
+
+	len = sizeof(int);
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsz, &len) == -1) {
+		sqlbox_warn(&box->cfg, "getsockopt");
+		return 0;
+	}
+	box->rec = bufsz > 0 ? (size_t)bufsz / 2 : 0;
+	box->rec -= box->rec % SQLBOX_FRAME;
+	if (box->rec < SQLBOX_FRAME)
+		box->rec = SQLBOX_FRAME;
+#endif
 	return 1;
 }
 
@@ -275,11 +472,15 @@ sqlbox_init(struct sqlbox *box, const struct sqlbox_cfg *cfg, int fd,
  * Given an open socket pair, fork our protected child process and begin
  * waiting for instructions.
  * Don't touch "cfg" if we fail: let the caller handle that.
- * If any descriptors in "fds" are closed, they're reassigned to -1.
+ * The "fds" are the main communication channel and "ctls" are for the
+ * out-of-band control channel.
+ * If any descriptors in "fds" or "ctls" are closed, they're reassigned
+ * to -1.
  * The caller should close any remaining descriptors on failure.
  */
 static struct sqlbox *
-sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2], sqlbox_cfg_free fp)
+sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2], int ctls[2],
+	sqlbox_cfg_free fp)
 {
 	struct sqlbox	 box;
 	struct sqlbox	*p;
@@ -308,9 +509,10 @@ sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2], sqlbox_cfg_free fp)
 			free(p);
 			return NULL;
 		}
-		close(fds[0]);
 		fds[0] = -1;
-		if (!sqlbox_init(p, cfg, fds[1], pid, fp)) {
+		close(ctls[0]);
+		ctls[0] = -1;
+		if (!sqlbox_init(p, cfg, fds[1], ctls[1], pid, fp)) {
 			free(p);
 			p = NULL;
 		}
@@ -326,7 +528,9 @@ sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2], sqlbox_cfg_free fp)
 
 	close(fds[1]);
 	fds[1] = -1;
-	if (!sqlbox_init(&box, cfg, fds[0], (pid_t)-1, fp)) {
+	close(ctls[1]);
+	ctls[1] = -1;
+	if (!sqlbox_init(&box, cfg, fds[0], ctls[0], (pid_t)-1, fp)) {
 		sqlbox_clear(&box, 0);
 		_exit(EXIT_FAILURE);
 	}
@@ -334,14 +538,41 @@ sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2], sqlbox_cfg_free fp)
 #if !HAVE_ARC4RANDOM
 	srandom(getpid());
 #endif
+
+	/* 
+	 * Exports write to caller descriptors that may be pipes.
+	 * Report their closing as errors instead of dying.
+	 */
+
+	signal(SIGPIPE, SIG_IGN);
+
 #if HAVE_PLEDGE
-	if (pledge("stdio rpath cpath "
-	           "wpath flock fattr", NULL) == -1) {
+	/*
+	 * Descriptors are passed for exports, imports, and memory
+	 * files, but promises can't be widened beyond the caller's,
+	 * so try without if need be.
+	 */
+
+	if (pledge("stdio rpath cpath wpath "
+	           "flock fattr recvfd sendfd", NULL) == -1 &&
+	    (errno != EPERM || pledge("stdio rpath cpath "
+	           "wpath flock fattr", NULL) == -1)) {
 		sqlbox_warn(cfg, "pledge");
 		_exit(EXIT_FAILURE);
 	}
 #endif
 
+	/* 
+	 * Start servicing the control channel.
+	 * The thread is stopped in sqlbox_clear().
+	 */
+
+	if (!sqlbox_ctl_start(&box)) {
+		sqlbox_warnx(&box.cfg, "sqlbox_ctl_start");
+		sqlbox_clear(&box, 0);
+		_exit(EXIT_FAILURE);
+	}
+
 	if (!(rc = sqlbox_main_loop(&box)))
 		sqlbox_warnx(&box.cfg, "sqlbox_main_loop");
 
@@ -355,19 +586,54 @@ sqlbox_alloc(struct sqlbox_cfg *cfg)
 	return sqlbox_alloc_destructor(cfg, NULL);
 }
 
-struct sqlbox *
-sqlbox_alloc_destructor(struct sqlbox_cfg *cfg, sqlbox_cfg_free fp)
+/*
+ * Create a non-blocking socket pair that doesn't raise SIGPIPE.
+ * This is a SOCK_SEQPACKET pair if requested and available, else a
+ * SOCK_STREAM pair, with any configured buffer sizes.
+ * Returns FALSE on failure (nothing is allocated), TRUE on success.
+ */
+static int
+sqlbox_socketpair(struct sqlbox_cfg *cfg, int fd[2])
 {
-	int	 	 fl = SOCK_STREAM;
-	int		 fd[2];
-	struct sqlbox	*p;
+	int	 	 fl = 0, rc = -1, bufsz;
 
 #if HAVE_SOCK_NONBLOCK
 	fl |= SOCK_NONBLOCK;
 #endif
-	if (socketpair(AF_UNIX, fl, 0, fd) == -1) {
+#ifdef SOCK_SEQPACKET
+	if (cfg->comm.seqpacket &&
+	    (rc = socketpair(AF_UNIX, fl | SOCK_SEQPACKET, 0, fd)) == -1)
+		sqlbox_debug(cfg, "socketpair: SOCK_SEQPACKET "
+			"not available, using SOCK_STREAM");
+#endif
+	if (rc == -1 && socketpair(AF_UNIX, fl | SOCK_STREAM, 0, fd) == -1) {
 		sqlbox_warn(cfg, "socketpair");
-		return NULL;
+		return 0;
+	}
+
+	if (cfg->comm.sndbuf > 0) {
+		bufsz = cfg->comm.sndbuf;
+		if (setsockopt(fd[0], SOL_SOCKET,
+		     SO_SNDBUF, &bufsz, sizeof(int)) == -1 ||
+		    setsockopt(fd[1], SOL_SOCKET,
+		     SO_SNDBUF, &bufsz, sizeof(int)) == -1) {
+			sqlbox_warn(cfg, "setsockopt");
+			close(fd[0]);
+			close(fd[1]);
+			return 0;
+		}
+	}
+	if (cfg->comm.rcvbuf > 0) {
+		bufsz = cfg->comm.rcvbuf;
+		if (setsockopt(fd[0], SOL_SOCKET,
+		     SO_RCVBUF, &bufsz, sizeof(int)) == -1 ||
+		    setsockopt(fd[1], SOL_SOCKET,
+		     SO_RCVBUF, &bufsz, sizeof(int)) == -1) {
+			sqlbox_warn(cfg, "setsockopt");
+			close(fd[0]);
+			close(fd[1]);
+			return 0;
+		}
 	}
 
 #if !defined(MSG_NOSIGNAL)
@@ -380,7 +646,7 @@ sqlbox_alloc_destructor(struct sqlbox_cfg *cfg, sqlbox_cfg_free fp)
 		sqlbox_warn(cfg, "setsockopt");
 		close(fd[0]);
 		close(fd[1]);
-		return NULL;
+		return 0;
 	}
 #else
 # error Neither MSG_NOSIGNAL nor SO_NOSIGPIPE defined.
@@ -395,15 +661,38 @@ sqlbox_alloc_destructor(struct sqlbox_cfg *cfg, sqlbox_cfg_free fp)
 		sqlbox_warn(cfg, "fcntl");
 		close(fd[0]);
 		close(fd[1]);
-		return NULL;
+		return 0;
 	}
 #endif
-	if ((p = sqlbox_alloc_fd(cfg, fd, fp)) == NULL) {
+	return 1;
+}
+
+struct sqlbox *
+sqlbox_alloc_destructor(struct sqlbox_cfg *cfg, sqlbox_cfg_free fp)
+{
+	int		 fd[2], ctl[2];
+	struct sqlbox	*p;
+
+	if (!sqlbox_socketpair(cfg, fd)) {
+		sqlbox_warnx(cfg, "sqlbox_socketpair");
+		return NULL;
+	} else if (!sqlbox_socketpair(cfg, ctl)) {
+		sqlbox_warnx(cfg, "sqlbox_socketpair");
+		close(fd[0]);
+		close(fd[1]);
+		return NULL;
+	}
+
+	if ((p = sqlbox_alloc_fd(cfg, fd, ctl, fp)) == NULL) {
 		sqlbox_warnx(cfg, "sqlbox_alloc_fd");
 		if (fd[0] != -1)
 			close(fd[0]);
 		if (fd[1] != -1)
 			close(fd[1]);
+		if (ctl[0] != -1)
+			close(ctl[0]);
+		if (ctl[1] != -1)
+			close(ctl[1]);
 	}
 
 	return p;
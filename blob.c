@@ -0,0 +1,594 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Blobs are read from or written to the database in at most this many
+ * bytes at a time, so the server never holds more than this.
+ */
+#define	SQLBOX_BLOB_CHUNK (SQLBOX_FRAME * 64)
+
+/*
+ * Return TRUE if the current role has the ability to access the given
+ * source (or no roles are specified), FALSE if otherwise.
+ */
+static int
+sqlbox_rolecheck_src(struct sqlbox *box, size_t idx)
+{
+	size_t	 i;
+
+	if (box->cfg.roles.rolesz == 0)
+		return 1;
+	for (i = 0; i < box->cfg.roles.roles[box->role].srcsz; i++)
+		if (box->cfg.roles.roles[box->role].srcs[i] == idx)
+			return 1;
+	sqlbox_warnx(&box->cfg, "blob: source %zu "
+		"denied to role %zu", idx, box->role);
+	return 0;
+}
+
+/*
+ * Return TRUE if the current role has the ability to open the given
+ * blob column for reading or, if "wr" is set, writing (or no roles
+ * are specified), FALSE if otherwise.
+ * Columns that may be written may also be read.
+ */
+static int
+sqlbox_rolecheck_blob(struct sqlbox *box, size_t idx, int wr)
+{
+	const struct sqlbox_role *r;
+	size_t	 i;
+
+	if (box->cfg.roles.rolesz == 0)
+		return 1;
+	r = &box->cfg.roles.roles[box->role];
+	for (i = 0; i < r->wblobsz; i++)
+		if (r->wblobs[i] == idx)
+			return 1;
+	for (i = 0; !wr && i < r->blobsz; i++)
+		if (r->blobs[i] == idx)
+			return 1;
+	sqlbox_warnx(&box->cfg, "blob: %s of blob %zu "
+		"denied to role %zu", wr ? "writing" : "reading",
+		idx, box->role);
+	return 0;
+}
+
+/*
+ * Look up an open blob by its identifier across all databases.
+ * Returns the blob (and its database in "dbp") or NULL if not found.
+ */
+static struct sqlbox_blob *
+sqlbox_blob_find(struct sqlbox *box, size_t id, struct sqlbox_db **dbp)
+{
+	struct sqlbox_db	*db;
+	struct sqlbox_blob	*b;
+
+	TAILQ_FOREACH(db, &box->dbq, entries)
+		TAILQ_FOREACH(b, &db->blobq, entries)
+			if (b->id == id) {
+				*dbp = db;
+				return b;
+			}
+
+	sqlbox_warnx(&box->cfg, "cannot find blob: %zu", id);
+	return NULL;
+}
+
+/*
+ * Parse the blob identifier, offset, and length of a read or write.
+ * Makes sure that the range is within the blob.
+ * Returns the blob or NULL on failure.
+ */
+static struct sqlbox_blob *
+sqlbox_blob_range(struct sqlbox *box, const char *name,
+	const char *buf, size_t sz, struct sqlbox_db **dbp,
+	size_t *off, size_t *len)
+{
+	struct sqlbox_blob	*b;
+	uint64_t		 v;
+
+	if (sz != sizeof(uint32_t) + sizeof(uint64_t) * 2) {
+		sqlbox_warnx(&box->cfg, "%s: bad frame size", name);
+		return NULL;
+	}
+	if ((b = sqlbox_blob_find
+	    (box, le32toh(*(const uint32_t *)buf), dbp)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_blob_find", name);
+		return NULL;
+	}
+
+	memcpy(&v, buf + sizeof(uint32_t), sizeof(uint64_t));
+	*off = le64toh(v);
+	memcpy(&v, buf + sizeof(uint32_t) + 
+		sizeof(uint64_t), sizeof(uint64_t));
+	*len = le64toh(v);
+
+	if (*off > b->sz || *len > b->sz - *off) {
+		sqlbox_warnx(&box->cfg, "%s: %s: range %zu+%zu beyond "
+			"blob of %zu B", (*dbp)->src->fname, name, 
+			*off, *len, b->sz);
+		return NULL;
+	}
+	return b;
+}
+
+size_t
+sqlbox_blob_open(struct sqlbox *box, size_t srcid, size_t idx,
+	int64_t rowid, unsigned long flags, size_t *sz)
+{
+	char	 	 buf[sizeof(uint32_t) * 3 + sizeof(int64_t)];
+	char		 ack[sizeof(uint32_t) + sizeof(uint64_t)];
+	uint32_t	 v;
+	uint64_t	 v64;
+	size_t		 id;
+
+	v = htole32(srcid);
+	memcpy(buf, &v, sizeof(uint32_t));
+	v = htole32(idx);
+	memcpy(buf + sizeof(uint32_t), &v, sizeof(uint32_t));
+	v64 = htole64(rowid);
+	memcpy(buf + sizeof(uint32_t) * 2, &v64, sizeof(int64_t));
+	v = htole32(flags);
+	memcpy(buf + sizeof(uint32_t) * 2 + 
+		sizeof(int64_t), &v, sizeof(uint32_t));
+
+	if (!sqlbox_write_frame
+	    (box, SQLBOX_OP_BLOB_OPEN, buf, sizeof(buf))) {
+		sqlbox_warnx(&box->cfg, "blob-open: sqlbox_write_frame");
+		return 0;
+	} else if (!sqlbox_read(box, ack, sizeof(ack))) {
+		sqlbox_warnx(&box->cfg, "blob-open: sqlbox_read");
+		return 0;
+	}
+
+	memcpy(&v, ack, sizeof(uint32_t));
+	if ((id = le32toh(v)) == 0) {
+		sqlbox_warnx(&box->cfg, "blob-open: invalid identifier");
+		return 0;
+	}
+	if (sz != NULL) {
+		memcpy(&v64, ack + sizeof(uint32_t), sizeof(uint64_t));
+		*sz = le64toh(v64);
+	}
+	return id;
+}
+
+/*
+ * Write the frame common to reading and writing.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_blob_io(struct sqlbox *box, enum sqlbox_op op,
+	size_t id, size_t off, size_t sz)
+{
+	char		 buf[sizeof(uint32_t) + sizeof(uint64_t) * 2];
+	uint32_t	 v = htole32(id);
+	uint64_t	 v64;
+
+	memcpy(buf, &v, sizeof(uint32_t));
+	v64 = htole64(off);
+	memcpy(buf + sizeof(uint32_t), &v64, sizeof(uint64_t));
+	v64 = htole64(sz);
+	memcpy(buf + sizeof(uint32_t) + 
+		sizeof(uint64_t), &v64, sizeof(uint64_t));
+	return sqlbox_write_frame(box, op, buf, sizeof(buf));
+}
+
+int
+sqlbox_blob_read(struct sqlbox *box, size_t id, 
+	void *buf, size_t sz, size_t off)
+{
+	uint32_t	 ack;
+	char		*cp = buf;
+	size_t		 n;
+
+	if (!sqlbox_blob_io(box, SQLBOX_OP_BLOB_READ, id, off, sz)) {
+		sqlbox_warnx(&box->cfg, "blob-read: sqlbox_write_frame");
+		return 0;
+	}
+
+	/* 
+	 * The server streams directly into the caller's buffer, each
+	 * chunk (or nothing, if reading nothing) preceded by its code.
+	 */
+
+	do {
+		n = sz < SQLBOX_BLOB_CHUNK ? sz : SQLBOX_BLOB_CHUNK;
+		if (!sqlbox_read(box, (char *)&ack, sizeof(uint32_t))) {
+			sqlbox_warnx(&box->cfg, "blob-read: sqlbox_read");
+			return 0;
+		} else if (le32toh(ack) != SQLBOX_CODE_OK) {
+			sqlbox_warnx(&box->cfg, "blob-read: "
+				"blob %zu expired", id);
+			return 0;
+		} else if (n > 0 && !sqlbox_read(box, cp, n)) {
+			sqlbox_warnx(&box->cfg, "blob-read: sqlbox_read");
+			return 0;
+		}
+		cp += n;
+		sz -= n;
+	} while (sz > 0);
+
+	return 1;
+}
+
+int
+sqlbox_blob_write(struct sqlbox *box, size_t id, 
+	const void *buf, size_t sz, size_t off)
+{
+	uint32_t	 ack;
+	const char	*cp = buf;
+	size_t		 n, len = sz;
+
+	if (!sqlbox_blob_io(box, SQLBOX_OP_BLOB_WRITE, id, off, sz)) {
+		sqlbox_warnx(&box->cfg, "blob-write: sqlbox_write_frame");
+		return 0;
+	}
+
+	/* 
+	 * Write in the chunks the server reads, as SOCK_SEQPACKET
+	 * records must not straddle its reads.
+	 */
+
+	for ( ; len > 0; cp += n, len -= n) {
+		n = len < SQLBOX_BLOB_CHUNK ? len : SQLBOX_BLOB_CHUNK;
+		if (!sqlbox_write(box, cp, n)) {
+			sqlbox_warnx(&box->cfg, "blob-write: sqlbox_write");
+			return 0;
+		}
+	}
+
+	if (!sqlbox_read(box, (char *)&ack, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "blob-write: sqlbox_read");
+		return 0;
+	} else if (le32toh(ack) != SQLBOX_CODE_OK) {
+		sqlbox_warnx(&box->cfg, "blob-write: blob %zu expired", id);
+		return 0;
+	}
+	return 1;
+}
+
+int
+sqlbox_blob_close(struct sqlbox *box, size_t id)
+{
+	uint32_t	 v = htole32(id);
+
+	if (!sqlbox_write_frame(box, 
+	    SQLBOX_OP_BLOB_CLOSE, (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "blob-close: sqlbox_write_frame");
+		return 0;
+	} else if (!sqlbox_read(box, (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "blob-close: sqlbox_read");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Close the blob, which has already been removed from its database,
+ * committing any writes if not in a transaction.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_blob_free(struct sqlbox *box, struct sqlbox_db *db, 
+	struct sqlbox_blob *b)
+{
+	int	 rc = 1;
+
+	sqlbox_debug(&box->cfg, "%s: sqlite3_blob_close: %s.%s",
+		db->src->fname, box->cfg.blobs.blobs[b->idx].table,
+		box->cfg.blobs.blobs[b->idx].column);
+	if (sqlite3_blob_close(b->blob) != SQLITE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: sqlite3_blob_close: %s",
+			db->src->fname, sqlite3_errmsg(db->db));
+		rc = 0;
+	}
+	free(b);
+	return rc;
+}
+
+int
+sqlbox_op_blob_open(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_db		*db;
+	struct sqlbox_blob		*b;
+	const struct sqlbox_pblob	*pb;
+	struct sqlbox_backoff		 bo;
+	size_t				 idx;
+	int64_t				 rowid;
+	uint64_t			 v64;
+	uint32_t			 v;
+	unsigned long			 flags;
+	char				 ack[sizeof(uint32_t) + 
+					     sizeof(uint64_t)];
+
+	if (sz != sizeof(uint32_t) * 3 + sizeof(int64_t)) {
+		sqlbox_warnx(&box->cfg, "blob-open: bad frame size");
+		return 0;
+	}
+
+	memcpy(&v, buf, sizeof(uint32_t));
+	if ((db = sqlbox_db_find_open(box, le32toh(v))) == NULL) {
+		sqlbox_warnx(&box->cfg, "blob-open: "
+			"sqlbox_db_find_open");
+		return 0;
+	}
+	memcpy(&v, buf + sizeof(uint32_t), sizeof(uint32_t));
+	idx = le32toh(v);
+	memcpy(&v64, buf + sizeof(uint32_t) * 2, sizeof(int64_t));
+	rowid = (int64_t)le64toh(v64);
+	memcpy(&v, buf + sizeof(uint32_t) * 2 + 
+		sizeof(int64_t), sizeof(uint32_t));
+	flags = le32toh(v);
+
+	if (idx >= box->cfg.blobs.blobsz) {
+		sqlbox_warnx(&box->cfg, "%s: blob-open: "
+			"bad blob %zu", db->src->fname, idx);
+		return 0;
+	} else if (!sqlbox_rolecheck_src(box, db->idx)) {
+		sqlbox_warnx(&box->cfg, "%s: blob-open: "
+			"sqlbox_rolecheck_src", db->src->fname);
+		return 0;
+	} else if ((flags & ~SQLBOX_BLOB_WRITE)) {
+		sqlbox_warnx(&box->cfg, "%s: blob-open: "
+			"bad flags: %lx", db->src->fname, flags);
+		return 0;
+	} else if (!sqlbox_rolecheck_blob(box, idx, 
+	    (flags & SQLBOX_BLOB_WRITE) != 0)) {
+		sqlbox_warnx(&box->cfg, "%s: blob-open: "
+			"sqlbox_rolecheck_blob", db->src->fname);
+		return 0;
+	} else if ((flags & SQLBOX_BLOB_WRITE) &&
+	    (db->src->mode == SQLBOX_SRC_RO ||
+	     db->src->mode == SQLBOX_SRC_IMMUTABLE)) {
+		sqlbox_warnx(&box->cfg, "%s: blob-open: "
+			"writing read-only source", db->src->fname);
+		return 0;
+	}
+	pb = &box->cfg.blobs.blobs[idx];
+
+	if ((b = calloc(1, sizeof(struct sqlbox_blob))) == NULL) {
+		sqlbox_warn(&box->cfg, "%s: blob-open: "
+			"calloc", db->src->fname);
+		return 0;
+	}
+
+	sqlbox_debug(&box->cfg, "%s: sqlite3_blob_open: %s.%s: "
+		"%" PRId64, db->src->fname, pb->table, pb->column, rowid);
+	sqlbox_backoff_init(&bo, db->src);
+again:
+	b->blob = NULL;
+	switch (sqlite3_blob_open(db->db, "main", pb->table, 
+	    pb->column, rowid, (flags & SQLBOX_BLOB_WRITE) != 0, 
+	    &b->blob)) {
+	case SQLITE_BUSY:
+	case SQLITE_LOCKED:
+	case SQLITE_PROTOCOL:
+		(void)sqlite3_blob_close(b->blob);
+		if (sqlbox_backoff(box, &bo))
+			goto again;
+		sqlbox_warnx(&box->cfg, "%s: sqlite3_blob_open: "
+			"gave up waiting", db->src->fname);
+		free(b);
+		return 0;
+	case SQLITE_OK:
+		break;
+	default:
+		sqlbox_warnx(&box->cfg, "%s: sqlite3_blob_open: "
+			"%s.%s: %s", db->src->fname, pb->table, 
+			pb->column, sqlite3_errmsg(db->db));
+		(void)sqlite3_blob_close(b->blob);
+		free(b);
+		return 0;
+	}
+
+	b->idx = idx;
+	b->sz = sqlite3_blob_bytes(b->blob);
+	b->write = (flags & SQLBOX_BLOB_WRITE) != 0;
+	b->id = ++box->lastid;
+	assert(b->id != 0);
+	TAILQ_INSERT_TAIL(&db->blobq, b, entries);
+
+	v = htole32(b->id);
+	memcpy(ack, &v, sizeof(uint32_t));
+	v64 = htole64(b->sz);
+	memcpy(ack + sizeof(uint32_t), &v64, sizeof(uint64_t));
+	if (sqlbox_write(box, ack, sizeof(ack)))
+		return 1;
+
+	sqlbox_warnx(&box->cfg, "%s: blob-open: "
+		"sqlbox_write", db->src->fname);
+	return 0;
+}
+
+int
+sqlbox_op_blob_read(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_db	*db;
+	struct sqlbox_blob	*b;
+	size_t			 off, len, n;
+	uint32_t		 ack;
+	char			*cp = NULL;
+	int			 c, rc = 0;
+
+	if ((b = sqlbox_blob_range(box, "blob-read", 
+	    buf, sz, &db, &off, &len)) == NULL)
+		return 0;
+
+	if (len > 0) {
+		n = len < SQLBOX_BLOB_CHUNK ? len : SQLBOX_BLOB_CHUNK;
+		if ((cp = malloc(n)) == NULL) {
+			sqlbox_warn(&box->cfg, "%s: blob-read: "
+				"malloc", db->src->fname);
+			return 0;
+		}
+	}
+
+	/* 
+	 * Each chunk is only acknowledged once read, so the client can
+	 * stop if the row has since been changed or deleted, which
+	 * SQLite reports as SQLITE_ABORT on the expired handle.
+	 */
+
+	do {
+		n = len < SQLBOX_BLOB_CHUNK ? len : SQLBOX_BLOB_CHUNK;
+		c = n == 0 ? SQLITE_OK :
+			sqlite3_blob_read(b->blob, cp, (int)n, (int)off);
+		if (c != SQLITE_OK && c != SQLITE_ABORT) {
+			sqlbox_warnx(&box->cfg, "%s: sqlite3_blob_read: "
+				"%s", db->src->fname, 
+				sqlite3_errmsg(db->db));
+			goto out;
+		}
+		if (c == SQLITE_ABORT)
+			sqlbox_debug(&box->cfg, "%s: sqlite3_blob_read: "
+				"blob %zu expired", db->src->fname, b->id);
+		ack = htole32(c == SQLITE_OK ? 
+			SQLBOX_CODE_OK : SQLBOX_CODE_ERROR);
+		if (!sqlbox_write(box, (char *)&ack, sizeof(uint32_t)) ||
+		    (c == SQLITE_OK && n > 0 && 
+		     !sqlbox_write(box, cp, n))) {
+			sqlbox_warnx(&box->cfg, "%s: blob-read: "
+				"sqlbox_write", db->src->fname);
+			goto out;
+		} else if (c != SQLITE_OK)
+			break;
+		off += n;
+		len -= n;
+	} while (len > 0);
+
+	rc = 1;
+out:
+	free(cp);
+	return rc;
+}
+
+int
+sqlbox_op_blob_write(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_db	*db;
+	struct sqlbox_blob	*b;
+	size_t			 off, len, n;
+	uint32_t		 ack;
+	char			*cp = NULL;
+	int			 c = SQLITE_OK;
+
+	if ((b = sqlbox_blob_range(box, "blob-write", 
+	    buf, sz, &db, &off, &len)) == NULL)
+		return 0;
+	if (!b->write) {
+		sqlbox_warnx(&box->cfg, "%s: blob-write: "
+			"blob %zu not writable", db->src->fname, b->id);
+		return 0;
+	}
+
+	if (len > 0) {
+		n = len < SQLBOX_BLOB_CHUNK ? len : SQLBOX_BLOB_CHUNK;
+		if ((cp = malloc(n)) == NULL) {
+			sqlbox_warn(&box->cfg, "%s: blob-write: "
+				"malloc", db->src->fname);
+			return 0;
+		}
+	}
+
+	/* 
+	 * The data follows the frame on the channel.
+	 * If the row has since been changed or deleted, SQLite reports
+	 * SQLITE_ABORT on the expired handle: drain the rest of the data
+	 * and tell the client.
+	 */
+
+	while (len > 0) {
+		n = len < SQLBOX_BLOB_CHUNK ? len : SQLBOX_BLOB_CHUNK;
+		if (!sqlbox_xread(box, box->fd, cp, n)) {
+			sqlbox_warnx(&box->cfg, "%s: blob-write: "
+				"sqlbox_xread", db->src->fname);
+			free(cp);
+			return 0;
+		}
+		if (c == SQLITE_OK)
+			c = sqlite3_blob_write
+				(b->blob, cp, (int)n, (int)off);
+		if (c != SQLITE_OK && c != SQLITE_ABORT) {
+			sqlbox_warnx(&box->cfg, "%s: sqlite3_blob_write: "
+				"%s", db->src->fname, 
+				sqlite3_errmsg(db->db));
+			free(cp);
+			return 0;
+		}
+		off += n;
+		len -= n;
+	}
+
+	free(cp);
+	if (c == SQLITE_ABORT)
+		sqlbox_debug(&box->cfg, "%s: sqlite3_blob_write: "
+			"blob %zu expired", db->src->fname, b->id);
+	ack = htole32(c == SQLITE_OK ? SQLBOX_CODE_OK : SQLBOX_CODE_ERROR);
+	if (sqlbox_write(box, (char *)&ack, sizeof(uint32_t)))
+		return 1;
+	sqlbox_warnx(&box->cfg, "%s: blob-write: "
+		"sqlbox_write", db->src->fname);
+	return 0;
+}
+
+int
+sqlbox_op_blob_close(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_db	*db;
+	struct sqlbox_blob	*b;
+	uint32_t		 ack = htole32(1);
+
+	if (sz != sizeof(uint32_t)) {
+		sqlbox_warnx(&box->cfg, "blob-close: bad frame size");
+		return 0;
+	}
+	if ((b = sqlbox_blob_find
+	    (box, le32toh(*(const uint32_t *)buf), &db)) == NULL) {
+		sqlbox_warnx(&box->cfg, "blob-close: sqlbox_blob_find");
+		return 0;
+	}
+	TAILQ_REMOVE(&db->blobq, b, entries);
+	if (!sqlbox_blob_free(box, db, b)) {
+		sqlbox_warnx(&box->cfg, "%s: blob-close: "
+			"sqlbox_blob_free", db->src->fname);
+		return 0;
+	}
+	if (sqlbox_write(box, (char *)&ack, sizeof(uint32_t)))
+		return 1;
+	sqlbox_warnx(&box->cfg, "%s: blob-close: "
+		"sqlbox_write", db->src->fname);
+	return 0;
+}
@@ -56,7 +56,10 @@ sqlbox_close(struct sqlbox *box, size_t src)
 {
 	uint32_t	 v = htole32(src);
 
-	if (!sqlbox_write_frame
+	if (!sqlbox_credit(box, 1)) {
+		sqlbox_warnx(&box->cfg, "close: sqlbox_credit");
+		return 0;
+	} else if (!sqlbox_write_frame
 	    (box, SQLBOX_OP_CLOSE, (char *)&v, sizeof(uint32_t))) {
 		sqlbox_warnx(&box->cfg, "close: sqlbox_write_frame");
 		return 0;
@@ -75,7 +78,7 @@ int
 sqlbox_op_close(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_db *db;
-	int		  rc = 0;
+	int		  rc;
 
 	/* Check source exists and we can close it. */
 
@@ -108,6 +111,11 @@ sqlbox_op_close(struct sqlbox *box, const char *buf, size_t sz)
 			"(id %zu) has unfinalised statements", 
 			db->src->fname, db->idx, db->id);
 		return 0;
+	} else if (!TAILQ_EMPTY(&db->blobq)) {
+		sqlbox_warnx(&box->cfg, "%s: close: source %zu "
+			"(id %zu) has open blobs", 
+			db->src->fname, db->idx, db->id);
+		return 0;
 	} else if (db->trans) {
 		sqlbox_warnx(&box->cfg, "%s: transaction "
 			"%zu still open on exit (auto rollback)", 
@@ -121,13 +129,7 @@ sqlbox_op_close(struct sqlbox *box, const char *buf, size_t sz)
 	 */
 
 	TAILQ_REMOVE(&box->dbq, db, entries);
-	sqlbox_debug(&box->cfg, "sqlite3_close: %s", db->src->fname);
-	if (sqlite3_close(db->db) != SQLITE_OK)
-		sqlbox_warnx(&box->cfg, "%s: close: %s", 
-			db->src->fname, sqlite3_errmsg(db->db));
-	else
-		rc = 1;
-
+	rc = db->db == NULL ? 1 : sqlbox_wrap_close(box, db);
 	free(db);
 	return rc;
 }
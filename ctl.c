@@ -0,0 +1,397 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include <sys/socket.h>
+#include COMPAT_ENDIAN_H
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * State of the watcher thread servicing the control channel.
+ * This only exists in the server.
+ * The main thread publishes the database it's working on in "db" so
+ * that the watcher can interrupt it.
+ * Interrupts name the client operation they target, numbered as in
+ * sqlbox_write_op(), and are latched in "target" until consumed by work
+ * within sqlbox_ctl_enter() while running that operation.
+ * Interrupts for operations already finished are discarded.
+ */
+struct	sqlbox_ctl {
+	pthread_t	 thread; /* watcher thread */
+	pthread_mutex_t	 mtx; /* protects all below */
+	pthread_cond_t	 cond; /* signalled on interrupt */
+	sqlite3		*db; /* database being worked or NULL */
+	size_t		 depth; /* nested sqlbox_ctl_enter() */
+	uint32_t	 op; /* operation being run */
+	uint32_t	 target; /* operation to interrupt */
+	int		 pending; /* "target" not yet consumed */
+	int		 intr; /* interrupted since entering? */
+};
+
+/*
+ * Whether an interrupt for the current operation is pending.
+ * Must be called with the lock held.
+ */
+static int
+sqlbox_ctl_pending(const struct sqlbox_ctl *ctl)
+{
+
+	return ctl->pending && ctl->target == ctl->op;
+}
+
+/*
+ * Write a control message of "op" with argument "arg".
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_ctl_write(struct sqlbox *box, enum sqlbox_ctlop op, uint32_t arg)
+{
+	uint32_t	 msg[2];
+
+	msg[0] = htole32(op);
+	msg[1] = htole32(arg);
+	return sqlbox_xwrite(box, box->ctlfd, (char *)msg, sizeof(msg));
+}
+
+int
+sqlbox_interrupt(struct sqlbox *box)
+{
+
+	if (!sqlbox_ctl_write(box, SQLBOX_CTL_INTERRUPT, box->opseq)) {
+		sqlbox_warnx(&box->cfg, "interrupt: sqlbox_ctl_write");
+		return 0;
+	}
+	return 1;
+}
+
+int
+sqlbox_ping_oob(struct sqlbox *box)
+{
+	uint32_t	 syn, ack;
+
+#if HAVE_ARC4RANDOM
+	syn = arc4random();
+#else
+	syn = random();
+#endif
+	if (!sqlbox_ctl_write(box, SQLBOX_CTL_PING, syn)) {
+		sqlbox_warnx(&box->cfg, "ping-oob: sqlbox_ctl_write");
+		return 0;
+	}
+	if (!sqlbox_xread(box, box->ctlfd, (char *)&ack, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "ping-oob: sqlbox_xread");
+		return 0;
+	}
+	if (le32toh(ack) != syn) {
+		sqlbox_warnx(&box->cfg, "ping-oob: bad ack");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Read a full control message into "msg".
+ * This differs from sqlbox_xread() in that end of file (the main
+ * thread shutting down the channel) is not an error.
+ * Returns <0 on failure, 0 on end of file, >0 on success.
+ */
+static int
+sqlbox_ctl_read(struct sqlbox *box, uint32_t msg[2])
+{
+	struct pollfd	 pfd = { .fd = box->ctlfd, .events = POLLIN };
+	ssize_t		 rsz;
+	size_t		 tsz = 0, sz = sizeof(uint32_t) * 2;
+
+	while (tsz < sz) {
+		if (poll(&pfd, 1, INFTIM) == -1) {
+			if (errno == EINTR)
+				continue;
+			sqlbox_warn(&box->cfg, "ctl: poll");
+			return -1;
+		} else if ((pfd.revents & (POLLNVAL|POLLERR))) {
+			sqlbox_warnx(&box->cfg, "ctl: poll: nval");
+			return -1;
+		} else if ((pfd.revents & POLLHUP) &&
+		           !(pfd.revents & POLLIN))
+			return 0;
+
+		rsz = read(pfd.fd, (char *)msg + tsz, sz - tsz);
+		if (rsz == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			sqlbox_warn(&box->cfg, "ctl: read");
+			return -1;
+		} else if (rsz == 0)
+			return 0;
+		tsz += rsz;
+	}
+
+	return 1;
+}
+
+/*
+ * The watcher thread.
+ * It services control messages until the channel is closed, which
+ * happens either when the client goes away or when sqlbox_ctl_stop()
+ * shuts down our end of the channel.
+ * It must never touch the database except by sqlite3_interrupt(),
+ * which is safe to call from any thread while the database is open.
+ */
+static void *
+sqlbox_ctl_loop(void *arg)
+{
+	struct sqlbox		*box = arg;
+	struct sqlbox_ctl	*ctl;
+	uint32_t		 msg[2], tgt;
+	int			 c;
+
+	while ((c = sqlbox_ctl_read(box, msg)) > 0) {
+		switch ((enum sqlbox_ctlop)le32toh(msg[0])) {
+		case SQLBOX_CTL_INTERRUPT:
+			pthread_mutex_lock(&box->ctl->mtx);
+			ctl = box->ctl;
+			tgt = le32toh(msg[1]);
+			if ((int32_t)(tgt - ctl->op) >= 0) {
+				ctl->target = tgt;
+				ctl->pending = 1;
+			}
+			if (sqlbox_ctl_pending(ctl) && ctl->db != NULL)
+				sqlite3_interrupt(ctl->db);
+			pthread_cond_signal(&ctl->cond);
+			pthread_mutex_unlock(&ctl->mtx);
+			break;
+		case SQLBOX_CTL_PING:
+			if (!sqlbox_xwrite(box, box->ctlfd,
+			    (char *)&msg[1], sizeof(uint32_t))) {
+				sqlbox_warnx(&box->cfg, 
+					"ctl: sqlbox_xwrite");
+				return NULL;
+			}
+			break;
+		default:
+			sqlbox_warnx(&box->cfg, "ctl: unknown "
+				"op: %" PRIu32, le32toh(msg[0]));
+			return NULL;
+		}
+	}
+
+	if (c < 0)
+		sqlbox_warnx(&box->cfg, "ctl: sqlbox_ctl_read");
+	return NULL;
+}
+
+/*
+ * Start the watcher thread (server only).
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_ctl_start(struct sqlbox *box)
+{
+	struct sqlbox_ctl	*ctl;
+	int			 er;
+
+	assert(box->ctl == NULL);
+	if ((ctl = calloc(1, sizeof(struct sqlbox_ctl))) == NULL) {
+		sqlbox_warn(&box->cfg, "ctl: calloc");
+		return 0;
+	}
+	if ((er = pthread_mutex_init(&ctl->mtx, NULL)) != 0) {
+		sqlbox_warnx(&box->cfg, "ctl: "
+			"pthread_mutex_init: %s", strerror(er));
+		free(ctl);
+		return 0;
+	} else if ((er = pthread_cond_init(&ctl->cond, NULL)) != 0) {
+		sqlbox_warnx(&box->cfg, "ctl: "
+			"pthread_cond_init: %s", strerror(er));
+		pthread_mutex_destroy(&ctl->mtx);
+		free(ctl);
+		return 0;
+	}
+
+	box->ctl = ctl;
+	if ((er = pthread_create(&ctl->thread, 
+	    NULL, sqlbox_ctl_loop, box)) != 0) {
+		sqlbox_warnx(&box->cfg, "ctl: "
+			"pthread_create: %s", strerror(er));
+		pthread_cond_destroy(&ctl->cond);
+		pthread_mutex_destroy(&ctl->mtx);
+		free(ctl);
+		box->ctl = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Stop and reap the watcher thread, if started.
+ * This is called before any database is closed, so the watcher can't
+ * interrupt a stale database.
+ */
+void
+sqlbox_ctl_stop(struct sqlbox *box)
+{
+
+	if (box->ctl == NULL)
+		return;
+
+	/* This wakes the watcher with an end of file. */
+
+	if (shutdown(box->ctlfd, SHUT_RDWR) == -1)
+		sqlbox_warn(&box->cfg, "ctl: shutdown");
+	pthread_join(box->ctl->thread, NULL);
+	pthread_cond_destroy(&box->ctl->cond);
+	pthread_mutex_destroy(&box->ctl->mtx);
+	free(box->ctl);
+	box->ctl = NULL;
+}
+
+/*
+ * Mark that the main thread has read the next operation from the
+ * client, which interrupts may now target.
+ * Any interrupt still latched for an earlier operation is discarded.
+ */
+void
+sqlbox_ctl_op(struct sqlbox *box)
+{
+
+	if (box->ctl == NULL)
+		return;
+	pthread_mutex_lock(&box->ctl->mtx);
+	box->ctl->op++;
+	if ((int32_t)(box->ctl->target - box->ctl->op) < 0)
+		box->ctl->pending = 0;
+	pthread_mutex_unlock(&box->ctl->mtx);
+}
+
+/*
+ * Mark that the main thread is working within the database "db", or
+ * waiting on it if NULL, and may be interrupted.
+ * Interrupts received beforehand for the current operation and not yet
+ * consumed apply to this work, but not those consumed by prior work.
+ * Work may be nested within a NULL "db", such as pauses between
+ * statements, but not within another database.
+ * Must be matched by sqlbox_ctl_leave().
+ */
+void
+sqlbox_ctl_enter(struct sqlbox *box, sqlite3 *db)
+{
+
+	if (box->ctl == NULL)
+		return;
+	pthread_mutex_lock(&box->ctl->mtx);
+	if (box->ctl->depth++ == 0)
+		box->ctl->intr = 0;
+	if (db != NULL)
+		box->ctl->db = db;
+	pthread_mutex_unlock(&box->ctl->mtx);
+}
+
+/*
+ * Mark that the main thread is no longer working in the database.
+ * Interruptions received from now on are latched for the next work in
+ * the same operation.
+ */
+void
+sqlbox_ctl_leave(struct sqlbox *box)
+{
+
+	if (box->ctl == NULL)
+		return;
+	pthread_mutex_lock(&box->ctl->mtx);
+	assert(box->ctl->depth > 0);
+	box->ctl->depth--;
+	box->ctl->db = NULL;
+	pthread_mutex_unlock(&box->ctl->mtx);
+}
+
+/*
+ * Whether we've been interrupted within sqlbox_ctl_enter(), consuming
+ * any latched interrupts.
+ * This is used to stop statements before they start and to stop
+ * waiting on busy databases, where there's no running statement for
+ * sqlite3_interrupt() to stop.
+ * Always returns FALSE outside of sqlbox_ctl_enter().
+ */
+int
+sqlbox_ctl_interrupted(struct sqlbox *box)
+{
+	int	 rc;
+
+	if (box->ctl == NULL)
+		return 0;
+	pthread_mutex_lock(&box->ctl->mtx);
+	if (box->ctl->depth > 0 && sqlbox_ctl_pending(box->ctl)) {
+		box->ctl->pending = 0;
+		box->ctl->intr = 1;
+	}
+	rc = box->ctl->depth > 0 && box->ctl->intr;
+	pthread_mutex_unlock(&box->ctl->mtx);
+	return rc;
+}
+
+/*
+ * Like sqlbox_sleep(), but within sqlbox_ctl_enter(), wake early if
+ * interrupted.
+ */
+void
+sqlbox_ctl_sleep(struct sqlbox *box, size_t ms)
+{
+	struct timespec	 ts;
+
+	if (box->ctl == NULL || clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+		sqlbox_sleep(ms);
+		return;
+	}
+
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&box->ctl->mtx);
+	if (box->ctl->depth == 0) {
+		pthread_mutex_unlock(&box->ctl->mtx);
+		sqlbox_sleep(ms);
+		return;
+	}
+	while (!box->ctl->intr && !sqlbox_ctl_pending(box->ctl))
+		if (pthread_cond_timedwait(&box->ctl->cond,
+		    &box->ctl->mtx, &ts) == ETIMEDOUT)
+			break;
+	pthread_mutex_unlock(&box->ctl->mtx);
+}
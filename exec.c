@@ -32,6 +32,11 @@
 #include "sqlbox.h"
 #include "extern.h"
 
+/*
+ * Default maximum runs of a statement by sqlbox_exec_chunk().
+ */
+#define	SQLBOX_CHUNK_MAX 10000 /* max. runs */
+
 /*
  * Return TRUE if the current role has the ability to prepare the given
  * statement (or no roles are specified), FALSE if otherwise.
@@ -62,9 +67,11 @@ sqlbox_exec_inner(struct sqlbox *box,
 	enum sqlbox_op op, size_t srcid, size_t pstmt, size_t psz, 
 	const struct sqlbox_parm *ps, unsigned long flags)
 {
-	size_t		 pos = 0, bufsz = SQLBOX_FRAME, i;
+	size_t		 pos = 0, bufsz = SQLBOX_FRAME, i, fdsz = 0;
 	uint32_t	 val;
-	char		*buf;
+	char		*buf = NULL;
+	int		*fds = NULL, rc = 0;
+	struct sqlbox_parm *cp = NULL;
 
 	/* 
 	 * Make sure explicit-sized strings are NUL terminated.
@@ -80,9 +87,39 @@ sqlbox_exec_inner(struct sqlbox *box,
 			return 0;
 		}
 
+	/*
+	 * Pass large blobs in memory files instead of copying them
+	 * through the frame, or inline if these aren't available.
+	 */
+
+	if (box->cfg.comm.memfd > 0)
+		for (i = 0; i < psz; i++) {
+			if (ps[i].type != SQLBOX_PARM_BLOB ||
+			    ps[i].sz < box->cfg.comm.memfd)
+				continue;
+			if (cp == NULL) {
+				cp = calloc(psz, sizeof(struct sqlbox_parm));
+				fds = calloc(psz, sizeof(int));
+				if (cp == NULL || fds == NULL) {
+					sqlbox_warn(&box->cfg, 
+						"exec: calloc");
+					goto out;
+				}
+				memcpy(cp, ps, 
+					psz * sizeof(struct sqlbox_parm));
+			}
+			if ((fds[fdsz] = sqlbox_memfd
+			    (box, ps[i].bparm, ps[i].sz)) == -1)
+				continue;
+			fdsz++;
+			cp[i].type = SQLBOX_PARM__FD;
+		}
+	if (cp != NULL)
+		ps = cp;
+
 	if ((buf = calloc(bufsz, 1)) == NULL) {
 		sqlbox_warn(&box->cfg, "exec: calloc");
-		return 0;
+		goto out;
 	}
 
 	/* Skip the frame size til we get the packed parms. */
@@ -109,8 +146,7 @@ sqlbox_exec_inner(struct sqlbox *box,
 
 	if (!sqlbox_parm_pack(box, psz, ps, &buf, &pos, &bufsz)) {
 		sqlbox_warnx(&box->cfg, "exec: sqlbox_parm_pack");
-		free(buf);
-		return 0;
+		goto out;
 	}
 
 	/* Go back and do the frame size. */
@@ -118,22 +154,47 @@ sqlbox_exec_inner(struct sqlbox *box,
 	val = htole32(pos - 4);
 	memcpy(buf, (char *)&val, sizeof(uint32_t));
 
-	/* Write data, free our buffer. */
+	/* Write data and any memory files following it. */
 
-	if (!sqlbox_write(box, buf, pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
-		sqlbox_warnx(&box->cfg, "exec: sqlbox_write");
-		free(buf);
-		return 0;
+	if (!sqlbox_write_op(box, buf,
+	    pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
+		sqlbox_warnx(&box->cfg, "exec: sqlbox_write_op");
+		goto out;
 	}
+	for (i = 0; i < fdsz; i++)
+		if (!sqlbox_write_fd(box, fds[i])) {
+			sqlbox_warnx(&box->cfg, "exec: sqlbox_write_fd");
+			goto out;
+		}
 
+	rc = 1;
+out:
+	for (i = 0; i < fdsz; i++)
+		close(fds[i]);
+	free(fds);
+	free(cp);
 	free(buf);
-	return 1;
+	return rc;
 }
 
-int
-sqlbox_exec_async(struct sqlbox *box, size_t srcid, size_t pstmt, 
-	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
+/*
+ * Write an asynchronous statement execution.
+ * If the window is full and "block" is zero, nothing is written.
+ * Returns <0 if the write would block, 0 on failure, >0 on success.
+ */
+static int
+sqlbox_exec_async_inner(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts,
+	int block)
 {
+	int	 c;
+
+	if ((c = sqlbox_credit(box, block)) < 0)
+		return -1;
+	else if (c == 0) {
+		sqlbox_warnx(&box->cfg, "exec-async: sqlbox_credit");
+		return 0;
+	}
 
 	if (!sqlbox_exec_inner(box, SQLBOX_OP_EXEC_ASYNC, 
 	    srcid, pstmt, psz, ps, opts)) {
@@ -144,6 +205,28 @@ sqlbox_exec_async(struct sqlbox *box, size_t srcid, size_t pstmt,
 	return 1;
 }
 
+int
+sqlbox_exec_async(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
+{
+
+	return sqlbox_exec_async_inner
+		(box, srcid, pstmt, psz, ps, opts, 1) > 0;
+}
+
+int
+sqlbox_exec_async_nb(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts,
+	int *blocked)
+{
+	int	 c;
+
+	c = sqlbox_exec_async_inner
+		(box, srcid, pstmt, psz, ps, opts, 0);
+	*blocked = c < 0;
+	return c != 0;
+}
+
 enum sqlbox_code
 sqlbox_exec(struct sqlbox *box, size_t srcid, size_t pstmt, 
 	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
@@ -164,14 +247,228 @@ sqlbox_exec(struct sqlbox *box, size_t srcid, size_t pstmt,
 	return (enum sqlbox_code)le32toh(val);
 }
 
+enum sqlbox_code
+sqlbox_exec_ext(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts,
+	int64_t *changes, int64_t *lastid)
+{
+	char	 buf[sizeof(uint32_t) + sizeof(int64_t) * 2];
+	int64_t	 val;
+
+	if (!sqlbox_exec_inner(box, SQLBOX_OP_EXEC_EXT,
+	    srcid, pstmt, psz, ps, opts)) {
+		sqlbox_warnx(&box->cfg, "exec-ext: sqlbox_exec_inner");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (!sqlbox_read(box, buf, sizeof(buf))) {
+		sqlbox_warnx(&box->cfg, "exec-ext: sqlbox_read");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (changes != NULL) {
+		memcpy(&val, buf + sizeof(uint32_t), sizeof(int64_t));
+		*changes = le64toh(val);
+	}
+	if (lastid != NULL) {
+		memcpy(&val, buf + sizeof(uint32_t) + 
+			sizeof(int64_t), sizeof(int64_t));
+		*lastid = le64toh(val);
+	}
+	return (enum sqlbox_code)le32toh(*(uint32_t *)buf);
+}
+
+enum sqlbox_code
+sqlbox_exec_chunk(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts,
+	int64_t *changes)
+{
+	char	 buf[sizeof(uint32_t) + sizeof(int64_t)];
+	int64_t	 val;
+
+	if (!sqlbox_exec_inner(box, SQLBOX_OP_EXEC_CHUNK,
+	    srcid, pstmt, psz, ps, opts)) {
+		sqlbox_warnx(&box->cfg, "exec-chunk: sqlbox_exec_inner");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (!sqlbox_read(box, buf, sizeof(buf))) {
+		sqlbox_warnx(&box->cfg, "exec-chunk: sqlbox_read");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (changes != NULL) {
+		memcpy(&val, buf + sizeof(uint32_t), sizeof(int64_t));
+		*changes = le64toh(val);
+	}
+	return (enum sqlbox_code)le32toh(*(uint32_t *)buf);
+}
+
+enum sqlbox_code
+sqlbox_exec_rows(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts,
+	const struct sqlbox_parmset **rows, size_t *rowsz)
+{
+	const char	*frame;
+	size_t		 framesz;
+
+	*rows = NULL;
+	*rowsz = 0;
+	sqlbox_res_clear(&box->rows);
+
+	if (!sqlbox_exec_inner(box, SQLBOX_OP_EXEC_ROWS,
+	    srcid, pstmt, psz, ps, opts)) {
+		sqlbox_warnx(&box->cfg, "exec-rows: sqlbox_exec_inner");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (!sqlbox_res_read(box, &box->rows, &frame, &framesz)) {
+		sqlbox_warnx(&box->cfg, "exec-rows: sqlbox_res_read");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (!sqlbox_res_unpack(box, &box->rows, frame, framesz)) {
+		sqlbox_warnx(&box->cfg, "exec-rows: sqlbox_res_unpack");
+		return SQLBOX_CODE_ERROR;
+	} else if (box->rows.setsz == 0) {
+		sqlbox_warnx(&box->cfg, "exec-rows: no result code");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	/* The last set is always the terminating code. */
+
+	*rows = box->rows.set;
+	*rowsz = box->rows.setsz - 1;
+	return box->rows.set[box->rows.setsz - 1].code;
+}
+
+/*
+ * Step through all rows of the prepared statement in "st", packing
+ * each into its result buffer as with sqlbox_op_step(), then write
+ * them all back.
+ * The last packed set has no parameters and the final code.
+ * Returns SQLBOX_CODE_ERROR on failure, SQLBOX_CODE_OK otherwise.
+ */
+static enum sqlbox_code
+sqlbox_op_exec_pack(struct sqlbox *box, struct sqlbox_stmt *st)
+{
+	size_t	 pos = sizeof(uint32_t);
+	int	 rc;
+	uint32_t val;
+
+	while ((rc = sqlbox_pack_step(box, &pos, st)) > 0)
+		continue;
+	if (rc < 0) {
+		sqlbox_warnx(&box->cfg, "%s: exec-rows: "
+			"sqlbox_pack_step", st->db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: exec-rows: "
+			"statement: %s", st->db->src->fname, 
+			st->pstmt->stmt);
+		return SQLBOX_CODE_ERROR;
+	}
+
+	val = htole32(pos - sizeof(uint32_t));
+	memcpy(st->res.buf, (char *)&val, sizeof(uint32_t));
+	pos = pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME;
+	if (!sqlbox_res_write(box, st->res.buf, pos)) {
+		sqlbox_warnx(&box->cfg, "exec-rows: sqlbox_res_write");
+		return SQLBOX_CODE_ERROR;
+	}
+	return SQLBOX_CODE_OK;
+}
+
+/*
+ * Step the prepared statement "stmt" to completion, then reset and
+ * repeat for as long as it changes rows, pausing between runs for the
+ * statement's configured time.
+ * Outside of explicit transactions, each run is its own transaction,
+ * so the write lock is released between chunks.
+ * The budget applies to each run, and the number of runs is capped.
+ * The whole loop, pauses included, is one control window, so a single
+ * interrupt stops it.
+ * Sets the total number of rows changed in "changes".
+ * Returns the code of the last run, SQLBOX_CODE_BUDGET if still
+ * changing rows after the maximum runs, SQLBOX_CODE_ERROR on failure.
+ */
+static enum sqlbox_code
+sqlbox_op_exec_chunks(struct sqlbox *box, struct sqlbox_db *db,
+	const struct sqlbox_pstmt *pst, sqlite3_stmt *stmt, 
+	unsigned long flags, int64_t *changes)
+{
+	enum sqlbox_code	 code;
+	size_t			 cols, runs, max;
+	int64_t			 n;
+	struct sqlbox_budget	 budget;
+
+	*changes = 0;
+	max = pst->chunk_max ? pst->chunk_max : SQLBOX_CHUNK_MAX;
+	sqlbox_ctl_enter(box, NULL);
+
+	for (runs = 1; ; runs++) {
+		sqlbox_budget_init(&budget, pst);
+		do {
+			code = sqlbox_wrap_step(box, db, pst, stmt, 
+				&cols, (flags & SQLBOX_STMT_CONSTRAINT), 
+				&budget);
+		} while (code == SQLBOX_CODE_OK && cols > 0);
+
+		if (code == SQLBOX_CODE_ERROR) {
+			sqlbox_warnx(&box->cfg, "%s: exec-chunk: "
+				"sqlbox_wrap_step", db->src->fname);
+			sqlbox_warnx(&box->cfg, "%s: exec-chunk: "
+				"statement: %s", db->src->fname, 
+				pst->stmt);
+			break;
+		} else if (code != SQLBOX_CODE_OK)
+			break;
+
+		/* Read-only statements don't reset the changes. */
+
+		if (sqlite3_stmt_readonly(stmt))
+			break;
+		sqlbox_debug(&box->cfg, "sqlite3_changes64: %s", 
+			db->src->fname);
+		if ((n = sqlite3_changes64(db->db)) == 0)
+			break;
+		*changes += n;
+
+		if (runs >= max) {
+			sqlbox_debug(&box->cfg, "%s: exec-chunk: "
+				"over budget after %zu runs: %s",
+				db->src->fname, runs, pst->stmt);
+			code = SQLBOX_CODE_BUDGET;
+			break;
+		}
+
+		/* 
+		 * Interrupts while pausing are picked up before the
+		 * next run starts.
+		 */
+
+		sqlbox_debug(&box->cfg, "%s: sqlite3_reset: %s",
+			db->src->fname, pst->stmt);
+		sqlite3_reset(stmt);
+		if (pst->chunk_ms)
+			sqlbox_ctl_sleep(box, pst->chunk_ms);
+	}
+
+	sqlbox_ctl_leave(box);
+	return code;
+}
+
 /*
  * Prepare and bind parameters to a statement in one step.
  * Do not send anything back to the client: this is done by the caller
  * depending upon the mode.
- * Return the allocated statement on success, NULL on failure.
+ * If "rows" is not NULL, all rows are packed into its result buffer,
+ * which must be primed, followed by the final code.
+ * If "chunks" is not NULL, the statement is run in chunks as with
+ * sqlbox_op_exec_chunks() and the total changes set in "chunks".
+ * Return the statement's code, SQLBOX_CODE_ERROR on failure.
  */
 static enum sqlbox_code
-sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz,
+	struct sqlbox_stmt *rows, int64_t *chunks)
 {
 	size_t	 		 idx, cols, psz, parmsz;
 	struct sqlbox_db	*db;
@@ -180,6 +477,7 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 	struct sqlbox_parm	*parms = NULL;
 	enum sqlbox_code	 code;
 	unsigned long		 flags;
+	struct sqlbox_budget	 budget;
 
 	/* 
 	 * Read the source identifier, whether we can have constraints,
@@ -195,12 +493,13 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 	buf += sizeof(uint32_t);
 	sz -= sizeof(uint32_t);
 
-	db = sqlbox_db_find(box, le32toh(*(uint32_t *)buf));
+	db = sqlbox_db_find_open(box, le32toh(*(uint32_t *)buf));
 	buf += sizeof(uint32_t);
 	sz -= sizeof(uint32_t);
 
 	if (db == NULL) {
-		sqlbox_warnx(&box->cfg, "exec: sqlbox_db_find");
+		sqlbox_warnx(&box->cfg, "exec: "
+			"sqlbox_db_find_open");
 		return SQLBOX_CODE_ERROR;
 	}
 
@@ -222,6 +521,7 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 		return SQLBOX_CODE_ERROR;
 	}
 	pst = &box->cfg.stmts.stmts[idx];
+	sqlbox_budget_init(&budget, pst);
 
 	/* Now the parameters. */
 
@@ -239,6 +539,12 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 		free(parms);
 		return SQLBOX_CODE_ERROR;
 	}
+	if (!sqlbox_parm_map(box, parms, parmsz)) {
+		sqlbox_warnx(&box->cfg, "%s: exec: "
+			"sqlbox_parm_map", db->src->fname);
+		free(parms);
+		return SQLBOX_CODE_ERROR;
+	}
 
 	/*
 	 * If we have no parameters, short-circuit into using sqlite3's
@@ -246,9 +552,9 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 	 * stepping, and freeing.
 	 */
 
-	if (parmsz == 0) {
-		code = sqlbox_wrap_exec(box, db, 
-			pst, (flags & SQLBOX_STMT_CONSTRAINT));
+	if (parmsz == 0 && rows == NULL && chunks == NULL) {
+		code = sqlbox_wrap_exec(box, db, pst, 
+			(flags & SQLBOX_STMT_CONSTRAINT), &budget);
 		if (code == SQLBOX_CODE_ERROR) {
 			sqlbox_warnx(&box->cfg, 
 				"%s: exec: sqlbox_wrap_exec", 
@@ -283,8 +589,27 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 		}
 		free(parms);
 
-		code = sqlbox_wrap_step(box, db, pst, stmt, 
-			&cols, (flags & SQLBOX_STMT_CONSTRAINT));
+		if (rows != NULL) {
+			rows->stmt = stmt;
+			rows->idx = idx;
+			rows->pstmt = pst;
+			rows->db = db;
+			rows->flags = flags;
+			rows->budget = budget;
+			code = sqlbox_op_exec_pack(box, rows);
+			sqlbox_wrap_finalise(box, db, pst, stmt);
+			return code;
+		}
+
+		if (chunks != NULL) {
+			code = sqlbox_op_exec_chunks(box, db, pst, 
+				stmt, flags, chunks);
+			sqlbox_wrap_finalise(box, db, pst, stmt);
+			return code;
+		}
+
+		code = sqlbox_wrap_step(box, db, pst, stmt, &cols,
+			(flags & SQLBOX_STMT_CONSTRAINT), &budget);
 		if (code == SQLBOX_CODE_ERROR) {
 			sqlbox_warnx(&box->cfg, 
 				"%s: exec: sqlbox_wrap_step", 
@@ -313,7 +638,7 @@ sqlbox_op_exec_sync(struct sqlbox *box, const char *buf, size_t sz)
 	enum sqlbox_code code;
 	uint32_t	 ack;
 
-	code = sqlbox_op_exec(box, buf, sz);
+	code = sqlbox_op_exec(box, buf, sz, NULL, NULL);
 	if (code == SQLBOX_CODE_ERROR) {
 		sqlbox_warnx(&box->cfg, "exec-sync: sqlbox_op_exec");
 		return 0;
@@ -329,16 +654,436 @@ sqlbox_op_exec_sync(struct sqlbox *box, const char *buf, size_t sz)
 	return 0;
 }
 
+/*
+ * Like sqlbox_op_exec_sync() but also writing back the number of rows
+ * changed and the last inserted row identifier.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_exec_ext(struct sqlbox *box, const char *buf, size_t sz)
+{
+	enum sqlbox_code	 code;
+	struct sqlbox_db	*db;
+	char			 ack[sizeof(uint32_t) + sizeof(int64_t) * 2];
+	uint32_t		 val;
+	int64_t			 changes, lastid;
+
+	code = sqlbox_op_exec(box, buf, sz, NULL, NULL);
+	if (code == SQLBOX_CODE_ERROR) {
+		sqlbox_warnx(&box->cfg, "exec-ext: sqlbox_op_exec");
+		return 0;
+	}
+
+	/* This was already checked by sqlbox_op_exec(). */
+
+	db = sqlbox_db_find(box, le32toh(*(uint32_t *)
+		(buf + sizeof(uint32_t))));
+	assert(db != NULL && db->db != NULL);
+
+	sqlbox_debug(&box->cfg, "sqlite3_changes64: %s", 
+		db->src->fname);
+	val = htole32(code);
+	changes = htole64(sqlite3_changes64(db->db));
+	lastid = htole64(sqlite3_last_insert_rowid(db->db));
+	memcpy(ack, &val, sizeof(uint32_t));
+	memcpy(ack + sizeof(uint32_t), &changes, sizeof(int64_t));
+	memcpy(ack + sizeof(uint32_t) + sizeof(int64_t), 
+		&lastid, sizeof(int64_t));
+
+	if (sqlbox_write(box, ack, sizeof(ack)))
+		return 1;
+	sqlbox_warnx(&box->cfg, "exec-ext: sqlbox_write");
+	return 0;
+}
+
 int
 sqlbox_op_exec_async(struct sqlbox *box, const char *buf, size_t sz)
 {
 	enum sqlbox_code	 code;
+	struct sqlbox_db	*db = NULL;
+	size_t			 i, idx;
 
-	code = sqlbox_op_exec(box, buf, sz);
+	/* 
+	 * Asynchronous writes may be batched into a transaction.
+	 * Failures to look up the source are reported when executing.
+	 * If interrupted while waiting to start the batch, the write
+	 * isn't batched and, within the same control window, is
+	 * interrupted before it starts.
+	 * Statements with a budget may be aborted midway, which makes
+	 * SQLite roll back the whole transaction, so they first commit
+	 * the batch and run on their own.
+	 */
+
+	sqlbox_ctl_enter(box, NULL);
+	if (sz >= sizeof(uint32_t) * 3 &&
+	    (db = sqlbox_db_find_open(box, le32toh(*(uint32_t *)
+	     (buf + sizeof(uint32_t))))) != NULL &&
+	    (db->src->flags & SQLBOX_SRC_BATCH)) {
+		idx = le32toh(*(uint32_t *)(buf + sizeof(uint32_t) * 2));
+		if (idx < box->cfg.stmts.stmtsz &&
+		    (box->cfg.stmts.stmts[idx].budget_ops ||
+		     box->cfg.stmts.stmts[idx].budget_ms)) {
+			if (!sqlbox_batch_commit(box, db)) {
+				sqlbox_warnx(&box->cfg, "exec-async: "
+					"sqlbox_batch_commit");
+				sqlbox_ctl_leave(box);
+				return 0;
+			}
+		} else if (sqlbox_batch_begin(box, db) == 0) {
+			sqlbox_warnx(&box->cfg, "exec-async: "
+				"sqlbox_batch_begin");
+			sqlbox_ctl_leave(box);
+			return 0;
+		}
+	}
+
+	code = sqlbox_op_exec(box, buf, sz, NULL, NULL);
+	sqlbox_ctl_leave(box);
 	if (code == SQLBOX_CODE_ERROR) {
 		sqlbox_warnx(&box->cfg, "exec-async: sqlbox_op_exec");
 		return 0;
 	}
 
+	/* 
+	 * Failed statements change nothing.
+	 * Mapped blobs count as if they were in the frame.
+	 */
+
+	for (i = 0; i < box->mapsz; i++)
+		sz += box->maps[i].sz;
+	if (db != NULL && !sqlbox_batch_add(box, db, 
+	    code == SQLBOX_CODE_OK ? sqlite3_changes64(db->db) : 0, sz)) {
+		sqlbox_warnx(&box->cfg, "exec-async: sqlbox_batch_add");
+		return 0;
+	}
 	return 1;
 }
+
+/*
+ * Like sqlbox_op_exec_sync() but running the statement in chunks until
+ * it changes no more rows, then also writing back the total number of
+ * rows changed.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_exec_chunk(struct sqlbox *box, const char *buf, size_t sz)
+{
+	enum sqlbox_code	 code;
+	char			 ack[sizeof(uint32_t) + sizeof(int64_t)];
+	uint32_t		 val;
+	int64_t			 changes = 0;
+
+	code = sqlbox_op_exec(box, buf, sz, NULL, &changes);
+	if (code == SQLBOX_CODE_ERROR) {
+		sqlbox_warnx(&box->cfg, "exec-chunk: sqlbox_op_exec");
+		return 0;
+	}
+
+	val = htole32(code);
+	changes = htole64(changes);
+	memcpy(ack, &val, sizeof(uint32_t));
+	memcpy(ack + sizeof(uint32_t), &changes, sizeof(int64_t));
+
+	if (sqlbox_write(box, ack, sizeof(ack)))
+		return 1;
+	sqlbox_warnx(&box->cfg, "exec-chunk: sqlbox_write");
+	return 0;
+}
+
+/*
+ * Like sqlbox_op_exec_sync() but always stepping through and writing
+ * back all rows.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_exec_rows(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	 st;
+	enum sqlbox_code	 code;
+
+	memset(&st, 0, sizeof(struct sqlbox_stmt));
+	st.res.bufsz = SQLBOX_FRAME;
+	if ((st.res.buf = calloc(st.res.bufsz, 1)) == NULL) {
+		sqlbox_warn(&box->cfg, "exec-rows: calloc");
+		return 0;
+	}
+
+	code = sqlbox_op_exec(box, buf, sz, &st, NULL);
+	sqlbox_res_clear(&st.res);
+	if (code == SQLBOX_CODE_ERROR) {
+		sqlbox_warnx(&box->cfg, "exec-rows: sqlbox_op_exec");
+		return 0;
+	}
+	return 1;
+}
+
+enum sqlbox_code
+sqlbox_run_program(struct sqlbox *box, size_t srcid, size_t prog,
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
+{
+	uint32_t	 val;
+
+	if (!sqlbox_exec_inner(box, SQLBOX_OP_RUN_PROGRAM,
+	    srcid, prog, psz, ps, opts)) {
+		sqlbox_warnx(&box->cfg, "run-program: "
+			"sqlbox_exec_inner");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (!sqlbox_read(box, (char *)&val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "run-program: sqlbox_read");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	return (enum sqlbox_code)le32toh(val);
+}
+
+/*
+ * Run step "idx" of program "pg" to completion, binding parameters
+ * from the program inputs "in" and the last insert rowids of earlier
+ * steps in "lastids".
+ * Returns the statement's code, SQLBOX_CODE_ERROR on failure.
+ */
+static enum sqlbox_code
+sqlbox_op_run_program_step(struct sqlbox *box, struct sqlbox_db *db,
+	const struct sqlbox_prog *pg, size_t idx, 
+	const struct sqlbox_parm *in, size_t insz,
+	const int64_t *lastids, unsigned long flags)
+{
+	const struct sqlbox_progstep	*ps = &pg->steps[idx];
+	const struct sqlbox_pstmt	*pst;
+	struct sqlbox_parm		*parms = NULL;
+	struct sqlbox_budget		 budget;
+	sqlite3_stmt			*stmt;
+	enum sqlbox_code		 code;
+	size_t				 i, cols;
+
+	if (!sqlbox_rolecheck_stmt(box, ps->stmt)) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_rolecheck_stmt", db->src->fname);
+		return SQLBOX_CODE_ERROR;
+	}
+	pst = &box->cfg.stmts.stmts[ps->stmt];
+	sqlbox_budget_init(&budget, pst);
+
+	/* Wire up parameters from inputs and earlier steps. */
+
+	if (ps->parmsz > 0 && (parms = calloc
+	    (ps->parmsz, sizeof(struct sqlbox_parm))) == NULL) {
+		sqlbox_warn(&box->cfg, "run-program: calloc");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	for (i = 0; i < ps->parmsz; i++)
+		switch (ps->parms[i].type) {
+		case SQLBOX_PROGP_INPUT:
+			if (ps->parms[i].idx >= insz) {
+				sqlbox_warnx(&box->cfg, "%s: "
+					"run-program: step %zu: "
+					"bad input %zu (have %zu)", 
+					db->src->fname, idx,
+					ps->parms[i].idx, insz);
+				free(parms);
+				return SQLBOX_CODE_ERROR;
+			}
+			parms[i] = in[ps->parms[i].idx];
+			break;
+		case SQLBOX_PROGP_LASTID:
+			assert(ps->parms[i].idx < idx);
+			parms[i].type = SQLBOX_PARM_INT;
+			parms[i].iparm = lastids[ps->parms[i].idx];
+			break;
+		default:
+			abort();
+		}
+
+	if ((stmt = sqlbox_wrap_prep(box, db, pst)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_wrap_prep", db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"statement: %s", db->src->fname, pst->stmt);
+		free(parms);
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (!sqlbox_parm_bind(box, db, pst, stmt, parms, ps->parmsz)) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_parm_bind", db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"statement: %s", db->src->fname, pst->stmt);
+		sqlbox_wrap_finalise(box, db, pst, stmt);
+		free(parms);
+		return SQLBOX_CODE_ERROR;
+	}
+	free(parms);
+
+	/* Step to completion, discarding any rows. */
+
+	do {
+		code = sqlbox_wrap_step(box, db, pst, stmt, &cols,
+			(flags & SQLBOX_STMT_CONSTRAINT), &budget);
+	} while (code == SQLBOX_CODE_OK && cols > 0);
+
+	if (code == SQLBOX_CODE_ERROR) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_wrap_step", db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"statement: %s", db->src->fname, pst->stmt);
+	}
+	sqlbox_wrap_finalise(box, db, pst, stmt);
+	return code;
+}
+
+/*
+ * Run all steps of a statement program, stopping at the first that
+ * doesn't succeed.
+ * Unless disabled, these are wrapped in a savepoint, which is rolled
+ * back if any step doesn't succeed.
+ * Writes back the code of the last step run.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_run_program(struct sqlbox *box, const char *buf, size_t sz)
+{
+	size_t	 		 i, idx, psz, parmsz;
+	struct sqlbox_db	*db;
+	const struct sqlbox_prog *pg;
+	struct sqlbox_parm	*parms = NULL;
+	int64_t			*lastids = NULL;
+	enum sqlbox_code	 code = SQLBOX_CODE_OK;
+	unsigned long		 flags;
+	uint32_t		 ack;
+	int			 trans;
+	struct sqlbox_pstmt	 begin = {
+		.stmt = (char *)"SAVEPOINT sqlbox_prog"
+	};
+	struct sqlbox_pstmt	 rollback = {
+		.stmt = (char *)"ROLLBACK TO sqlbox_prog"
+	};
+	struct sqlbox_pstmt	 release = {
+		.stmt = (char *)"RELEASE sqlbox_prog"
+	};
+
+	/* Read the flags, source, and program identifier. */
+
+	if (sz < sizeof(uint32_t) * 3) {
+		sqlbox_warnx(&box->cfg, "run-program: bad frame size");
+		return 0;
+	}
+
+	flags = le32toh(*(uint32_t *)buf);
+	buf += sizeof(uint32_t);
+	sz -= sizeof(uint32_t);
+
+	db = sqlbox_db_find_open(box, le32toh(*(uint32_t *)buf));
+	buf += sizeof(uint32_t);
+	sz -= sizeof(uint32_t);
+
+	if (db == NULL) {
+		sqlbox_warnx(&box->cfg, "run-program: "
+			"sqlbox_db_find_open");
+		return 0;
+	}
+
+	idx = le32toh(*(uint32_t *)buf);
+	buf += sizeof(uint32_t);
+	sz -= sizeof(uint32_t);
+
+	if (idx >= box->cfg.progs.progsz) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"bad program %zu", db->src->fname, idx);
+		return 0;
+	}
+	pg = &box->cfg.progs.progs[idx];
+
+	/* Now the program inputs. */
+
+	psz = sqlbox_parm_unpack(box, &parms, &parmsz, buf, sz);
+	if (psz == 0) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_parm_unpack", db->src->fname);
+		return 0;
+	} else if (psz != sz) {
+		sqlbox_warnx(&box->cfg, "run-program: bad frame size");
+		free(parms);
+		return 0;
+	} else if (!sqlbox_parm_map(box, parms, parmsz)) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_parm_map", db->src->fname);
+		free(parms);
+		return 0;
+	}
+
+	if (pg->stepsz > 0 && (lastids = calloc
+	    (pg->stepsz, sizeof(int64_t))) == NULL) {
+		sqlbox_warn(&box->cfg, "run-program: calloc");
+		free(parms);
+		return 0;
+	}
+
+	/*
+	 * The savepoint statements run outside of any control window
+	 * so that they neither fail on nor consume a held interrupt:
+	 * the first step will pick it up instead.
+	 */
+
+	trans = !(pg->flags & SQLBOX_PROG_NOTRANS);
+	if (trans && sqlbox_wrap_exec_sys
+	    (box, db, &begin) != SQLBOX_CODE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_wrap_exec_sys", db->src->fname);
+		free(lastids);
+		free(parms);
+		return 0;
+	}
+
+	for (i = 0; i < pg->stepsz; i++) {
+		code = sqlbox_op_run_program_step(box, db, pg, 
+			i, parms, parmsz, lastids, flags);
+		if (code != SQLBOX_CODE_OK)
+			break;
+		lastids[i] = sqlite3_last_insert_rowid(db->db);
+	}
+
+	free(lastids);
+	free(parms);
+
+	/* 
+	 * Roll back if any step failed.
+	 * A savepoint must always be released, even after rollback.
+	 * An interrupted or over-budget write may already have made
+	 * SQLite roll back the whole transaction, savepoint included,
+	 * in which case there's nothing left to roll back or release.
+	 */
+
+	if (trans && sqlite3_get_autocommit(db->db)) {
+		sqlbox_debug(&box->cfg, "%s: run-program: "
+			"already rolled back", db->src->fname);
+		trans = 0;
+	}
+
+	if (trans && code != SQLBOX_CODE_OK &&
+	    sqlbox_wrap_exec_sys(box, db, &rollback) != SQLBOX_CODE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_wrap_exec_sys", db->src->fname);
+		return 0;
+	}
+	if (trans && sqlbox_wrap_exec_sys
+	    (box, db, &release) != SQLBOX_CODE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"sqlbox_wrap_exec_sys", db->src->fname);
+		return 0;
+	}
+
+	if (code == SQLBOX_CODE_ERROR) {
+		sqlbox_warnx(&box->cfg, "%s: run-program: "
+			"program %zu: step %zu", db->src->fname, idx, i);
+		return 0;
+	}
+
+	ack = htole32(code);
+	if (sqlbox_write(box, (char *)&ack, sizeof(uint32_t)))
+		return 1;
+	sqlbox_warnx(&box->cfg, "run-program: sqlbox_write");
+	return 0;
+}
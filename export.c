@@ -0,0 +1,563 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Rows are buffered and written to the descriptor once the buffer
+ * holds at least this many bytes.
+ */
+#define	SQLBOX_EXPORT_BUF (SQLBOX_FRAME * 64)
+
+/*
+ * Buffered output to the export descriptor.
+ */
+struct	sqlbox_out {
+	int		 fd; /* export descriptor */
+	char		*buf; /* pending output */
+	size_t		 bufsz; /* allocated size of buf */
+	size_t		 pos; /* bytes pending in buf */
+	int		 err; /* writing to fd failed */
+};
+
+enum sqlbox_code
+sqlbox_export(struct sqlbox *box, size_t id, int fd, enum sqlbox_fmt fmt)
+{
+	struct sqlbox_stmt	*st;
+	uint32_t		 val[2];
+
+	if (fmt > SQLBOX_FMT_JSON) {
+		sqlbox_warnx(&box->cfg, "export: bad format");
+		return SQLBOX_CODE_ERROR;
+	} else if (fd < 0) {
+		sqlbox_warnx(&box->cfg, "export: bad descriptor");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if ((st = sqlbox_stmt_find(box, id)) == NULL) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_stmt_find");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	/* Rows already read but not yet stepped would be lost. */
+
+	if (st->res.curset < st->res.setsz) {
+		sqlbox_warnx(&box->cfg, "export: statement "
+			"has unstepped rows");
+		return SQLBOX_CODE_ERROR;
+	}
+	sqlbox_res_clear(&st->res);
+
+	val[0] = htole32(id);
+	val[1] = htole32(fmt);
+	if (!sqlbox_write_frame(box, 
+	    SQLBOX_OP_EXPORT, (char *)val, sizeof(val))) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_write_frame");
+		return SQLBOX_CODE_ERROR;
+	}
+	if (!sqlbox_write_fd(box, fd)) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_write_fd");
+		return SQLBOX_CODE_ERROR;
+	}
+	if (!sqlbox_read(box, (char *)val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_read");
+		return SQLBOX_CODE_ERROR;
+	}
+	return (enum sqlbox_code)le32toh(val[0]);
+}
+
+/*
+ * Write out everything that's pending in "out".
+ * If the descriptor doesn't accept the output, such as when the reader
+ * has gone away, this is marked in "out" and the output discarded.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_out_flush(struct sqlbox *box, struct sqlbox_out *out)
+{
+
+	if (out->pos == 0)
+		return 1;
+	if (!sqlbox_write_all(box, out->fd, out->buf, out->pos)) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_write_all");
+		out->err = 1;
+		out->pos = 0;
+		return 0;
+	}
+	out->pos = 0;
+	return 1;
+}
+
+/*
+ * Make sure that "out" has room for "sz" more bytes.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_out_reserve(struct sqlbox *box, struct sqlbox_out *out, size_t sz)
+{
+	void	*pp;
+	size_t	 nsz;
+
+	if (out->pos + sz <= out->bufsz)
+		return 1;
+	nsz = out->bufsz + sz + SQLBOX_EXPORT_BUF;
+	if ((pp = realloc(out->buf, nsz)) == NULL) {
+		sqlbox_warn(&box->cfg, "export: realloc");
+		return 0;
+	}
+	out->buf = pp;
+	out->bufsz = nsz;
+	return 1;
+}
+
+static int
+sqlbox_out_put(struct sqlbox *box, struct sqlbox_out *out, 
+	const char *buf, size_t sz)
+{
+
+	if (!sqlbox_out_reserve(box, out, sz))
+		return 0;
+	memcpy(out->buf + out->pos, buf, sz);
+	out->pos += sz;
+	return 1;
+}
+
+static int
+sqlbox_out_putc(struct sqlbox *box, struct sqlbox_out *out, char c)
+{
+
+	return sqlbox_out_put(box, out, &c, 1);
+}
+
+/*
+ * Write a number for the integer or real parameter "p".
+ * Non-finite reals are written as "null" if "json" is set.
+ */
+static int
+sqlbox_out_number(struct sqlbox *box, struct sqlbox_out *out, 
+	const struct sqlbox_parm *p, int json)
+{
+	char	 buf[32];
+	int	 c;
+
+	if (p->type == SQLBOX_PARM_INT)
+		c = snprintf(buf, sizeof(buf), "%" PRId64, p->iparm);
+	else if (json && !isfinite(p->fparm))
+		c = snprintf(buf, sizeof(buf), "null");
+	else
+		c = snprintf(buf, sizeof(buf), "%.17g", p->fparm);
+
+	assert(c > 0 && (size_t)c < sizeof(buf));
+	return sqlbox_out_put(box, out, buf, c);
+}
+
+/*
+ * The bytes of a text or blob parameter.
+ * Text excludes the terminating NUL byte.
+ */
+static void
+sqlbox_out_bytes(const struct sqlbox_parm *p, const char **v, size_t *sz)
+{
+
+	if (p->type == SQLBOX_PARM_BLOB) {
+		*v = p->bparm;
+		*sz = p->sz;
+	} else {
+		*v = p->sparm;
+		*sz = p->sz > 0 ? p->sz - 1 : strlen(p->sparm);
+	}
+}
+
+/*
+ * Write "set" as an RFC 4180 record.
+ * Text and blobs are written as-is, quoted if they contain quotes,
+ * commas, or line breaks; the empty string is quoted to distinguish it
+ * from NULL, which is written as nothing at all.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_export_csv(struct sqlbox *box, struct sqlbox_out *out,
+	const struct sqlbox_parmset *set)
+{
+	size_t		 i, j, sz;
+	const char	*v;
+
+	for (i = 0; i < set->psz; i++) {
+		if (i > 0 && !sqlbox_out_putc(box, out, ','))
+			return 0;
+		switch (set->ps[i].type) {
+		case SQLBOX_PARM_NULL:
+			continue;
+		case SQLBOX_PARM_FLOAT:
+		case SQLBOX_PARM_INT:
+			if (!sqlbox_out_number(box, out, &set->ps[i], 0))
+				return 0;
+			continue;
+		case SQLBOX_PARM_BLOB:
+		case SQLBOX_PARM_STRING:
+			break;
+		default:
+			sqlbox_warnx(&box->cfg, "export: bad type");
+			return 0;
+		}
+
+		sqlbox_out_bytes(&set->ps[i], &v, &sz);
+		for (j = 0; j < sz; j++)
+			if (v[j] == ',' || v[j] == '"' ||
+			    v[j] == '\r' || v[j] == '\n')
+				break;
+		if (sz > 0 && j == sz) {
+			if (!sqlbox_out_put(box, out, v, sz))
+				return 0;
+			continue;
+		}
+
+		if (!sqlbox_out_putc(box, out, '"'))
+			return 0;
+		for (j = 0; j < sz; j++) {
+			if (v[j] == '"' && !sqlbox_out_putc(box, out, '"'))
+				return 0;
+			if (!sqlbox_out_putc(box, out, v[j]))
+				return 0;
+		}
+		if (!sqlbox_out_putc(box, out, '"'))
+			return 0;
+	}
+
+	return sqlbox_out_put(box, out, "\r\n", 2);
+}
+
+/*
+ * Write "set" as a JSON array on its own line.
+ * Blobs are written as strings of hexadecimal digits.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_export_json(struct sqlbox *box, struct sqlbox_out *out,
+	const struct sqlbox_parmset *set)
+{
+	size_t		 i, j, sz;
+	const char	*v;
+	char		 buf[8];
+	unsigned char	 c;
+	static const char hex[] = "0123456789abcdef";
+
+	if (!sqlbox_out_putc(box, out, '['))
+		return 0;
+
+	for (i = 0; i < set->psz; i++) {
+		if (i > 0 && !sqlbox_out_putc(box, out, ','))
+			return 0;
+		switch (set->ps[i].type) {
+		case SQLBOX_PARM_NULL:
+			if (!sqlbox_out_put(box, out, "null", 4))
+				return 0;
+			continue;
+		case SQLBOX_PARM_FLOAT:
+		case SQLBOX_PARM_INT:
+			if (!sqlbox_out_number(box, out, &set->ps[i], 1))
+				return 0;
+			continue;
+		case SQLBOX_PARM_BLOB:
+		case SQLBOX_PARM_STRING:
+			break;
+		default:
+			sqlbox_warnx(&box->cfg, "export: bad type");
+			return 0;
+		}
+
+		sqlbox_out_bytes(&set->ps[i], &v, &sz);
+		if (!sqlbox_out_putc(box, out, '"'))
+			return 0;
+		for (j = 0; j < sz; j++) {
+			c = (unsigned char)v[j];
+			if (set->ps[i].type == SQLBOX_PARM_BLOB) {
+				buf[0] = hex[c >> 4];
+				buf[1] = hex[c & 0xf];
+				if (!sqlbox_out_put(box, out, buf, 2))
+					return 0;
+			} else if (c == '"' || c == '\\') {
+				buf[0] = '\\';
+				buf[1] = c;
+				if (!sqlbox_out_put(box, out, buf, 2))
+					return 0;
+			} else if (c < 0x20) {
+				snprintf(buf, sizeof(buf), "\\u%.4x", c);
+				if (!sqlbox_out_put(box, out, buf, 6))
+					return 0;
+			} else if (!sqlbox_out_putc(box, out, c))
+				return 0;
+		}
+		if (!sqlbox_out_putc(box, out, '"'))
+			return 0;
+	}
+
+	return sqlbox_out_put(box, out, "]\n", 2);
+}
+
+/*
+ * Write "set" as a 32-bit length followed by the packed parameters as
+ * for sqlbox_parm_pack(), padded so that the whole row is a multiple of
+ * eight bytes.
+ * The length is of everything following it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_export_binary(struct sqlbox *box, struct sqlbox_out *out,
+	const struct sqlbox_parmset *set)
+{
+	size_t		 start = out->pos;
+	uint32_t	 val;
+
+	assert(start % 8 == 0);
+	if (!sqlbox_out_reserve(box, out, sizeof(uint32_t)))
+		return 0;
+	out->pos += sizeof(uint32_t);
+
+	if (!sqlbox_parm_pack(box, set->psz, set->ps, 
+	    &out->buf, &out->pos, &out->bufsz)) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_parm_pack");
+		return 0;
+	}
+
+	if (!sqlbox_out_reserve(box, out, 8))
+		return 0;
+	while (out->pos % 8)
+		out->buf[out->pos++] = '\0';
+
+	val = htole32(out->pos - start - sizeof(uint32_t));
+	memcpy(out->buf + start, &val, sizeof(uint32_t));
+	return 1;
+}
+
+/*
+ * Write a single row in the format "fmt", flushing if the buffer has
+ * filled.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_export_row(struct sqlbox *box, struct sqlbox_out *out,
+	enum sqlbox_fmt fmt, const struct sqlbox_parmset *set)
+{
+	int	 rc;
+
+	switch (fmt) {
+	case SQLBOX_FMT_BINARY:
+		rc = sqlbox_export_binary(box, out, set);
+		break;
+	case SQLBOX_FMT_CSV:
+		rc = sqlbox_export_csv(box, out, set);
+		break;
+	case SQLBOX_FMT_JSON:
+		rc = sqlbox_export_json(box, out, set);
+		break;
+	default:
+		abort();
+	}
+
+	if (!rc)
+		return 0;
+	return out->pos < SQLBOX_EXPORT_BUF || 
+		sqlbox_out_flush(box, out);
+}
+
+/*
+ * Export rows of "st" that have been cached by multi-stepping, which
+ * are packed as for sqlbox_pack_step().
+ * Clears the cache.
+ * Returns the code of the last row, SQLBOX_CODE_ERROR on failure.
+ */
+static enum sqlbox_code
+sqlbox_export_cached(struct sqlbox *box, struct sqlbox_stmt *st,
+	struct sqlbox_out *out, enum sqlbox_fmt fmt)
+{
+	struct sqlbox_res	 res;
+	enum sqlbox_code	 code = SQLBOX_CODE_OK;
+	size_t			 i;
+	int			 done;
+
+	memset(&res, 0, sizeof(struct sqlbox_res));
+	if (!sqlbox_res_unpack(box, &res, 
+	    st->res.buf + sizeof(uint32_t), 
+	    le32toh(*(uint32_t *)st->res.buf))) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_res_unpack");
+		sqlbox_res_clear(&res);
+		return SQLBOX_CODE_ERROR;
+	}
+
+	for (i = 0; i < res.setsz; i++) {
+		if ((code = res.set[i].code) != SQLBOX_CODE_OK || 
+		    res.set[i].psz == 0)
+			break;
+		if (!sqlbox_export_row(box, out, fmt, &res.set[i])) {
+			code = SQLBOX_CODE_ERROR;
+			break;
+		}
+	}
+
+	sqlbox_res_clear(&res);
+	done = st->res.done;
+	sqlbox_res_clear(&st->res);
+	st->res.done = done;
+	return code;
+}
+
+/*
+ * Step through all remaining rows of a statement, writing them to a
+ * descriptor passed by the client in the requested format.
+ * Writes back the code of the last step, or SQLBOX_CODE_ERROR if the
+ * descriptor didn't accept the output: this is the caller's problem,
+ * not ours, so we keep running.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_export(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+	struct sqlbox_out	 out;
+	struct sqlbox_row	 row;
+	enum sqlbox_fmt		 fmt;
+	enum sqlbox_code	 code = SQLBOX_CODE_OK;
+	size_t			 cols;
+	uint32_t		 val;
+	int			 rc = 0;
+
+	memset(&out, 0, sizeof(struct sqlbox_out));
+	out.fd = -1;
+
+	if (sz != sizeof(uint32_t) * 2) {
+		sqlbox_warnx(&box->cfg, "export: bad frame size");
+		return 0;
+	}
+	if ((st = sqlbox_stmt_find
+	    (box, le32toh(*(uint32_t *)buf))) == NULL) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_stmt_find");
+		return 0;
+	}
+	fmt = le32toh(*(uint32_t *)(buf + sizeof(uint32_t)));
+	if (fmt > SQLBOX_FMT_JSON) {
+		sqlbox_warnx(&box->cfg, "export: bad format");
+		return 0;
+	}
+
+	if (!sqlbox_read_fd(box, &out.fd)) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_read_fd");
+		return 0;
+	}
+
+	out.bufsz = SQLBOX_EXPORT_BUF + SQLBOX_FRAME;
+	if ((out.buf = malloc(out.bufsz)) == NULL) {
+		sqlbox_warn(&box->cfg, "export: malloc");
+		goto out;
+	}
+
+	/* Start with anything cached by multi-stepping. */
+
+	if (st->res.bufsz) {
+		code = sqlbox_export_cached(box, st, &out, fmt);
+		if (code == SQLBOX_CODE_ERROR && !out.err) {
+			sqlbox_warnx(&box->cfg, "%s: export: "
+				"sqlbox_export_cached", 
+				st->db->src->fname);
+			goto out;
+		}
+	}
+
+	while (code == SQLBOX_CODE_OK && !st->res.done) {
+		code = sqlbox_wrap_step(box, st->db, st->pstmt, 
+			st->stmt, &cols, 
+			(st->flags & SQLBOX_STMT_CONSTRAINT), 
+			&st->budget);
+		if (code == SQLBOX_CODE_ERROR) {
+			sqlbox_warnx(&box->cfg, "%s: export: "
+				"sqlbox_wrap_step", st->db->src->fname);
+			sqlbox_warnx(&box->cfg, "%s: export: "
+				"statement: %s", st->db->src->fname, 
+				st->pstmt->stmt);
+			goto out;
+		} else if (code != SQLBOX_CODE_OK || cols == 0)
+			break;
+
+		if (!sqlbox_row_fill(box, st, cols, &row)) {
+			sqlbox_warnx(&box->cfg, "%s: export: "
+				"sqlbox_row_fill", st->db->src->fname);
+			sqlbox_row_clear(&row);
+			goto out;
+		}
+		rc = sqlbox_export_row(box, &out, fmt, &row.set);
+		sqlbox_row_clear(&row);
+		if (!rc && out.err) {
+			code = SQLBOX_CODE_ERROR;
+			break;
+		} else if (!rc) {
+			sqlbox_warnx(&box->cfg, "%s: export: "
+				"sqlbox_export_row", st->db->src->fname);
+			goto out;
+		}
+		rc = 0;
+	}
+
+	/* Whatever happened, there's nothing left to step. */
+
+	st->res.done = 1;
+
+	if (!sqlbox_out_flush(box, &out) && !out.err) {
+		sqlbox_warnx(&box->cfg, "%s: export: "
+			"sqlbox_out_flush", st->db->src->fname);
+		goto out;
+	}
+	if (out.err) {
+		sqlbox_warnx(&box->cfg, "%s: export: descriptor "
+			"failed, output discarded", st->db->src->fname);
+		code = SQLBOX_CODE_ERROR;
+	}
+
+	/* Close before responding so the caller sees all output. */
+
+	close(out.fd);
+	out.fd = -1;
+
+	val = htole32(code);
+	if (!sqlbox_write(box, (char *)&val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "export: sqlbox_write");
+		goto out;
+	}
+	rc = 1;
+out:
+	if (out.fd != -1)
+		close(out.fd);
+	free(out.buf);
+	return rc;
+}
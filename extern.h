@@ -23,14 +23,37 @@
  * operations.
  * It should be less than the block size for socketpair() but big enough
  * to hold an average payload of data (parameters to bind, results).
+ * On SOCK_SEQPACKET channels, the frame basis is always its own record.
  */
 #define	SQLBOX_FRAME	1024
 
+/*
+ * When we're caching results, cache at most 10 times the frame size.
+ * This also bounds batches of results written at once.
+ * XXX: this will probably end up being tuned or dynamically set.
+ */
+#define	SQLBOX_CACHE_MAX (SQLBOX_FRAME * 10)
+
+/*
+ * Maximum number of finalised statements kept for reuse by a shared or
+ * warmed connection.
+ */
+#define	SQLBOX_STMT_CACHE_MAX 64
+
 enum	sqlbox_op {
+	SQLBOX_OP_BLOB_CLOSE,
+	SQLBOX_OP_BLOB_OPEN,
+	SQLBOX_OP_BLOB_READ,
+	SQLBOX_OP_BLOB_WRITE,
 	SQLBOX_OP_CLOSE,
 	SQLBOX_OP_EXEC_ASYNC,
+	SQLBOX_OP_EXEC_CHUNK,
+	SQLBOX_OP_EXEC_EXT,
+	SQLBOX_OP_EXEC_ROWS,
 	SQLBOX_OP_EXEC_SYNC,
+	SQLBOX_OP_EXPORT,
 	SQLBOX_OP_FINAL,
+	SQLBOX_OP_IMPORT,
 	SQLBOX_OP_LASTID,
 	SQLBOX_OP_MSG_SET_DAT,
 	SQLBOX_OP_OPEN_ASYNC,
@@ -38,14 +61,53 @@ enum	sqlbox_op {
 	SQLBOX_OP_PING,
 	SQLBOX_OP_PREPARE_BIND_ASYNC,
 	SQLBOX_OP_PREPARE_BIND_SYNC,
+	SQLBOX_OP_QUERY,
 	SQLBOX_OP_REBIND,
+	SQLBOX_OP_REBIND_MANY,
+	SQLBOX_OP_REBIND_STEP,
 	SQLBOX_OP_ROLE,
+	SQLBOX_OP_RUN_PROGRAM,
+	SQLBOX_OP_STATS,
 	SQLBOX_OP_STEP,
 	SQLBOX_OP_TRANS_CLOSE,
 	SQLBOX_OP_TRANS_OPEN,
 	SQLBOX_OP__MAX
 };
 
+/*
+ * Operations on the control channel, which is serviced by a watcher
+ * thread in the server regardless of what the main thread is doing.
+ * Each is a pair of 32-bit integers: the operation and its argument.
+ */
+enum	sqlbox_ctlop {
+	SQLBOX_CTL_INTERRUPT, /* interrupt active database */
+	SQLBOX_CTL_PING, /* write back argument */
+	SQLBOX_CTL__MAX
+};
+
+/*
+ * Parameter types used only between the client and server.
+ * A blob of at least sqlbox_comm's "memfd" bytes is packed as its length
+ * and passed as a sealed memory file following the frame.
+ * The server maps it with sqlbox_parm_map() and binds without copying.
+ */
+#define	SQLBOX_PARM__FD		0x100 /* in memory file */
+#define	SQLBOX_PARM__MAPPED	0x101 /* mapped by server */
+
+/*
+ * In place of the first result code, indicates that a batch of results
+ * follows in a memory file, its size following.
+ */
+#define	SQLBOX_RES_MEMFD	0xffffffffU
+
+/*
+ * Memory mapped for the duration of an operation.
+ */
+struct	sqlbox_map {
+	void			*addr;
+	size_t			 sz;
+};
+
 /*
  * When the client calls sqlbox_step(3), zero or more results may be
  * transferred from the server.
@@ -58,6 +120,68 @@ struct	sqlbox_res {
 	size_t			 curset;
 	size_t			 setsz;
 	int			 done;
+	void			*map; /* mapped batch or NULL (client) */
+	size_t			 mapsz; /* length of map */
+	struct sqlbox_res	*prev; /* earlier batches of set (client) */
+};
+
+/*
+ * A value produced by an output filter, freed with its row.
+ */
+struct	sqlbox_freen {
+	void			 *dat;
+	void			(*fp)(void *);
+	TAILQ_ENTRY(sqlbox_freen) entries;
+};
+
+TAILQ_HEAD(sqlbox_freeq, sqlbox_freen);
+
+/*
+ * The columns of a stepped row as parameters.
+ */
+struct	sqlbox_row {
+	struct sqlbox_parmset	 set; /* columns */
+	struct sqlbox_freeq	 fq; /* filtered values */
+};
+
+/*
+ * An array parameter bound with sqlite3_bind_pointer() and read by the
+ * sqlbox_array table-valued function.
+ * It's allocated in one block with its elements, which it owns.
+ */
+struct	sqlbox_array {
+	enum sqlbox_parmt	 type; /* SQLBOX_PARM_INT or _STRING */
+	size_t			 sz; /* number of elements */
+	const int64_t		*ints; /* integers, if so typed */
+	const char	       **strs; /* strings, if so typed */
+};
+
+/*
+ * Pointer type of bound struct sqlbox_array.
+ */
+#define	SQLBOX_ARRAY_PTR "sqlbox_array"
+
+/*
+ * State of retrying an operation on a busy or locked source.
+ */
+struct	sqlbox_backoff {
+	const struct sqlbox_retry *retry; /* policy */
+	size_t			 prev; /* last backoff (ms) */
+	size_t			 waited; /* total backoff (ms) */
+	int			 nointr; /* don't wake on interrupt */
+};
+
+/*
+ * Resources used when executing a statement, accumulated over all
+ * steps until it's re-bound, and the limits set by its sqlbox_pstmt.
+ */
+struct	sqlbox_budget {
+	size_t			 maxops; /* VM step limit or 0 */
+	size_t			 maxms; /* wall time limit or 0 */
+	size_t			 ops; /* VM steps used (approximate) */
+	uint64_t		 us; /* wall time used */
+	uint64_t		 start; /* start of current step */
+	int			 over; /* limit exceeded? */
 };
 
 /*
@@ -71,12 +195,51 @@ struct	sqlbox_stmt {
 	struct sqlbox_db	*db; /* source */
 	struct sqlbox_res	 res; /* results, if any */
 	unsigned long		 flags; /* stepping flags */
+	struct sqlbox_budget	 budget; /* execution budget */
 	TAILQ_ENTRY(sqlbox_stmt) entries; /* per-database */
 	TAILQ_ENTRY(sqlbox_stmt) gentries; /* global */
 };
 
 TAILQ_HEAD(sqlbox_stmtq, sqlbox_stmt);
 
+/*
+ * A blob opened for incremental reading or writing.
+ */
+struct	sqlbox_blob {
+	sqlite3_blob		*blob; /* handle */
+	size_t			 idx; /* blob column idx */
+	size_t			 id; /* blob identifier */
+	size_t			 sz; /* length (bytes) */
+	int			 write; /* opened for writing? */
+	TAILQ_ENTRY(sqlbox_blob) entries; /* per-database */
+};
+
+TAILQ_HEAD(sqlbox_blobq, sqlbox_blob);
+
+/*
+ * A prepared statement that's been finalised and kept for reuse.
+ */
+struct	sqlbox_cached {
+	sqlite3_stmt		*stmt; /* reset statement */
+	const struct sqlbox_pstmt *pstmt; /* prepared statement */
+	TAILQ_ENTRY(sqlbox_cached) entries;
+};
+
+TAILQ_HEAD(sqlbox_cacheq, sqlbox_cached);
+
+/*
+ * An underlying connection with a statement cache, used by sources with
+ * SQLBOX_SRC_SHARED or SQLBOX_SRC_WARM.
+ * If shared, it's closed when the last of its opens is closed.
+ */
+struct	sqlbox_conn {
+	sqlite3			*db; /* database */
+	size_t			 refs; /* sqlbox_db using this */
+	size_t			 owner; /* sqlbox_db id in trans or 0 */
+	struct sqlbox_cacheq	 cache; /* statement cache */
+	size_t			 cachesz; /* entries in cache */
+};
+
 /*
  * A database connection.
  * There can be any number of these simultaneously in existence.
@@ -85,29 +248,53 @@ TAILQ_HEAD(sqlbox_stmtq, sqlbox_stmt);
 struct	sqlbox_db {
 	sqlite3			*db; /* database or NULL */
 	struct sqlbox_stmtq	 stmtq; /* used list */
+	struct sqlbox_blobq	 blobq; /* open blobs */
 	size_t			 id; /* source identifier */
 	size_t			 idx; /* source idx */
 	size_t		 	 trans; /* if >0, exp. transaction */
+	int			 batch; /* batching writes? */
+	size_t			 batchrows; /* rows changed in batch */
+	size_t			 batchbytes; /* frame bytes in batch */
+	uint64_t		 batchstart; /* batch start (ms) */
 	const struct sqlbox_src	*src; /* source */
+	struct sqlbox_conn	*conn; /* shared connection or NULL */
 	TAILQ_ENTRY(sqlbox_db)	 entries;
 };
 
 TAILQ_HEAD(sqlbox_dbq, sqlbox_db);
 
+struct	sqlbox_ctl;
+
 struct	sqlbox {
 	struct sqlbox_cfg 	 cfg; /* configuration */
 	size_t			 role; /* current role */
 	struct sqlbox_dbq	 dbq; /* all databases */
 	struct sqlbox_stmtq	 stmtq; /* all statements */
 	int		  	 fd; /* comm channel or -1 */
+	int			 ctlfd; /* control channel or -1 */
+	size_t			 rec; /* max. record if SOCK_SEQPACKET or 0 */
+	struct sqlbox_ctl	*ctl; /* watcher thread (server) */
 	size_t			 lastid; /* last db id */
+	size_t			 pending; /* unacknowledged frames */
+	uint32_t		 opseq; /* operations sent (client) */
+	struct sqlbox_stats	 stats; /* counters (server) */
+	struct sqlbox_res	 rows; /* exec-rows or query (client) */
+	struct sqlbox_map	*maps; /* mapped parameters (server) */
+	size_t			 mapsz; /* no. mapped parameters */
 	pid_t		  	 pid; /* child or (pid_t)-1 */
 	int			 free_msg_dat; /* free sqlbox_msg dat? */
 	sqlbox_cfg_free		 cfg_free_fp;
 };
 
+int	 sqlbox_backoff(struct sqlbox *, struct sqlbox_backoff *);
+int	 sqlbox_blob_free(struct sqlbox *, struct sqlbox_db *,
+		struct sqlbox_blob *);
+void	 sqlbox_backoff_init(struct sqlbox_backoff *,
+		const struct sqlbox_src *);
 void	 sqlbox_sleep(size_t);
 struct sqlbox_db *sqlbox_db_find(struct sqlbox *, size_t);
+struct sqlbox_db *sqlbox_db_find_open(struct sqlbox *, size_t);
+int	 sqlbox_db_open(struct sqlbox *, struct sqlbox_db *);
 struct sqlbox_stmt *sqlbox_stmt_find(struct sqlbox *, size_t);
 void	 sqlbox_warn(const struct sqlbox_cfg *, const char *, ...)
 		__attribute__((format(printf, 2, 3)));
@@ -116,11 +303,34 @@ void	 sqlbox_warnx(const struct sqlbox_cfg *, const char *, ...)
 void	 sqlbox_debug(const struct sqlbox_cfg *, const char *, ...)
 		__attribute__((format(printf, 2, 3)));
 int	 sqlbox_main_loop(struct sqlbox *);
+int	 sqlbox_pack_step(struct sqlbox *, size_t *,
+		struct sqlbox_stmt *);
 void	 sqlbox_res_clear(struct sqlbox_res *);
+int	 sqlbox_res_read(struct sqlbox *, struct sqlbox_res *,
+		const char **, size_t *);
+int	 sqlbox_res_write(struct sqlbox *, const char *, size_t);
+void	 sqlbox_row_clear(struct sqlbox_row *);
+int	 sqlbox_row_fill(struct sqlbox *, struct sqlbox_stmt *, size_t,
+		struct sqlbox_row *);
+int	 sqlbox_res_unpack(struct sqlbox *, struct sqlbox_res *,
+		const char *, size_t);
+const struct sqlbox_parmset
+	*sqlbox_step_read(struct sqlbox *, struct sqlbox_res *);
+int	 sqlbox_step_stmt(struct sqlbox *, struct sqlbox_stmt *);
 
+void			 sqlbox_budget_init(struct sqlbox_budget *,
+				const struct sqlbox_pstmt *);
+int			 sqlbox_wrap_array(struct sqlbox *,
+				struct sqlbox_db *);
+int			 sqlbox_wrap_close(struct sqlbox *,
+				struct sqlbox_db *);
 enum sqlbox_code	 sqlbox_wrap_exec(struct sqlbox *,
 				struct sqlbox_db *, 
-				const struct sqlbox_pstmt *, int);
+				const struct sqlbox_pstmt *, int,
+				struct sqlbox_budget *);
+enum sqlbox_code	 sqlbox_wrap_exec_sys(struct sqlbox *,
+				struct sqlbox_db *, 
+				const struct sqlbox_pstmt *);
 void			 sqlbox_wrap_finalise(struct sqlbox *, 
 				struct sqlbox_db *, 
 				const struct sqlbox_pstmt *, 
@@ -133,26 +343,62 @@ sqlite3			*sqlbox_wrap_open(struct sqlbox *,
 enum sqlbox_code	 sqlbox_wrap_step(struct sqlbox *,
 				struct sqlbox_db *,
 				const struct sqlbox_pstmt *,
-				sqlite3_stmt *, size_t *, int);
+				sqlite3_stmt *, size_t *, int,
+				struct sqlbox_budget *);
+
+void	 sqlbox_ctl_enter(struct sqlbox *, sqlite3 *);
+int	 sqlbox_ctl_interrupted(struct sqlbox *);
+void	 sqlbox_ctl_leave(struct sqlbox *);
+void	 sqlbox_ctl_op(struct sqlbox *);
+void	 sqlbox_ctl_sleep(struct sqlbox *, size_t);
+int	 sqlbox_ctl_start(struct sqlbox *);
+void	 sqlbox_ctl_stop(struct sqlbox *);
+
+int	 sqlbox_batch_add(struct sqlbox *, struct sqlbox_db *,
+		size_t, size_t);
+int	 sqlbox_batch_begin(struct sqlbox *, struct sqlbox_db *);
+int	 sqlbox_batch_commit(struct sqlbox *, struct sqlbox_db *);
+int	 sqlbox_batch_expire(struct sqlbox *, int *);
+int	 sqlbox_batch_flush(struct sqlbox *);
+int	 sqlbox_batch_rollback(struct sqlbox *, struct sqlbox_db *);
 
+int	 sqlbox_credit(struct sqlbox *, int);
 int	 sqlbox_read(struct sqlbox *, char *, size_t);
 int	 sqlbox_read_frame(struct sqlbox *, char **, size_t *, const char **, size_t *);
+int	 sqlbox_read_fd(struct sqlbox *, int *);
+int	 sqlbox_memfd(struct sqlbox *, const void *, size_t);
 int	 sqlbox_write(struct sqlbox *, const char *, size_t);
+int	 sqlbox_write_all(struct sqlbox *, int, const char *, size_t);
+int	 sqlbox_write_fd(struct sqlbox *, int);
+int	 sqlbox_write_op(struct sqlbox *, const char *, size_t);
+int	 sqlbox_xread(struct sqlbox *, int, char *, size_t);
+int	 sqlbox_xwrite(struct sqlbox *, int, const char *, size_t);
 int	 sqlbox_write_frame(struct sqlbox *,
 		enum sqlbox_op, const char *, size_t);
 
 int	 sqlbox_parm_bind(struct sqlbox *, struct sqlbox_db *, 
 		const struct sqlbox_pstmt *, sqlite3_stmt *, 
 		const struct sqlbox_parm *, size_t);
+int	 sqlbox_parm_map(struct sqlbox *, struct sqlbox_parm *, size_t);
+void	 sqlbox_parm_unmap(struct sqlbox *);
 int	 sqlbox_parm_pack(struct sqlbox *, size_t, 
 		const struct sqlbox_parm *, char **, size_t *, size_t *);
 size_t	 sqlbox_parm_unpack(struct sqlbox *, struct sqlbox_parm **, 
 		size_t *, const char *, size_t);
 
+int	 sqlbox_op_blob_close(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_blob_open(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_blob_read(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_blob_write(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_close(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_exec_async(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_exec_chunk(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_exec_ext(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_exec_rows(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_exec_sync(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_export(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_finalise(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_import(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_lastid(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_msg_set_dat(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_open_async(struct sqlbox *, const char *, size_t);
@@ -160,8 +406,13 @@ int	 sqlbox_op_open_sync(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_ping(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_prepare_bind_async(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_prepare_bind_sync(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_query(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_rebind(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_rebind_many(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_rebind_step(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_role(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_run_program(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_stats(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_step(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_trans_close(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_trans_open(struct sqlbox *, const char *, size_t);
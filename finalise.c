@@ -47,6 +47,9 @@ sqlbox_finalise(struct sqlbox *box, size_t id)
 	if ((st = sqlbox_stmt_find(box, id)) == NULL) {
 		sqlbox_warnx(&box->cfg, "finalise: sqlbox_stmt_find");
 		return 0;
+	} else if (!sqlbox_credit(box, 1)) {
+		sqlbox_warnx(&box->cfg, "finalise: sqlbox_credit");
+		return 0;
 	}
 	TAILQ_REMOVE(&box->stmtq, st, gentries);
 	sqlbox_stmt_free(st);
@@ -0,0 +1,572 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Input is read from the descriptor in at least this many bytes.
+ */
+#define	SQLBOX_IMPORT_BUF (SQLBOX_FRAME * 64)
+
+/*
+ * Buffered input from the import descriptor.
+ */
+struct	sqlbox_in {
+	int			 fd; /* import descriptor */
+	char			*buf; /* read but unparsed input */
+	size_t			 bufsz; /* allocated size of buf */
+	size_t			 pos; /* parse position in buf */
+	size_t			 len; /* bytes of input in buf */
+	int			 eof; /* no more input to read */
+	size_t			 max; /* longest row accepted */
+	char			*rec; /* current record */
+	size_t			 recsz; /* allocated size of rec */
+	struct sqlbox_parm	*parms; /* current record's fields */
+	size_t			 parmsz; /* allocated size of parms */
+};
+
+/*
+ * Return TRUE if the current role has the ability to prepare the given
+ * statement (or no roles are specified), FALSE if otherwise.
+ */
+static int
+sqlbox_rolecheck_stmt(struct sqlbox *box, size_t idx)
+{
+	size_t	 i;
+
+	if (box->cfg.roles.rolesz == 0)
+		return 1;
+	for (i = 0; i < box->cfg.roles.roles[box->role].stmtsz; i++)
+		if (box->cfg.roles.roles[box->role].stmts[i] == idx)
+			return 1;
+	sqlbox_warnx(&box->cfg, "import: statement "
+		"%zu denied to role %zu", idx, box->role);
+	return 0;
+}
+
+enum sqlbox_code
+sqlbox_import(struct sqlbox *box, size_t srcid, size_t idx, int fd,
+	enum sqlbox_fmt fmt, size_t batchrows, size_t *rows, 
+	size_t *conflict)
+{
+	uint32_t	 val[4];
+	char		 buf[sizeof(uint32_t) + sizeof(uint64_t) * 2];
+	uint64_t	 v;
+
+	if (fmt != SQLBOX_FMT_BINARY && fmt != SQLBOX_FMT_CSV) {
+		sqlbox_warnx(&box->cfg, "import: bad format");
+		return SQLBOX_CODE_ERROR;
+	} else if (fd < 0) {
+		sqlbox_warnx(&box->cfg, "import: bad descriptor");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	val[0] = htole32(srcid);
+	val[1] = htole32(idx);
+	val[2] = htole32(fmt);
+	val[3] = htole32(batchrows);
+	if (!sqlbox_write_frame(box, 
+	    SQLBOX_OP_IMPORT, (char *)val, sizeof(val))) {
+		sqlbox_warnx(&box->cfg, "import: sqlbox_write_frame");
+		return SQLBOX_CODE_ERROR;
+	}
+	if (!sqlbox_write_fd(box, fd)) {
+		sqlbox_warnx(&box->cfg, "import: sqlbox_write_fd");
+		return SQLBOX_CODE_ERROR;
+	}
+	if (!sqlbox_read(box, buf, sizeof(buf))) {
+		sqlbox_warnx(&box->cfg, "import: sqlbox_read");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	if (rows != NULL) {
+		memcpy(&v, buf + sizeof(uint32_t), sizeof(uint64_t));
+		*rows = le64toh(v);
+	}
+	if (conflict != NULL) {
+		memcpy(&v, buf + sizeof(uint32_t) + 
+			sizeof(uint64_t), sizeof(uint64_t));
+		*conflict = le64toh(v);
+	}
+	return (enum sqlbox_code)le32toh(*(uint32_t *)buf);
+}
+
+/*
+ * Read more input, first moving unparsed input to the front of the
+ * buffer and growing it if it's full.
+ * Sets "eof" if there's no more input.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_in_fill(struct sqlbox *box, struct sqlbox_in *in)
+{
+	struct pollfd	 pfd = { .fd = in->fd, .events = POLLIN };
+	ssize_t		 rsz;
+	void		*pp;
+
+	if (in->pos > 0) {
+		memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+		in->len -= in->pos;
+		in->pos = 0;
+	}
+
+	if (in->bufsz - in->len < SQLBOX_IMPORT_BUF) {
+		pp = realloc(in->buf, in->bufsz + SQLBOX_IMPORT_BUF);
+		if (pp == NULL) {
+			sqlbox_warn(&box->cfg, "import: realloc");
+			return 0;
+		}
+		in->buf = pp;
+		in->bufsz += SQLBOX_IMPORT_BUF;
+	}
+
+	for (;;) {
+		rsz = read(in->fd, in->buf + in->len, in->bufsz - in->len);
+		if (rsz != -1)
+			break;
+		else if (errno == EINTR)
+			continue;
+		else if (errno != EAGAIN) {
+			sqlbox_warn(&box->cfg, "import: read");
+			return 0;
+		}
+		if (poll(&pfd, 1, INFTIM) == -1) {
+			sqlbox_warn(&box->cfg, "import: ppoll");
+			return 0;
+		} else if ((pfd.revents & (POLLNVAL|POLLERR))) {
+			sqlbox_warnx(&box->cfg, "import: ppoll: nval");
+			return 0;
+		}
+	}
+
+	if (rsz == 0)
+		in->eof = 1;
+	in->len += rsz;
+	return 1;
+}
+
+/*
+ * Make sure "in" has room for "sz" bytes of record and "parmsz"
+ * fields.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_in_reserve(struct sqlbox *box, struct sqlbox_in *in, 
+	size_t sz, size_t parmsz)
+{
+	void	*pp;
+
+	if (sz > in->recsz) {
+		if ((pp = realloc(in->rec, sz)) == NULL) {
+			sqlbox_warn(&box->cfg, "import: realloc");
+			return 0;
+		}
+		in->rec = pp;
+		in->recsz = sz;
+	}
+	if (parmsz > in->parmsz) {
+		pp = reallocarray(in->parms, 
+			parmsz, sizeof(struct sqlbox_parm));
+		if (pp == NULL) {
+			sqlbox_warn(&box->cfg, "import: reallocarray");
+			return 0;
+		}
+		in->parms = pp;
+		in->parmsz = parmsz;
+	}
+	return 1;
+}
+
+/*
+ * Parse the next RFC 4180 record from "in" into its fields, skipping
+ * empty lines.
+ * Records may end with a newline or carriage return and newline.
+ * Unquoted empty fields are NULL; all others are text.
+ * Returns <0 on failure, 0 at the end of input, >0 with "psz" fields
+ * in the parameters of "in".
+ */
+static int
+sqlbox_import_csv(struct sqlbox *box, struct sqlbox_in *in, size_t *psz)
+{
+	size_t	 i, end, start, fields, n, fstart;
+	int	 inq;
+
+again:
+	/* Find the end of the record, outside of quotes. */
+
+	inq = 0;
+	fields = 1;
+	i = in->pos;
+	for (;;) {
+		if (i == in->len) {
+			if (in->eof)
+				break;
+			if (i - in->pos > in->max) {
+				sqlbox_warnx(&box->cfg, "import: "
+					"row too long");
+				return -1;
+			}
+			i -= in->pos;
+			if (!sqlbox_in_fill(box, in))
+				return -1;
+			continue;
+		}
+		if (in->buf[i] == '"')
+			inq = !inq;
+		else if (!inq && in->buf[i] == ',')
+			fields++;
+		else if (!inq && in->buf[i] == '\n')
+			break;
+		i++;
+	}
+
+	if (i == in->len && i == in->pos)
+		return 0;
+
+	start = in->pos;
+	end = i;
+	in->pos = i < in->len ? i + 1 : i;
+	if (end > start && in->buf[end - 1] == '\r')
+		end--;
+	if (end == start)
+		goto again;
+
+	/* Fields are de-quoted into the record buffer. */
+
+	if (!sqlbox_in_reserve(box, in, end - start + fields, fields))
+		return -1;
+
+	for (n = 0, i = start, *psz = 0; *psz < fields; (*psz)++, i++) {
+		fstart = n;
+		memset(&in->parms[*psz], 0, sizeof(struct sqlbox_parm));
+		if (i < end && in->buf[i] == '"') {
+			for (i++; i < end; i++) {
+				if (in->buf[i] != '"') {
+					in->rec[n++] = in->buf[i];
+					continue;
+				} else if (i + 1 < end && 
+				    in->buf[i + 1] == '"') {
+					in->rec[n++] = in->buf[++i];
+					continue;
+				}
+
+				/* Keep anything after the quote. */
+
+				for (i++; i < end && in->buf[i] != ','; i++)
+					in->rec[n++] = in->buf[i];
+				break;
+			}
+		} else {
+			while (i < end && in->buf[i] != ',')
+				in->rec[n++] = in->buf[i++];
+			if (n == fstart) {
+				in->parms[*psz].type = SQLBOX_PARM_NULL;
+				continue;
+			}
+		}
+		in->rec[n++] = '\0';
+		in->parms[*psz].type = SQLBOX_PARM_STRING;
+		in->parms[*psz].sz = n - fstart;
+		in->parms[*psz].sparm = in->rec + fstart;
+	}
+
+	return 1;
+}
+
+/*
+ * Parse the next row from "in" as written by sqlbox_export() with
+ * SQLBOX_FMT_BINARY.
+ * The row is copied into the aligned record buffer, as the packed
+ * parameters are aligned relative to its start.
+ * Returns <0 on failure, 0 at the end of input, >0 with "psz" fields
+ * in "parms", which must be freed.
+ */
+static int
+sqlbox_import_binary(struct sqlbox *box, struct sqlbox_in *in, 
+	struct sqlbox_parm **parms, size_t *psz)
+{
+	size_t	 sz, used;
+
+	*parms = NULL;
+	*psz = 0;
+
+	while (in->len - in->pos < sizeof(uint32_t)) {
+		if (in->eof && in->len == in->pos)
+			return 0;
+		if (in->eof) {
+			sqlbox_warnx(&box->cfg, "import: "
+				"truncated row length");
+			return -1;
+		}
+		if (!sqlbox_in_fill(box, in))
+			return -1;
+	}
+
+	sz = le32toh(*(uint32_t *)(in->buf + in->pos));
+	if (sz > in->max) {
+		sqlbox_warnx(&box->cfg, "import: row too long: %zu", sz);
+		return -1;
+	}
+	sz += sizeof(uint32_t);
+	while (in->len - in->pos < sz) {
+		if (in->eof) {
+			sqlbox_warnx(&box->cfg, "import: truncated row");
+			return -1;
+		}
+		if (!sqlbox_in_fill(box, in))
+			return -1;
+	}
+
+	if (!sqlbox_in_reserve(box, in, sz, 0))
+		return -1;
+	memcpy(in->rec, in->buf + in->pos, sz);
+	in->pos += sz;
+
+	used = sqlbox_parm_unpack(box, parms, psz, 
+		in->rec + sizeof(uint32_t), sz - sizeof(uint32_t));
+	if (used == 0) {
+		sqlbox_warnx(&box->cfg, "import: sqlbox_parm_unpack");
+		return -1;
+	}
+	return 1;
+}
+
+/*
+ * Read rows from a descriptor passed by the client in the requested
+ * format, binding each to a statement and running it.
+ * Rows violating constraints are skipped, remembering the first.
+ * Unless in an explicit transaction, rows are committed in batches.
+ * Writes back the code that stopped the import, if any, the number of
+ * rows committed, and the first row violating a constraint or, if the
+ * import stopped with SQLBOX_CODE_ERROR, the row that couldn't be read
+ * or bound.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_import(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_db	*db;
+	struct sqlbox_pstmt	*pst;
+	struct sqlbox_in	 in;
+	struct sqlbox_parm	*parms = NULL;
+	struct sqlbox_budget	 budget;
+	sqlite3_stmt		*stmt = NULL;
+	enum sqlbox_fmt		 fmt;
+	enum sqlbox_code	 code = SQLBOX_CODE_OK;
+	size_t			 idx, batchrows, psz, cols, 
+				 nrows = 0, batched = 0, rowid = 0, 
+				 conflict = 0;
+	int			 c, rc = 0;
+	char			 ack[sizeof(uint32_t) + 
+				     sizeof(uint64_t) * 2];
+	uint32_t		 val;
+	uint64_t		 v;
+
+	memset(&in, 0, sizeof(struct sqlbox_in));
+	in.fd = -1;
+
+	if (sz != sizeof(uint32_t) * 4) {
+		sqlbox_warnx(&box->cfg, "import: bad frame size");
+		return 0;
+	}
+	db = sqlbox_db_find_open(box, le32toh(*(uint32_t *)buf));
+	if (db == NULL) {
+		sqlbox_warnx(&box->cfg, "import: sqlbox_db_find_open");
+		return 0;
+	}
+	idx = le32toh(*(uint32_t *)(buf + sizeof(uint32_t)));
+	fmt = le32toh(*(uint32_t *)(buf + sizeof(uint32_t) * 2));
+	batchrows = le32toh(*(uint32_t *)(buf + sizeof(uint32_t) * 3));
+
+	if (idx >= box->cfg.stmts.stmtsz) {
+		sqlbox_warnx(&box->cfg, "%s: import: "
+			"bad statement %zu", db->src->fname, idx);
+		return 0;
+	} else if (fmt != SQLBOX_FMT_BINARY && fmt != SQLBOX_FMT_CSV) {
+		sqlbox_warnx(&box->cfg, "%s: import: "
+			"bad format", db->src->fname);
+		return 0;
+	} else if (!sqlbox_rolecheck_stmt(box, idx)) {
+		sqlbox_warnx(&box->cfg, "%s: import: "
+			"sqlbox_rolecheck_stmt", db->src->fname);
+		return 0;
+	}
+	pst = &box->cfg.stmts.stmts[idx];
+
+	if (!sqlbox_read_fd(box, &in.fd)) {
+		sqlbox_warnx(&box->cfg, "import: sqlbox_read_fd");
+		return 0;
+	}
+
+	/* SQLite won't take a longer row anyway. */
+
+	in.max = sqlite3_limit(db->db, SQLITE_LIMIT_LENGTH, -1);
+
+	if ((stmt = sqlbox_wrap_prep(box, db, pst)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: import: "
+			"sqlbox_wrap_prep", db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: import: "
+			"statement: %s", db->src->fname, pst->stmt);
+		goto out;
+	}
+
+	if ((c = sqlbox_batch_begin(box, db)) < 0)
+		code = SQLBOX_CODE_INTERRUPT;
+	else if (c == 0) {
+		sqlbox_warnx(&box->cfg, "%s: import: "
+			"sqlbox_batch_begin", db->src->fname);
+		goto out;
+	}
+
+	while (code == SQLBOX_CODE_OK) {
+		free(parms);
+		parms = NULL;
+		if (fmt == SQLBOX_FMT_CSV)
+			c = sqlbox_import_csv(box, &in, &psz);
+		else
+			c = sqlbox_import_binary(box, &in, &parms, &psz);
+		if (c < 0) {
+			sqlbox_warnx(&box->cfg, "%s: import: "
+				"bad input row %zu", db->src->fname, 
+				rowid + 1);
+			code = SQLBOX_CODE_ERROR;
+			conflict = rowid + 1;
+			break;
+		} else if (c == 0)
+			break;
+		rowid++;
+
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		if (!sqlbox_parm_bind(box, db, pst, stmt, 
+		    parms != NULL ? parms : in.parms, psz)) {
+			sqlbox_warnx(&box->cfg, "%s: import: "
+				"sqlbox_parm_bind (row %zu)", 
+				db->src->fname, rowid);
+			sqlbox_warnx(&box->cfg, "%s: import: "
+				"statement: %s", db->src->fname, 
+				pst->stmt);
+			code = SQLBOX_CODE_ERROR;
+			conflict = rowid;
+			break;
+		}
+
+		sqlbox_budget_init(&budget, pst);
+		do {
+			code = sqlbox_wrap_step(box, db, pst, 
+				stmt, &cols, 1, &budget);
+		} while (code == SQLBOX_CODE_OK && cols > 0);
+
+		if (code == SQLBOX_CODE_ERROR) {
+			sqlbox_warnx(&box->cfg, "%s: import: "
+				"sqlbox_wrap_step (row %zu)", 
+				db->src->fname, rowid);
+			sqlbox_warnx(&box->cfg, "%s: import: "
+				"statement: %s", db->src->fname, 
+				pst->stmt);
+			goto out;
+		} else if (code == SQLBOX_CODE_CONSTRAINT) {
+			if (conflict == 0)
+				conflict = rowid;
+			code = SQLBOX_CODE_OK;
+			continue;
+		} else if (code != SQLBOX_CODE_OK)
+			break;
+
+		/* Start a new batch once this one is full. */
+
+		batched++;
+		if (db->batch && batchrows && batched >= batchrows) {
+			if (!sqlbox_batch_commit(box, db)) {
+				sqlbox_warnx(&box->cfg, "%s: import: "
+					"sqlbox_batch_commit", 
+					db->src->fname);
+				goto out;
+			}
+			nrows += batched;
+			batched = 0;
+			if ((c = sqlbox_batch_begin(box, db)) < 0)
+				code = SQLBOX_CODE_INTERRUPT;
+			else if (c == 0) {
+				sqlbox_warnx(&box->cfg, "%s: import: "
+					"sqlbox_batch_begin", 
+					db->src->fname);
+				goto out;
+			}
+		}
+	}
+
+	/* 
+	 * Roll back the uncommitted rows if stopped early, including
+	 * by bad input, which the client hears about as an error.
+	 * Within explicit transactions, all rows count.
+	 */
+
+	if (code != SQLBOX_CODE_OK && db->batch) {
+		if (!sqlbox_batch_rollback(box, db)) {
+			sqlbox_warnx(&box->cfg, "%s: import: "
+				"sqlbox_batch_rollback", db->src->fname);
+			goto out;
+		}
+		batched = 0;
+	} else if (!sqlbox_batch_commit(box, db)) {
+		sqlbox_warnx(&box->cfg, "%s: import: "
+			"sqlbox_batch_commit", db->src->fname);
+		goto out;
+	}
+	nrows += batched;
+
+	val = htole32(code);
+	memcpy(ack, &val, sizeof(uint32_t));
+	v = htole64(nrows);
+	memcpy(ack + sizeof(uint32_t), &v, sizeof(uint64_t));
+	v = htole64(conflict);
+	memcpy(ack + sizeof(uint32_t) + sizeof(uint64_t), 
+		&v, sizeof(uint64_t));
+	if (!sqlbox_write(box, ack, sizeof(ack))) {
+		sqlbox_warnx(&box->cfg, "import: sqlbox_write");
+		goto out;
+	}
+	rc = 1;
+out:
+	if (stmt != NULL)
+		sqlbox_wrap_finalise(box, db, pst, stmt);
+	if (in.fd != -1)
+		close(in.fd);
+	free(parms);
+	free(in.buf);
+	free(in.rec);
+	free(in.parms);
+	return rc;
+}
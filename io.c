@@ -19,10 +19,13 @@
 #if HAVE_SYS_QUEUE
 # include <sys/queue.h>
 #endif 
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include COMPAT_ENDIAN_H
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -39,15 +42,18 @@
  * This is called by both the client and the server, so it can't contain
  * any specifities.
  * Simply performs a blocking write of the sized buffer, which must not
- * be zero-length.
+ * be zero-length, to either the main or control channel "fd".
+ * On SOCK_SEQPACKET channels, the first SQLBOX_FRAME bytes are written
+ * as one record and the remainder in records of at most box->rec, so
+ * the reader can consume frame bases whole.
  * Returns FALSE on failure, TRUE on success.
  */
 int
-sqlbox_write(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_xwrite(struct sqlbox *box, int fd, const char *buf, size_t sz)
 {
-	struct pollfd	  pfd = { .fd = box->fd, .events = POLLOUT };
+	struct pollfd	  pfd = { .fd = fd, .events = POLLOUT };
 	ssize_t		  wsz;
-	size_t		  tsz = 0;
+	size_t		  tsz = 0, n;
 	int		  rc = 0, fl = 0;
 
 #ifdef	MSG_NOSIGNAL
@@ -78,7 +84,15 @@ sqlbox_write(struct sqlbox *box, const char *buf, size_t sz)
 		 * its part of the socket *after* the poll(2), above.
 		 */
 
-		wsz = send(pfd.fd, buf + tsz, sz - tsz, fl);
+		n = sz - tsz;
+		if (box->rec > 0 && tsz == 0 && n > SQLBOX_FRAME)
+			n = SQLBOX_FRAME;
+		else if (box->rec > 0 && n > box->rec)
+			n = box->rec;
+
+		wsz = send(pfd.fd, buf + tsz, n, fl);
+		if (wsz == -1 && errno == EAGAIN)
+			continue;
 		if (wsz == -1) {
 			sqlbox_warn(&box->cfg, "send");
 			return 0;
@@ -91,17 +105,39 @@ sqlbox_write(struct sqlbox *box, const char *buf, size_t sz)
 	return rc;
 }
 
+int
+sqlbox_write(struct sqlbox *box, const char *buf, size_t sz)
+{
+
+	return sqlbox_xwrite(box, box->fd, buf, sz);
+}
+
+/*
+ * Called by the client only.
+ * Like sqlbox_write(), but for a buffer holding a full operation frame,
+ * which is numbered so that sqlbox_interrupt() can target it.
+ * The server numbers the frames it reads in the same way.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_write_op(struct sqlbox *box, const char *buf, size_t sz)
+{
+
+	box->opseq++;
+	return sqlbox_write(box, buf, sz);
+}
+
 /*
  * Called by the client only, so it doesn't respond to end of file in
  * any but erroring out.
  * Performs a non-blocking read of the sized buffer, which must not be
- * zero-length.
+ * zero-length, from either the main or control channel "fd".
  * Returns FALSE on failure, TRUE on success.
  */
 int
-sqlbox_read(struct sqlbox *box, char *buf, size_t sz)
+sqlbox_xread(struct sqlbox *box, int fd, char *buf, size_t sz)
 {
-	struct pollfd	 pfd = { .fd = box->fd, .events = POLLIN };
+	struct pollfd	 pfd = { .fd = fd, .events = POLLIN };
 	ssize_t		 rsz;
 	size_t		 tsz = 0;
 
@@ -145,6 +181,52 @@ sqlbox_read(struct sqlbox *box, char *buf, size_t sz)
 	return 1;
 }
 
+int
+sqlbox_read(struct sqlbox *box, char *buf, size_t sz)
+{
+
+	if (!sqlbox_xread(box, box->fd, buf, sz))
+		return 0;
+
+	/*
+	 * The server processes frames in order, so having a response
+	 * means that everything we've written beforehand is consumed.
+	 */
+
+	box->pending = 0;
+	return 1;
+}
+
+/*
+ * Called by the client only.
+ * Account for writing a frame that the server won't acknowledge.
+ * If the window of unacknowledged frames is full, either synchronise
+ * with the server (which reclaims the window) if "block" is non-zero or
+ * report that the write would block.
+ * This does nothing if there's no window.
+ * Returns <0 if the write would block, 0 on failure, >0 on success.
+ */
+int
+sqlbox_credit(struct sqlbox *box, int block)
+{
+
+	if (box->cfg.comm.window == 0)
+		return 1;
+
+	if (box->pending >= box->cfg.comm.window) {
+		if (!block)
+			return -1;
+		if (!sqlbox_ping(box)) {
+			sqlbox_warnx(&box->cfg, "credit: sqlbox_ping");
+			return 0;
+		}
+		assert(box->pending == 0);
+	}
+
+	box->pending++;
+	return 1;
+}
+
 /*
  * Read a single frame, which is of size at least the baseline frame.
  * The frame is set in "frame" and is of length "framesz", both of which
@@ -216,9 +298,14 @@ sqlbox_read_frame(struct sqlbox *box, char **buf,
 		 * Make sure we've read the entire initial frame.
 		 * The whole point is that it should come in one packet,
 		 * so warn here if it doesn't.
+		 * Records always hold the whole frame basis.
 		 */
 
-		if ((sz += rsz) < bsz)
+		if ((sz += rsz) < bsz && box->rec > 0) {
+			sqlbox_warnx(&box->cfg, "read: short frame "
+				"basis record (%zd B < %zu B)", rsz, bsz);
+			return -1;
+		} else if (sz < bsz)
 			sqlbox_warnx(&box->cfg, "read: frame basis "
 				"fragmented (%zd B < %zu B)", rsz, bsz);
 	}
@@ -308,8 +395,203 @@ sqlbox_write_frame(struct sqlbox *box,
 	memcpy(frame + sizeof(uint32_t), &tmp, sizeof(uint32_t));
 
 	assert(sz <= SQLBOX_FRAME - sizeof(uint32_t) * 2);
-	memcpy(frame + sizeof(uint32_t) * 2, buf, sz);
+	if (sz > 0)
+		memcpy(frame + sizeof(uint32_t) * 2, buf, sz);
+
+	return sqlbox_write_op(box, frame, sizeof(frame));
+}
+
+/*
+ * Pass the descriptor "fd" over the main channel with a single byte of
+ * data, which must be read with sqlbox_read_fd().
+ * This does not close "fd".
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_write_fd(struct sqlbox *box, int fd)
+{
+	struct pollfd	 pfd = { .fd = box->fd, .events = POLLOUT };
+	struct msghdr	 msg;
+	struct cmsghdr	*cmsg;
+	struct iovec	 iov;
+	char		 c = '\0';
+	int		 fl = 0;
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} cmsgbuf;
+
+#ifdef	MSG_NOSIGNAL
+	fl = MSG_NOSIGNAL;
+#endif /* MSG_NOSIGNAL */
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	for (;;) {
+		if (poll(&pfd, 1, INFTIM) == -1) {
+			sqlbox_warn(&box->cfg, "ppoll (write-fd)");
+			return 0;
+		} else if ((pfd.revents & (POLLNVAL|POLLERR|POLLHUP))) {
+			sqlbox_warnx(&box->cfg, 
+				"ppoll (write-fd): nval or hangup");
+			return 0;
+		}
+		if (sendmsg(box->fd, &msg, fl) != -1)
+			return 1;
+		if (errno != EAGAIN && errno != EINTR) {
+			sqlbox_warn(&box->cfg, "sendmsg");
+			return 0;
+		}
+	}
+}
+
+/*
+ * Receive a descriptor written with sqlbox_write_fd() into "fd".
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_read_fd(struct sqlbox *box, int *fd)
+{
+	struct pollfd	 pfd = { .fd = box->fd, .events = POLLIN };
+	struct msghdr	 msg;
+	struct cmsghdr	*cmsg;
+	struct iovec	 iov;
+	ssize_t		 rsz;
+	char		 c;
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} cmsgbuf;
+
+	*fd = -1;
+	memset(&msg, 0, sizeof(struct msghdr));
+	memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+	for (;;) {
+		if (poll(&pfd, 1, INFTIM) == -1) {
+			sqlbox_warn(&box->cfg, "ppoll (read-fd)");
+			return 0;
+		} else if ((pfd.revents & (POLLNVAL|POLLERR))) {
+			sqlbox_warnx(&box->cfg, "ppoll (read-fd): nval");
+			return 0;
+		} else if (!(POLLIN & pfd.revents)) {
+			sqlbox_warnx(&box->cfg, "ppoll (read-fd): hangup");
+			return 0;
+		}
+		if ((rsz = recvmsg(box->fd, &msg, 0)) != -1)
+			break;
+		if (errno != EAGAIN && errno != EINTR) {
+			sqlbox_warn(&box->cfg, "recvmsg");
+			return 0;
+		}
+	}
+
+	if (rsz == 0) {
+		sqlbox_warnx(&box->cfg, "recvmsg: eof");
+		return 0;
+	} else if ((msg.msg_flags & MSG_CTRUNC)) {
+		sqlbox_warnx(&box->cfg, "recvmsg: truncated");
+		return 0;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; 
+	     cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+			return 1;
+		}
 
-	return sqlbox_write(box, frame, sizeof(frame));
+	sqlbox_warnx(&box->cfg, "recvmsg: no descriptor");
+	return 0;
 }
 
+/*
+ * Write all of "buf" of length "sz" to the descriptor "fd", which
+ * needn't be a socket and may be non-blocking.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_write_all(struct sqlbox *box, int fd, const char *buf, size_t sz)
+{
+	struct pollfd	 pfd = { .fd = fd, .events = POLLOUT };
+	ssize_t		 wsz;
+	size_t		 tsz = 0;
+
+	while (tsz < sz) {
+		if ((wsz = write(fd, buf + tsz, sz - tsz)) != -1) {
+			tsz += wsz;
+			continue;
+		} else if (errno == EINTR)
+			continue;
+		else if (errno != EAGAIN) {
+			sqlbox_warn(&box->cfg, "write");
+			return 0;
+		}
+		if (poll(&pfd, 1, INFTIM) == -1) {
+			sqlbox_warn(&box->cfg, "ppoll (write-all)");
+			return 0;
+		} else if ((pfd.revents & (POLLNVAL|POLLERR|POLLHUP))) {
+			sqlbox_warnx(&box->cfg, 
+				"ppoll (write-all): nval or hangup");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Copy "buf" of length "sz" into a new memory file sealed against any
+ * further change, to be passed with sqlbox_write_fd().
+ * Returns the descriptor or -1 on failure or if not supported.
+ */
+int
+sqlbox_memfd(struct sqlbox *box, const void *buf, size_t sz)
+{
+#if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+	int	 fd;
+
+	if ((fd = memfd_create("sqlbox", 
+	    MFD_CLOEXEC|MFD_ALLOW_SEALING)) == -1) {
+		sqlbox_warn(&box->cfg, "memfd_create");
+		return -1;
+	}
+	if (sz > 0 && !sqlbox_write_all(box, fd, buf, sz)) {
+		sqlbox_warnx(&box->cfg, "memfd: sqlbox_write_all");
+		close(fd);
+		return -1;
+	}
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | 
+	    F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+		sqlbox_warn(&box->cfg, "fcntl(F_ADD_SEALS)");
+		close(fd);
+		return -1;
+	}
+	return fd;
+#else
+	return -1;
+#endif
+}
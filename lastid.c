@@ -68,9 +68,14 @@ sqlbox_op_lastid(struct sqlbox *box, const char *buf, size_t sz)
 		return 0;
 	}
 
-	sqlbox_debug(&box->cfg, "sqlite3_last_insert_rowid: %s", 
-		db->src->fname);
-	ack = htole64(sqlite3_last_insert_rowid(db->db));
+	/* A lazy database that's never been opened has no rows. */
+
+	if (db->db != NULL) {
+		sqlbox_debug(&box->cfg, "sqlite3_last_insert_rowid: "
+			"%s", db->src->fname);
+		ack = htole64(sqlite3_last_insert_rowid(db->db));
+	} else
+		ack = 0;
 
 	if (!sqlbox_write(box, (char *)&ack, sizeof(int64_t))) {
 		sqlbox_warnx(&box->cfg, "lastid: sqlbox_write");
@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sqlite3.h>
@@ -45,10 +46,19 @@
 typedef	int (*sqlbox_op)(struct sqlbox *, const char *, size_t);
 
 static	const sqlbox_op ops[SQLBOX_OP__MAX] = {
+	sqlbox_op_blob_close, /* SQLBOX_OP_BLOB_CLOSE */
+	sqlbox_op_blob_open, /* SQLBOX_OP_BLOB_OPEN */
+	sqlbox_op_blob_read, /* SQLBOX_OP_BLOB_READ */
+	sqlbox_op_blob_write, /* SQLBOX_OP_BLOB_WRITE */
 	sqlbox_op_close, /* SQLBOX_OP_CLOSE */
 	sqlbox_op_exec_async, /* SQLBOX_OP_EXEC_ASYNC */
+	sqlbox_op_exec_chunk, /* SQLBOX_OP_EXEC_CHUNK */
+	sqlbox_op_exec_ext, /* SQLBOX_OP_EXEC_EXT */
+	sqlbox_op_exec_rows, /* SQLBOX_OP_EXEC_ROWS */
 	sqlbox_op_exec_sync, /* SQLBOX_OP_EXEC_SYNC */
+	sqlbox_op_export, /* SQLBOX_OP_EXPORT */
 	sqlbox_op_finalise, /* SQLBOX_OP_FINAL */
+	sqlbox_op_import, /* SQLBOX_OP_IMPORT */
 	sqlbox_op_lastid, /* SQLBOX_OP_LASTID */
 	sqlbox_op_msg_set_dat, /* SQLBOX_OP_MSG_SET_DAT */
 	sqlbox_op_open_async, /* SQLBOX_OP_OPEN_ASYNC */
@@ -56,28 +66,94 @@ static	const sqlbox_op ops[SQLBOX_OP__MAX] = {
 	sqlbox_op_ping, /* SQLBOX_OP_PING */
 	sqlbox_op_prepare_bind_async, /* SQLBOX_OP_PREPARE_BIND_ASYNC */
 	sqlbox_op_prepare_bind_sync, /* SQLBOX_OP_PREPARE_BIND_SYNC */
+	sqlbox_op_query, /* SQLBOX_OP_QUERY */
 	sqlbox_op_rebind, /* SQLBOX_OP_REBIND */
+	sqlbox_op_rebind_many, /* SQLBOX_OP_REBIND_MANY */
+	sqlbox_op_rebind_step, /* SQLBOX_OP_REBIND_STEP */
 	sqlbox_op_role, /* SQLBOX_OP_ROLE */
+	sqlbox_op_run_program, /* SQLBOX_OP_RUN_PROGRAM */
+	sqlbox_op_stats, /* SQLBOX_OP_STATS */
 	sqlbox_op_step, /* SQLBOX_OP_STEP */
 	sqlbox_op_trans_close, /* SQLBOX_OP_TRANS_CLOSE */
 	sqlbox_op_trans_open, /* SQLBOX_OP_TRANS_OPEN */
 };
 
 /*
- * This is a way for us to sleep between connection attempts.
- * To reduce lock contention, our sleep will be random.
+ * Default backoff range when a source is busy or locked.
  */
+#define	SQLBOX_RETRY_BASE 10 /* min. backoff (ms) */
+#define	SQLBOX_RETRY_CAP 250 /* max. backoff (ms) */
+
 void
-sqlbox_sleep(size_t attempt)
+sqlbox_backoff_init(struct sqlbox_backoff *bo, const struct sqlbox_src *src)
 {
-	useconds_t	us;
 
-	us = attempt > 100 ? 10000 :  /* 1/100 second */
-	     attempt > 10  ? 100000 : /* 1/10 second */
-	     250000;                  /* 1/4 second */
+	memset(bo, 0, sizeof(struct sqlbox_backoff));
+	bo->retry = &src->retry;
+}
+
+/*
+ * This is a way for us to sleep between connection attempts.
+ * To reduce lock contention, our sleep is capped exponential backoff
+ * with decorrelated jitter: random between the base and three times the
+ * last sleep, but no more than the cap.
+ * Unless disabled for the backoff, interrupts cut the sleep short.
+ * Returns FALSE without sleeping if we've already waited the maximum
+ * for the source, TRUE otherwise.
+ */
+int
+sqlbox_backoff(struct sqlbox *box, struct sqlbox_backoff *bo)
+{
+	size_t		 base, cap, hi, ms;
+
+	base = bo->retry->base ? 
+		bo->retry->base : SQLBOX_RETRY_BASE;
+	cap = bo->retry->cap ? 
+		bo->retry->cap : SQLBOX_RETRY_CAP;
+	if (cap < base)
+		cap = base;
+
+	if (bo->retry->maxwait && bo->waited >= bo->retry->maxwait) {
+		box->stats.giveups++;
+		return 0;
+	}
+
+	hi = (bo->prev ? bo->prev : base) * 3;
+	if (hi > cap)
+		hi = cap;
 
-	/* FIXME: don't use random(). */
-	usleep(us * (double)(random() / (double)RAND_MAX));
+#if HAVE_ARC4RANDOM
+	ms = base + arc4random_uniform(hi - base + 1);
+#else
+	ms = base + random() % (hi - base + 1);
+#endif
+	if (bo->retry->maxwait && 
+	    ms > bo->retry->maxwait - bo->waited)
+		ms = bo->retry->maxwait - bo->waited;
+
+	bo->prev = ms;
+	bo->waited += ms;
+	box->stats.retries++;
+	box->stats.waited += ms;
+	if (bo->nointr)
+		sqlbox_sleep(ms);
+	else
+		sqlbox_ctl_sleep(box, ms);
+	return 1;
+}
+
+/*
+ * Sleep for "ms" milliseconds, restarting if interrupted.
+ */
+void
+sqlbox_sleep(size_t ms)
+{
+	struct timespec	 ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		continue;
 }
 
 struct sqlbox_stmt *
@@ -121,26 +197,74 @@ sqlbox_db_find(struct sqlbox *box, size_t id)
 	return NULL;
 }
 
+/*
+ * Like sqlbox_db_find() but also opens lazy databases that haven't
+ * yet been opened.
+ * Use this for anything that needs the underlying database.
+ * Returns the database or NULL if not found or the open failed.
+ */
+struct sqlbox_db *
+sqlbox_db_find_open(struct sqlbox *box, size_t id)
+{
+	struct sqlbox_db	*db;
+
+	if ((db = sqlbox_db_find(box, id)) == NULL)
+		return NULL;
+	if (db->db == NULL && !sqlbox_db_open(box, db)) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_db_open", 
+			db->src->fname);
+		return NULL;
+	}
+	return db;
+}
+
 int
 sqlbox_main_loop(struct sqlbox *box)
 {
 	size_t		 framesz, bufsz = 0;
 	const char	*frame;
 	enum sqlbox_op	 op;
-	int		 c, rc = 0;
+	int		 c, ms, rc = 0;
 	char		*buf = NULL;
+	struct pollfd	 pfd = { .fd = box->fd, .events = POLLIN };
 
 	for (;;) {
+		/*
+		 * Batches hold the write lock, so don't let them stay
+		 * open while the client is idle: wait for the next op
+		 * only until the oldest batch needs committing.
+		 */
+
+		if (!sqlbox_batch_expire(box, &ms)) {
+			sqlbox_warnx(&box->cfg, "sqlbox_batch_expire");
+			break;
+		}
+		if (ms != INFTIM) {
+			if ((c = poll(&pfd, 1, ms)) == -1) {
+				sqlbox_warn(&box->cfg, "poll");
+				break;
+			} else if (c == 0)
+				continue;
+		}
+
 		c = sqlbox_read_frame
 			(box, &buf, &bufsz, &frame, &framesz);
 		if (c < 0) {
 			sqlbox_warnx(&box->cfg, "sqlbox_read_frame");
 			break;
 		} else if (c == 0) {
-			rc = 1;
+			if (!sqlbox_batch_flush(box))
+				sqlbox_warnx(&box->cfg, 
+					"sqlbox_batch_flush");
+			else
+				rc = 1;
 			break;
 		}
 
+		/* Number the operation as the client did. */
+
+		sqlbox_ctl_op(box);
+
 		if (framesz < sizeof(uint32_t)) {
 			sqlbox_warnx(&box->cfg, "bad "
 				"frame size: %zu", framesz);
@@ -157,7 +281,21 @@ sqlbox_main_loop(struct sqlbox *box)
 			break;
 		}
 
-		if (!(ops[op])(box, frame, framesz)) {
+		/* 
+		 * Anything but a batched write ends the batch, except
+		 * pings: they read nothing, and the client sends them
+		 * to reclaim its window of asynchronous writes.
+		 */
+
+		if (op != SQLBOX_OP_EXEC_ASYNC && op != SQLBOX_OP_PING &&
+		    !sqlbox_batch_flush(box)) {
+			sqlbox_warnx(&box->cfg, "sqlbox_batch_flush");
+			break;
+		}
+
+		c = (ops[op])(box, frame, framesz);
+		sqlbox_parm_unmap(box);
+		if (!c) {
 			sqlbox_warnx(&box->cfg, "sqlbox_op(%d)", op);
 			break;
 		}
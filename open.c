@@ -22,7 +22,9 @@
 #include COMPAT_ENDIAN_H
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -77,7 +79,10 @@ sqlbox_open_async(struct sqlbox *box, size_t src)
 {
 	uint32_t	 v = htole32(src);
 
-	if (!sqlbox_write_frame
+	if (!sqlbox_credit(box, 1)) {
+		sqlbox_warnx(&box->cfg, "open: sqlbox_credit");
+		return 0;
+	} else if (!sqlbox_write_frame
 	    (box, SQLBOX_OP_OPEN_ASYNC, (char *)&v, sizeof(uint32_t))) {
 		sqlbox_warnx(&box->cfg, "open: sqlbox_write_frame");
 		return 0;
@@ -85,13 +90,200 @@ sqlbox_open_async(struct sqlbox *box, size_t src)
 	return 1;
 }
 
+/*
+ * Default memory-mapped window for immutable sources: these never
+ * change, so we may as well map as much of them as we can.
+ * SQLite clamps this to its own compile-time maximum.
+ */
+#define	SQLBOX_IMMUTABLE_MMAP	(1024LL * 1024 * 1024)
+
+/*
+ * Set the PRAGMA "name" to the string "sval" if not NULL or the integer
+ * "ival" otherwise.
+ * String values have been checked by sqlbox_alloc(), so they're safe to
+ * put directly into the statement.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_open_pragma(struct sqlbox *box, struct sqlbox_db *db,
+	const char *name, const char *sval, int64_t ival)
+{
+	char			 buf[64];
+	struct sqlbox_pstmt	 pst = { .stmt = buf };
+	int			 c;
+
+	if (sval != NULL)
+		c = snprintf(buf, sizeof(buf),
+			"PRAGMA %s = %s;", name, sval);
+	else
+		c = snprintf(buf, sizeof(buf),
+			"PRAGMA %s = %" PRId64 ";", name, ival);
+	assert(c > 0 && (size_t)c < sizeof(buf));
+
+	if (sqlbox_wrap_exec_sys(box, db, &pst) != SQLBOX_CODE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_exec_sys: "
+			"%s", db->src->fname, buf);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Apply the source's tuning pragmas, if any, to a freshly-opened
+ * database.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_open_tune(struct sqlbox *box, struct sqlbox_db *db)
+{
+	const struct sqlbox_tune *t = &db->src->tune;
+
+	if (t->journal_mode != NULL && !sqlbox_open_pragma
+	    (box, db, "journal_mode", t->journal_mode, 0))
+		return 0;
+	if (t->synchronous != NULL && !sqlbox_open_pragma
+	    (box, db, "synchronous", t->synchronous, 0))
+		return 0;
+	if (t->temp_store != NULL && !sqlbox_open_pragma
+	    (box, db, "temp_store", t->temp_store, 0))
+		return 0;
+	if (t->cache_size != 0 && !sqlbox_open_pragma
+	    (box, db, "cache_size", NULL, t->cache_size))
+		return 0;
+	if (t->mmap_size != 0 && !sqlbox_open_pragma
+	    (box, db, "mmap_size", NULL, t->mmap_size))
+		return 0;
+	if (t->mmap_size == 0 && 
+	    db->src->mode == SQLBOX_SRC_IMMUTABLE &&
+	    !sqlbox_open_pragma(box, db, "mmap_size", 
+	    NULL, SQLBOX_IMMUTABLE_MMAP))
+		return 0;
+	if (t->wal_autocheckpoint != 0 && !sqlbox_open_pragma
+	    (box, db, "wal_autocheckpoint", NULL, t->wal_autocheckpoint))
+		return 0;
+	return 1;
+}
+
+/*
+ * Prepare all statements the current role may use into the connection's
+ * statement cache, up to what the cache can hold.
+ * Statements failing to prepare are reported but not an error, as they
+ * may be meant for other sources.
+ */
+static void
+sqlbox_open_warm(struct sqlbox *box, struct sqlbox_db *db)
+{
+	size_t			 i, idx, sz;
+	const struct sqlbox_role *r = NULL;
+	const struct sqlbox_pstmt *pst;
+	sqlite3_stmt		*stmt;
+
+	assert(db->conn != NULL);
+
+	if (box->cfg.roles.rolesz) {
+		r = &box->cfg.roles.roles[box->role];
+		sz = r->stmtsz;
+	} else
+		sz = box->cfg.stmts.stmtsz;
+
+	/* Anything beyond the cache would only be prepared and dropped. */
+
+	for (i = 0; i < sz; i++) {
+		if (db->conn->cachesz >= SQLBOX_STMT_CACHE_MAX)
+			break;
+		idx = r != NULL ? r->stmts[i] : i;
+		pst = &box->cfg.stmts.stmts[idx];
+		if ((stmt = sqlbox_wrap_prep(box, db, pst)) == NULL) {
+			sqlbox_warnx(&box->cfg, "%s: warm: statement "
+				"%zu: sqlbox_wrap_prep", 
+				db->src->fname, idx);
+			continue;
+		}
+		sqlbox_wrap_finalise(box, db, pst, stmt);
+	}
+}
+
+/*
+ * Open the underlying database of "db", which must not already be
+ * open, and apply our pragmas.
+ * This happens either when the database is opened or, for lazy
+ * sources, when first used.
+ * Returns TRUE on success, FALSE on failure (the database may be left
+ * open, in which case it's closed on exit).
+ */
+int
+sqlbox_db_open(struct sqlbox *box, struct sqlbox_db *db)
+{
+	const char		*fn = db->src->fname;
+	struct sqlbox_db	*sib;
+	struct sqlbox_pstmt	 fk = {
+		.stmt = (char *)"PRAGMA foreign_keys = ON;"
+	};
+
+	assert(db->db == NULL);
+
+	/*
+	 * Shared sources use the connection of any other open of the
+	 * same source, which has already been set up.
+	 */
+
+	if ((db->src->flags & SQLBOX_SRC_SHARED)) {
+		TAILQ_FOREACH(sib, &box->dbq, entries)
+			if (sib != db && sib->idx == db->idx &&
+			    sib->conn != NULL)
+				break;
+		if (sib != NULL) {
+			sqlbox_debug(&box->cfg, "%s: sharing "
+				"connection (id %zu)", fn, sib->id);
+			db->conn = sib->conn;
+			db->conn->refs++;
+			db->db = db->conn->db;
+			return 1;
+		}
+	}
+
+	if ((db->db = sqlbox_wrap_open(box, db->src)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_open", fn);
+		return 0;
+	} else if (!sqlbox_wrap_array(box, db)) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_array", fn);
+		return 0;
+	}
+
+	if ((db->src->flags & (SQLBOX_SRC_SHARED|SQLBOX_SRC_WARM))) {
+		if ((db->conn = calloc(1, 
+		    sizeof(struct sqlbox_conn))) == NULL) {
+			sqlbox_warn(&box->cfg, "open: calloc");
+			return 0;
+		}
+		TAILQ_INIT(&db->conn->cache);
+		db->conn->db = db->db;
+		db->conn->refs = 1;
+	}
+
+	/* We always enable foreign keys. */
+
+	if (sqlbox_wrap_exec_sys(box, db, &fk) != SQLBOX_CODE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_exec_sys", fn);
+		return 0;
+	} else if (!sqlbox_open_tune(box, db)) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_open_tune", fn);
+		return 0;
+	}
+
+	if ((db->src->flags & SQLBOX_SRC_WARM))
+		sqlbox_open_warm(box, db);
+	return 1;
+}
+
 /*
  * Attempt to open a database.
  * First check if the index is valid, then whether our role permits
  * opening new databases.
- * Then do the open itself.
+ * Then do the open itself, unless the source is lazy, in which case
+ * it's deferred until first used.
  * On success, writes back the unique identifier of the database.
- * Returns TRUE on success, FALSE on failure (nothing is allocated).
+ * Returns TRUE on success, FALSE on failure.
  */
 static int
 sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
@@ -100,9 +292,6 @@ sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
 	const char		*fn;
 	struct sqlbox_db	*db;
 	uint32_t		 ack;
-	struct sqlbox_pstmt	 fk = {
-		.stmt = (char *)"PRAGMA foreign_keys = ON;"
-	};
 
 	/* Check source exists and we have permission for it. */
 
@@ -133,17 +322,12 @@ sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
 	}
 
 	TAILQ_INIT(&db->stmtq);
+	TAILQ_INIT(&db->blobq);
 	db->id = ++box->lastid;
 	assert(db->id != 0);
 	db->src = &box->cfg.srcs.srcs[idx];
 	db->idx = idx;
 
-	if ((db->db = sqlbox_wrap_open(box, db->src)) == NULL) {
-		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_open", fn);
-		free(db);
-		return 0;
-	}
-
 	/* 
 	 * Add to list of available sources.
 	 * After this, the exit handler will properly close the database
@@ -152,10 +336,9 @@ sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
 
 	TAILQ_INSERT_TAIL(&box->dbq, db, entries);
 
-	/* We always enable foreign keys. */
-
-	if (sqlbox_wrap_exec(box, db, &fk, 0) == SQLBOX_CODE_ERROR) {
-		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_exec", fn);
+	if (!(db->src->flags & SQLBOX_SRC_LAZY) &&
+	    !sqlbox_db_open(box, db)) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_db_open", fn);
 		return 0;
 	}
 
@@ -19,10 +19,13 @@
 #if HAVE_SYS_QUEUE
 # include <sys/queue.h>
 #endif 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include COMPAT_ENDIAN_H
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h> /* HUGE_VAL */
@@ -59,7 +62,7 @@ sqlbox_parm_pack(struct sqlbox *box, size_t parmsz,
 	const struct sqlbox_parm *parms, 
 	char **buf, size_t *offs, size_t *bufsz)
 {
-	size_t	 framesz, i, sz;
+	size_t	 framesz, i, j, sz;
 	void	*pp;
 	uint32_t tmp;
 	uint64_t val;
@@ -78,6 +81,10 @@ sqlbox_parm_pack(struct sqlbox *box, size_t parmsz,
 	for (i = 0; i < parmsz; i++) {
 		sqlbox_parm_pack_align(box, &framesz, 4);
 		framesz += sizeof(uint32_t);
+		if (parms[i].type == SQLBOX_PARM__FD) {
+			framesz += sizeof(uint32_t);
+			continue;
+		}
 		switch (parms[i].type) {
 		case SQLBOX_PARM_NULL: /* nothing */
 			break;
@@ -98,6 +105,21 @@ sqlbox_parm_pack(struct sqlbox *box, size_t parmsz,
 			framesz += parms[i].sz == 0 ? 
 				strlen(parms[i].sparm) + 1 : parms[i].sz;
 			break;
+		case SQLBOX_PARM_INT_ARRAY: /* count+data */
+			framesz += sizeof(uint32_t);
+			sqlbox_parm_pack_align(box, &framesz, 8);
+			framesz += parms[i].sz * sizeof(int64_t);
+			break;
+		case SQLBOX_PARM_STRING_ARRAY: /* count+(length+data) */
+			framesz += sizeof(uint32_t);
+			for (j = 0; j < parms[i].sz; j++) {
+				if (parms[i].saparm[j] == NULL)
+					return 0;
+				sqlbox_parm_pack_align(box, &framesz, 4);
+				framesz += sizeof(uint32_t);
+				framesz += strlen(parms[i].saparm[j]) + 1;
+			}
+			break;
 		default:
 			return 0;
 		}
@@ -136,6 +158,13 @@ sqlbox_parm_pack(struct sqlbox *box, size_t parmsz,
 		tmp = htole32(parms[i].type);
 		memcpy(*buf + *offs, (char *)&tmp, sizeof(uint32_t));
 		*offs += sizeof(uint32_t);
+		if (parms[i].type == SQLBOX_PARM__FD) {
+			tmp = htole32(parms[i].sz);
+			memcpy(*buf + *offs, 
+				(char *)&tmp, sizeof(uint32_t));
+			*offs += sizeof(uint32_t);
+			continue;
+		}
 		switch (parms[i].type) {
 		case SQLBOX_PARM_FLOAT:
 			sqlbox_parm_pack_align(box, offs, 8);
@@ -170,6 +199,36 @@ sqlbox_parm_pack(struct sqlbox *box, size_t parmsz,
 			memcpy(*buf + *offs, parms[i].sparm, sz);
 			*offs += sz;
 			break;
+		case SQLBOX_PARM_INT_ARRAY:
+			tmp = htole32(parms[i].sz);
+			memcpy(*buf + *offs, 
+				(char *)&tmp, sizeof(uint32_t));
+			*offs += sizeof(uint32_t);
+			sqlbox_parm_pack_align(box, offs, 8);
+			for (j = 0; j < parms[i].sz; j++) {
+				val = htole64(parms[i].iaparm[j]);
+				memcpy(*buf + *offs, 
+					(char *)&val, sizeof(int64_t));
+				*offs += sizeof(int64_t);
+			}
+			break;
+		case SQLBOX_PARM_STRING_ARRAY:
+			tmp = htole32(parms[i].sz);
+			memcpy(*buf + *offs, 
+				(char *)&tmp, sizeof(uint32_t));
+			*offs += sizeof(uint32_t);
+			for (j = 0; j < parms[i].sz; j++) {
+				sqlbox_parm_pack_align(box, offs, 4);
+				sz = strlen(parms[i].saparm[j]) + 1;
+				tmp = htole32(sz);
+				memcpy(*buf + *offs, 
+					(char *)&tmp, sizeof(uint32_t));
+				*offs += sizeof(uint32_t);
+				memcpy(*buf + *offs, 
+					parms[i].saparm[j], sz);
+				*offs += sz;
+			}
+			break;
 		default:
 			abort();
 		}
@@ -181,10 +240,78 @@ sqlbox_parm_pack(struct sqlbox *box, size_t parmsz,
 	return 1;
 }
 
+/*
+ * Copy an unpacked array parameter, which still points to its packed
+ * and validated elements, into a struct sqlbox_array to be bound.
+ * Returns the array (to be freed by the caller) or NULL on failure.
+ */
+static struct sqlbox_array *
+sqlbox_parm_array(struct sqlbox *box, const struct sqlbox_parm *p)
+{
+	struct sqlbox_array	*arr;
+	const char		*buf;
+	char			*strs;
+	size_t			 i, len, sz;
+	int64_t			*ints;
+
+	if (p->type == SQLBOX_PARM_INT_ARRAY) {
+		sz = sizeof(struct sqlbox_array) + 
+			p->sz * sizeof(int64_t);
+		if ((arr = malloc(sz)) == NULL) {
+			sqlbox_warn(&box->cfg, "malloc");
+			return NULL;
+		}
+		ints = (int64_t *)(arr + 1);
+		for (i = 0; i < p->sz; i++)
+			ints[i] = le64toh(((const int64_t *)p->bparm)[i]);
+		arr->type = SQLBOX_PARM_INT;
+		arr->sz = p->sz;
+		arr->ints = ints;
+		arr->strs = NULL;
+		return arr;
+	}
+
+	assert(p->type == SQLBOX_PARM_STRING_ARRAY);
+
+	/* First compute the size of all strings. */
+
+	sz = sizeof(struct sqlbox_array) + p->sz * sizeof(char *);
+	for (buf = p->bparm, i = 0; i < p->sz; i++) {
+		buf += (4 - ((uintptr_t)buf % 4)) % 4;
+		len = le32toh(*(const uint32_t *)buf);
+		buf += sizeof(uint32_t) + len;
+		sz += len;
+	}
+
+	if ((arr = malloc(sz)) == NULL) {
+		sqlbox_warn(&box->cfg, "malloc");
+		return NULL;
+	}
+	arr->type = SQLBOX_PARM_STRING;
+	arr->sz = p->sz;
+	arr->ints = NULL;
+	arr->strs = (const char **)(arr + 1);
+	strs = (char *)(arr->strs + p->sz);
+
+	for (buf = p->bparm, i = 0; i < p->sz; i++) {
+		buf += (4 - ((uintptr_t)buf % 4)) % 4;
+		len = le32toh(*(const uint32_t *)buf);
+		buf += sizeof(uint32_t);
+		memcpy(strs, buf, len);
+		arr->strs[i] = strs;
+		strs += len;
+		buf += len;
+	}
+
+	return arr;
+}
+
 /* 
  * Bind parameters in "parms" to a statement "stmt".
  * We mark the strings as SQLITE_TRANSIENT because we're probably going
  * to lose the buffer during the next read and so it needs to be stored.
+ * Mapped blobs are bound SQLITE_STATIC as they're only unmapped once the
+ * operation, and thus the statement's use of them, is finished.
  * Returns TRUE on success, FALSE on failure.
  */
 int
@@ -192,10 +319,21 @@ sqlbox_parm_bind(struct sqlbox *box, struct sqlbox_db *db,
 	const struct sqlbox_pstmt *pst, sqlite3_stmt *stmt, 
 	const struct sqlbox_parm *parms, size_t parmsz)
 {
-	size_t	 i;
-	int	 c;
+	size_t			 i;
+	int			 c;
+	struct sqlbox_array	*arr;
 
 	for (i = 0; i < parmsz; i++) {
+		if (parms[i].type == SQLBOX_PARM__MAPPED) {
+			sqlbox_debug(&box->cfg, 
+				"%s: sqlite3_bind_blob64[%zu]: "
+				"%s (%zu B, mapped)", db->src->fname,
+				i, pst->stmt, parms[i].sz);
+			c = sqlite3_bind_blob64(stmt, i + 1,
+				parms[i].bparm, parms[i].sz, 
+				SQLITE_STATIC);
+			goto check;
+		}
 		switch (parms[i].type) {
 		case SQLBOX_PARM_BLOB:
 			sqlbox_debug(&box->cfg, 
@@ -235,6 +373,21 @@ sqlbox_parm_bind(struct sqlbox *box, struct sqlbox_db *db,
 				parms[i].sparm, parms[i].sz - 1, 
 				SQLITE_TRANSIENT);
 			break;
+		case SQLBOX_PARM_INT_ARRAY:
+		case SQLBOX_PARM_STRING_ARRAY:
+			sqlbox_debug(&box->cfg, 
+				"%s: sqlite3_bind_pointer[%zu]: "
+				"%s (%zu elements)", db->src->fname, 
+				i, pst->stmt, parms[i].sz);
+			if ((arr = sqlbox_parm_array
+			    (box, &parms[i])) == NULL)
+				return 0;
+
+			/* This frees the array even on failure. */
+
+			c = sqlite3_bind_pointer(stmt, i + 1,
+				arr, SQLBOX_ARRAY_PTR, free);
+			break;
 		default:
 			sqlbox_warnx(&box->cfg, 
 				"%s: sqlbox_parm_bind[%zu]: "
@@ -246,6 +399,7 @@ sqlbox_parm_bind(struct sqlbox *box, struct sqlbox_db *db,
 				i, pst->stmt);
 			return 0;
 		}
+check:
 		if (c != SQLITE_OK) {
 			sqlbox_warnx(&box->cfg, 
 				"%s: sqlbox_parm_bind[%zu]: %s", 
@@ -280,7 +434,7 @@ sqlbox_parm_unpack_align(struct sqlbox *box,
 		return 0;
 
 	*buf += offs;
-	*bufsz += offs;
+	*bufsz -= offs;
 	return 1;
 }
 
@@ -293,7 +447,7 @@ size_t
 sqlbox_parm_unpack(struct sqlbox *box, struct sqlbox_parm **parms,
 	size_t *parmsz, const char *buf, size_t bufsz)
 {
-	size_t	 	 i = 0, len;
+	size_t	 	 i = 0, j, len;
 	const char	*start = buf;
 
 	*parms = NULL;
@@ -342,6 +496,16 @@ sqlbox_parm_unpack(struct sqlbox *box, struct sqlbox_parm **parms,
 		(*parms)[i].type = le32toh(*(uint32_t *)buf);
 		buf += sizeof(uint32_t);
 		bufsz -= sizeof(uint32_t);
+		if ((*parms)[i].type == SQLBOX_PARM__FD) {
+			/* Length only: see sqlbox_parm_map(). */
+			if (bufsz < sizeof(uint32_t))
+				goto badframe;
+			(*parms)[i].sz = le32toh(*(uint32_t *)buf);
+			(*parms)[i].bparm = NULL;
+			buf += sizeof(uint32_t);
+			bufsz -= sizeof(uint32_t);
+			continue;
+		}
 		switch ((*parms)[i].type) {
 		case SQLBOX_PARM_FLOAT:
 			if (!sqlbox_parm_unpack_align(box, &buf, &bufsz, 8))
@@ -404,6 +568,54 @@ sqlbox_parm_unpack(struct sqlbox *box, struct sqlbox_parm **parms,
 			buf += len;
 			bufsz -= len;
 			break;
+		case SQLBOX_PARM_INT_ARRAY:
+			/*
+			 * Arrays are left pointing to their packed
+			 * elements, which are copied out when bound.
+			 */
+			if (bufsz < sizeof(uint32_t))
+				goto badframe;
+			len = le32toh(*(uint32_t *)buf);
+			buf += sizeof(uint32_t);
+			bufsz -= sizeof(uint32_t);
+			if (!sqlbox_parm_unpack_align(box, &buf, &bufsz, 8))
+				goto badframe;
+			if (bufsz / sizeof(int64_t) < len)
+				goto badframe;
+			(*parms)[i].bparm = buf;
+			(*parms)[i].sz = len;
+			buf += len * sizeof(int64_t);
+			bufsz -= len * sizeof(int64_t);
+			break;
+		case SQLBOX_PARM_STRING_ARRAY:
+			if (bufsz < sizeof(uint32_t))
+				goto badframe;
+			(*parms)[i].sz = le32toh(*(uint32_t *)buf);
+			buf += sizeof(uint32_t);
+			bufsz -= sizeof(uint32_t);
+			(*parms)[i].bparm = buf;
+			for (j = 0; j < (*parms)[i].sz; j++) {
+				if (!sqlbox_parm_unpack_align
+				    (box, &buf, &bufsz, 4))
+					goto badframe;
+				if (bufsz < sizeof(uint32_t))
+					goto badframe;
+				len = le32toh(*(uint32_t *)buf);
+				buf += sizeof(uint32_t);
+				bufsz -= sizeof(uint32_t);
+				if (len == 0 || bufsz < len)
+					goto badframe;
+				if (buf[len - 1] != '\0') {
+					sqlbox_warnx(&box->cfg, 
+						"unpacking parameter "
+						"%zu: string %zu "
+						"malformed", i, j);
+					goto err;
+				}
+				buf += len;
+				bufsz -= len;
+			}
+			break;
 		default:
 			sqlbox_warnx(&box->cfg, "unpacking parameter "
 				"%zu: unknown type: %d", i, 
@@ -467,6 +679,8 @@ sqlbox_parm_int(const struct sqlbox_parm *p, int64_t *v)
 		break;
 	case SQLBOX_PARM_NULL:
 	case SQLBOX_PARM_BLOB:
+	case SQLBOX_PARM_INT_ARRAY:
+	case SQLBOX_PARM_STRING_ARRAY:
 		return -1;
 	}
 
@@ -496,6 +710,8 @@ sqlbox_parm_float(const struct sqlbox_parm *p, double *v)
 		break;
 	case SQLBOX_PARM_NULL:
 	case SQLBOX_PARM_BLOB:
+	case SQLBOX_PARM_INT_ARRAY:
+	case SQLBOX_PARM_STRING_ARRAY:
 		return -1;
 	}
 
@@ -529,6 +745,8 @@ sqlbox_parm_string(const struct sqlbox_parm *p, char *v, size_t vsz, size_t *out
 		break;
 	case SQLBOX_PARM_NULL:
 	case SQLBOX_PARM_BLOB:
+	case SQLBOX_PARM_INT_ARRAY:
+	case SQLBOX_PARM_STRING_ARRAY:
 		return -1;
 	}
 
@@ -562,6 +780,8 @@ sqlbox_parm_string_alloc(const struct sqlbox_parm *p, char **v, size_t *outsz)
 		break;
 	case SQLBOX_PARM_NULL:
 	case SQLBOX_PARM_BLOB:
+	case SQLBOX_PARM_INT_ARRAY:
+	case SQLBOX_PARM_STRING_ARRAY:
 		return -1;
 	}
 
@@ -591,6 +811,8 @@ sqlbox_parm_blob(const struct sqlbox_parm *p, void *v, size_t vsz, size_t *outsz
 		*outsz = strlcpy(v, p->sparm, vsz) + 1;
 		break;
 	case SQLBOX_PARM_NULL:
+	case SQLBOX_PARM_INT_ARRAY:
+	case SQLBOX_PARM_STRING_ARRAY:
 		return -1;
 	case SQLBOX_PARM_BLOB:
 		memcpy(v, p->bparm, nsz);
@@ -624,6 +846,8 @@ sqlbox_parm_blob_alloc(const struct sqlbox_parm *p, void **v, size_t *outsz)
 		*outsz = strlen(*v) + 1;
 		break;
 	case SQLBOX_PARM_NULL:
+	case SQLBOX_PARM_INT_ARRAY:
+	case SQLBOX_PARM_STRING_ARRAY:
 		return -1;
 	case SQLBOX_PARM_BLOB:
 		if (p->sz) {
@@ -637,3 +861,101 @@ sqlbox_parm_blob_alloc(const struct sqlbox_parm *p, void **v, size_t *outsz)
 
 	return p->type == SQLBOX_PARM_BLOB ? 0 : 1;
 }
+
+/*
+ * Receive the descriptors of any blobs in "parms" passed by memory file,
+ * which follow the frame in order, and map them.
+ * The memory is tracked by "box" until sqlbox_parm_unmap() is called at
+ * the end of the operation.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_parm_map(struct sqlbox *box, struct sqlbox_parm *parms, 
+	size_t parmsz)
+{
+	size_t		 i;
+	int		 fd;
+	void		*pp;
+	struct stat	 st;
+
+	for (i = 0; i < parmsz; i++) {
+		if (parms[i].type != SQLBOX_PARM__FD)
+			continue;
+		if (!sqlbox_read_fd(box, &fd)) {
+			sqlbox_warnx(&box->cfg, "parameter %zu: "
+				"sqlbox_read_fd", i);
+			return 0;
+		}
+
+#ifdef F_GET_SEALS
+		/*
+		 * The sender mustn't be able to change or truncate the
+		 * memory while we're reading it.
+		 */
+
+		if ((fcntl(fd, F_GET_SEALS) & (F_SEAL_WRITE|F_SEAL_SHRINK)) !=
+		    (F_SEAL_WRITE|F_SEAL_SHRINK)) {
+			sqlbox_warnx(&box->cfg, "parameter %zu: "
+				"memory file not sealed", i);
+			close(fd);
+			return 0;
+		} else if (fstat(fd, &st) == -1) {
+			sqlbox_warn(&box->cfg, "parameter %zu: fstat", i);
+			close(fd);
+			return 0;
+		} else if (st.st_size < 0 || 
+		    (uintmax_t)st.st_size < parms[i].sz) {
+			sqlbox_warnx(&box->cfg, "parameter %zu: "
+				"memory file too short", i);
+			close(fd);
+			return 0;
+		}
+#else
+		sqlbox_warnx(&box->cfg, "parameter %zu: "
+			"memory files not supported", i);
+		close(fd);
+		return 0;
+#endif
+
+		pp = reallocarray(box->maps, 
+			box->mapsz + 1, sizeof(struct sqlbox_map));
+		if (pp == NULL) {
+			sqlbox_warn(&box->cfg, "reallocarray");
+			close(fd);
+			return 0;
+		}
+		box->maps = pp;
+
+		if (parms[i].sz == 0)
+			parms[i].bparm = "";
+		else if ((parms[i].bparm = mmap(NULL, parms[i].sz, 
+		    PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+			sqlbox_warn(&box->cfg, "parameter %zu: mmap", i);
+			close(fd);
+			return 0;
+		} else {
+			box->maps[box->mapsz].addr = (void *)parms[i].bparm;
+			box->maps[box->mapsz].sz = parms[i].sz;
+			box->mapsz++;
+		}
+		close(fd);
+		parms[i].type = SQLBOX_PARM__MAPPED;
+	}
+
+	return 1;
+}
+
+/*
+ * Unmap all memory mapped by sqlbox_parm_map().
+ */
+void
+sqlbox_parm_unmap(struct sqlbox *box)
+{
+	size_t	 i;
+
+	for (i = 0; i < box->mapsz; i++)
+		munmap(box->maps[i].addr, box->maps[i].sz);
+	free(box->maps);
+	box->maps = NULL;
+	box->mapsz = 0;
+}
@@ -100,10 +100,8 @@ main(int argc, char *argv[])
 		parms[2].iparm = random();
 		parms[3].iparm = random();
 #endif
-		if (!sqlbox_rebind(p, stmtid, 4, parms))
-			errx(EXIT_FAILURE, "sqlbox_rebind");
-		if (sqlbox_step(p, stmtid) == NULL)
-			errx(EXIT_FAILURE, "sqlbox_step");
+		if (sqlbox_rebind_step(p, stmtid, 4, parms) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_rebind_step");
 	}
 
 	if (!sqlbox_finalise(p, stmtid))
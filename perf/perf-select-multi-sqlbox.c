@@ -15,6 +15,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #include <err.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,10 +27,10 @@
 int
 main(int argc, char *argv[])
 {
-	size_t		 	 i, rows = 10000;
+	size_t		 	 i, rows = 10000, bufsz = 0;
 	struct sqlbox		*p;
 	struct sqlbox_cfg	 cfg;
-	int			 c;
+	int			 c, seqpacket = 0;
 	struct sqlbox_src	 srcs[] = {
 		{ .fname = (char *)":memory:",
 		  .mode = SQLBOX_SRC_RW }
@@ -51,8 +52,14 @@ main(int argc, char *argv[])
 	if (pledge("stdio rpath cpath wpath flock fattr proc", NULL) == -1)
 		err(EXIT_FAILURE, "pledge");
 
-	while ((c = getopt(argc, argv, "n:")) != -1)
+	while ((c = getopt(argc, argv, "b:n:s")) != -1)
 		switch (c) {
+		case 'b':
+			bufsz = atoi(optarg);
+			break;
+		case 's':
+			seqpacket = 1;
+			break;
 		case 'n':
 			rows = atoi(optarg);
 			break;
@@ -62,6 +69,8 @@ main(int argc, char *argv[])
 
 	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
 	cfg.msg.func_short = warnx;
+	cfg.comm.sndbuf = cfg.comm.rcvbuf = bufsz;
+	cfg.comm.seqpacket = seqpacket;
 
 	cfg.srcs.srcsz = 1;
 	cfg.srcs.srcs = srcs;
@@ -133,8 +133,9 @@ sqlbox_pbind(struct sqlbox *box, enum sqlbox_op op, size_t srcid,
 
 	/* Write data, free our buffer. */
 
-	if (!sqlbox_write(box, buf, pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
-		sqlbox_warnx(&box->cfg, "prepare-bind: sqlbox_write");
+	if (!sqlbox_write_op(box, buf,
+	    pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
+		sqlbox_warnx(&box->cfg, "prepare-bind: sqlbox_write_op");
 		free(buf);
 		free(st);
 		return NULL;
@@ -144,12 +145,26 @@ sqlbox_pbind(struct sqlbox *box, enum sqlbox_op op, size_t srcid,
 	return st;
 }
 
-int
-sqlbox_prepare_bind_async(struct sqlbox *box, size_t srcid,
+/*
+ * Write an asynchronous prepare and bind.
+ * If the window is full and "block" is zero, nothing is written.
+ * Returns <0 if the write would block, 0 on failure, >0 on success.
+ */
+static int
+sqlbox_prepare_bind_async_inner(struct sqlbox *box, size_t srcid,
 	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
-	unsigned long opts)
+	unsigned long opts, int block)
 {
 	struct sqlbox_stmt	*st;
+	int			 c;
+
+	if ((c = sqlbox_credit(box, block)) < 0)
+		return -1;
+	else if (c == 0) {
+		sqlbox_warnx(&box->cfg, 
+			"prepare-bind-async: sqlbox_credit");
+		return 0;
+	}
 
 	if ((st = sqlbox_pbind(box, SQLBOX_OP_PREPARE_BIND_ASYNC, 
 	    srcid, pstmt, psz, ps, opts)) == NULL) {
@@ -165,6 +180,29 @@ sqlbox_prepare_bind_async(struct sqlbox *box, size_t srcid,
 	return 1;
 }
 
+int
+sqlbox_prepare_bind_async(struct sqlbox *box, size_t srcid,
+	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
+	unsigned long opts)
+{
+
+	return sqlbox_prepare_bind_async_inner
+		(box, srcid, pstmt, psz, ps, opts, 1) > 0;
+}
+
+int
+sqlbox_prepare_bind_async_nb(struct sqlbox *box, size_t srcid,
+	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
+	unsigned long opts, int *blocked)
+{
+	int	 c;
+
+	c = sqlbox_prepare_bind_async_inner
+		(box, srcid, pstmt, psz, ps, opts, 0);
+	*blocked = c < 0;
+	return c != 0;
+}
+
 size_t
 sqlbox_prepare_bind(struct sqlbox *box, size_t srcid,
 	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
@@ -199,6 +237,49 @@ sqlbox_prepare_bind(struct sqlbox *box, size_t srcid,
 	return st->id;
 }
 
+const struct sqlbox_parmset *
+sqlbox_query(struct sqlbox *box, size_t srcid,
+	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
+	unsigned long opts, size_t *stmtid)
+{
+	struct sqlbox_stmt	*st;
+	uint32_t		 val;
+
+	*stmtid = 0;
+
+	if ((st = sqlbox_pbind(box, SQLBOX_OP_QUERY,
+	    srcid, pstmt, psz, ps, opts)) == NULL) {
+		sqlbox_warnx(&box->cfg, "query: sqlbox_pbind");
+		return NULL;
+	}
+
+	if (!sqlbox_read(box, (char *)&val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "query: sqlbox_read");
+		free(st);
+		return NULL;
+	}
+
+	/* 
+	 * One-shot statements have already been finalised, so there's
+	 * nothing to keep but the results.
+	 */
+
+	if ((st->id = le32toh(val)) == 0) {
+		free(st);
+		if (!(opts & SQLBOX_STMT_ONESHOT)) {
+			sqlbox_warnx(&box->cfg, "query: server "
+				"wrote back identifier of zero");
+			return NULL;
+		}
+		sqlbox_res_clear(&box->rows);
+		return sqlbox_step_read(box, &box->rows);
+	}
+
+	TAILQ_INSERT_TAIL(&box->stmtq, st, gentries);
+	*stmtid = st->id;
+	return sqlbox_step_read(box, &st->res);
+}
+
 /*
  * Prepare and bind parameters to a statement in one step.
  * Do not send anything back to the client: this is done by the caller
@@ -227,12 +308,13 @@ sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz)
 	buf += sizeof(uint32_t);
 	sz -= sizeof(uint32_t);
 
-	db = sqlbox_db_find(box, le32toh(*(uint32_t *)buf));
+	db = sqlbox_db_find_open(box, le32toh(*(uint32_t *)buf));
 	buf += sizeof(uint32_t);
 	sz -= sizeof(uint32_t);
 
 	if (db == NULL) {
-		sqlbox_warnx(&box->cfg, "prepare-bind: sqlbox_db_find");
+		sqlbox_warnx(&box->cfg, "prepare-bind: "
+			"sqlbox_db_find_open");
 		return NULL;
 	}
 
@@ -311,6 +393,7 @@ sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz)
 	st->flags = opts;
 	st->stmt = stmt;
 	st->pstmt = pst;
+	sqlbox_budget_init(&st->budget, pst);
 	st->idx = idx;
 	st->db = db;
 	st->id = ++box->lastid;
@@ -361,3 +444,103 @@ sqlbox_op_prepare_bind_async(struct sqlbox *box, const char *buf, size_t sz)
 	}
 	return 1;
 }
+
+/*
+ * Step a one-shot statement "st" for its first row and to see whether
+ * there are any more, leaving both packed in its results.
+ * Sets the results' "done" if there are no more rows.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_op_query_pack(struct sqlbox *box, struct sqlbox_stmt *st)
+{
+	size_t		 i, pos = sizeof(uint32_t);
+	int		 rc;
+	uint32_t	 val;
+
+	st->res.bufsz = SQLBOX_FRAME;
+	if ((st->res.buf = calloc(st->res.bufsz, 1)) == NULL) {
+		sqlbox_warn(&box->cfg, "query: calloc");
+		return 0;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if ((rc = sqlbox_pack_step(box, &pos, st)) < 0) {
+			sqlbox_warnx(&box->cfg, "%s: query: "
+				"sqlbox_pack_step", st->db->src->fname);
+			sqlbox_warnx(&box->cfg, "%s: statement: %s",
+				st->db->src->fname, st->pstmt->stmt);
+			return 0;
+		} else if (rc == 0) {
+			st->res.done = 1;
+			break;
+		}
+	}
+
+	val = htole32(pos - sizeof(uint32_t));
+	memcpy(st->res.buf, (char *)&val, sizeof(uint32_t));
+	st->res.bufsz = pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME;
+	return 1;
+}
+
+/*
+ * Prepare and bind parameters to a statement, then write back its
+ * identifier and first results.
+ * One-shot statements are stepped past their first row up front: if
+ * that's all there is, they're finalised right away, writing back an
+ * identifier of zero; otherwise they're kept for further stepping.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_query(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+	uint32_t		 ack;
+	int			 oneshot, done;
+
+	if ((st = sqlbox_op_prepare_bind(box, buf, sz)) == NULL) {
+		sqlbox_warnx(&box->cfg, "query: "
+			"sqlbox_op_prepare_bind");
+		return 0;
+	}
+
+	oneshot = (st->flags & SQLBOX_STMT_ONESHOT) != 0;
+	if (oneshot && !sqlbox_op_query_pack(box, st)) {
+		sqlbox_warnx(&box->cfg, "%s: query: "
+			"sqlbox_op_query_pack", st->db->src->fname);
+		return 0;
+	}
+
+	assert(st->id != 0);
+	ack = htole32(oneshot && st->res.done ? 0 : st->id);
+	if (!sqlbox_write(box, (char *)&ack, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "%s: query: "
+			"sqlbox_write", st->db->src->fname);
+		return 0;
+	}
+
+	if (!oneshot) {
+		if (sqlbox_step_stmt(box, st))
+			return 1;
+		sqlbox_warnx(&box->cfg, "%s: query: "
+			"sqlbox_step_stmt", st->db->src->fname);
+		return 0;
+	}
+
+	if (!sqlbox_res_write(box, st->res.buf, st->res.bufsz)) {
+		sqlbox_warnx(&box->cfg, "%s: query: "
+			"sqlbox_res_write", st->db->src->fname);
+		return 0;
+	}
+	done = st->res.done;
+	sqlbox_res_clear(&st->res);
+	st->res.done = done;
+
+	if (done) {
+		TAILQ_REMOVE(&st->db->stmtq, st, entries);
+		TAILQ_REMOVE(&box->stmtq, st, gentries);
+		sqlbox_wrap_finalise(box, st->db, st->pstmt, st->stmt);
+		sqlbox_stmt_free(st);
+	}
+	return 1;
+}
@@ -32,11 +32,17 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-int
-sqlbox_rebind(struct sqlbox *box, size_t id,
-	size_t psz, const struct sqlbox_parm *ps)
+/*
+ * Write a rebind frame of type "op" for the statement "id".
+ * This consists of the parameter sets in "sets", prefixed by their
+ * number if rebinding many.
+ * Returns the client's statement or NULL on failure.
+ */
+static struct sqlbox_stmt *
+sqlbox_rebind_write(struct sqlbox *box, enum sqlbox_op op,
+	size_t id, size_t setsz, const struct sqlbox_parmset *sets)
 {
-	size_t			 pos = 0, bufsz = SQLBOX_FRAME, i;
+	size_t			 pos = 0, bufsz = SQLBOX_FRAME, i, j;
 	uint32_t		 val;
 	char			*buf;
 	struct sqlbox_stmt	*st;
@@ -46,14 +52,16 @@ sqlbox_rebind(struct sqlbox *box, size_t id,
 	 * FIXME: kill server on error.
 	 */
 
-	for (i = 0; i < psz; i++) 
-		if (ps[i].type == SQLBOX_PARM_STRING &&
-		    ps[i].sz > 0 &&
-		    ps[i].sparm[ps[i].sz - 1] != '\0') {
-			sqlbox_warnx(&box->cfg, "rebind: "
-				"parameter %zu is malformed", i);
-			return 0;
-		}
+	for (j = 0; j < setsz; j++)
+		for (i = 0; i < sets[j].psz; i++) 
+			if (sets[j].ps[i].type == SQLBOX_PARM_STRING &&
+			    sets[j].ps[i].sz > 0 &&
+			    sets[j].ps[i].sparm
+			    [sets[j].ps[i].sz - 1] != '\0') {
+				sqlbox_warnx(&box->cfg, "rebind: "
+					"parameter %zu is malformed", i);
+				return NULL;
+			}
 
 	/*
 	 * Grab client's last record.
@@ -62,10 +70,13 @@ sqlbox_rebind(struct sqlbox *box, size_t id,
 
 	if ((st = sqlbox_stmt_find(box, id)) == NULL) {
 		sqlbox_warnx(&box->cfg, "rebind: sqlbox_stmt_find");
-		return 0;
+		return NULL;
+	} else if (op == SQLBOX_OP_REBIND && !sqlbox_credit(box, 1)) {
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_credit");
+		return NULL;
 	} else if ((buf = calloc(bufsz, 1)) == NULL) {
 		sqlbox_warn(&box->cfg, "rebind: calloc");
-		return 0;
+		return NULL;
 	}
 
 	/* Skip the frame size til we get the packed parms. */
@@ -74,7 +85,7 @@ sqlbox_rebind(struct sqlbox *box, size_t id,
 
 	/* Pack operation, source, statement, and parameters. */
 
-	val = htole32(SQLBOX_OP_REBIND);
+	val = htole32(op);
 	memcpy(buf + pos, (char *)&val, sizeof(uint32_t));
 	pos += sizeof(uint32_t);
 
@@ -82,12 +93,21 @@ sqlbox_rebind(struct sqlbox *box, size_t id,
 	memcpy(buf + pos, (char *)&val, sizeof(uint32_t));
 	pos += sizeof(uint32_t);
 
-	if (!sqlbox_parm_pack(box, psz, ps, &buf, &pos, &bufsz)) {
-		sqlbox_warnx(&box->cfg, "rebind: sqlbox_parm_pack");
-		free(buf);
-		return 0;
+	if (op == SQLBOX_OP_REBIND_MANY) {
+		val = htole32(setsz);
+		memcpy(buf + pos, (char *)&val, sizeof(uint32_t));
+		pos += sizeof(uint32_t);
 	}
 
+	for (j = 0; j < setsz; j++)
+		if (!sqlbox_parm_pack(box, sets[j].psz, 
+		    sets[j].ps, &buf, &pos, &bufsz)) {
+			sqlbox_warnx(&box->cfg, 
+				"rebind: sqlbox_parm_pack");
+			free(buf);
+			return NULL;
+		}
+
 	/* Go back and do the frame size. */
 
 	val = htole32(pos - 4);
@@ -95,45 +115,159 @@ sqlbox_rebind(struct sqlbox *box, size_t id,
 
 	/* Write data, free our buffer. */
 
-	if (!sqlbox_write(box, buf,
+	if (!sqlbox_write_op(box, buf,
 	    pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
-		sqlbox_warnx(&box->cfg, "rebind: sqlbox_write");
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_write_op");
 		free(buf);
-		return 0;
+		return NULL;
 	}
 	free(buf);
 
 	/* Remove any pending results. */
 
 	sqlbox_res_clear(&st->res);
+	return st;
+}
+
+int
+sqlbox_rebind(struct sqlbox *box, size_t id,
+	size_t psz, const struct sqlbox_parm *ps)
+{
+	struct sqlbox_parmset	 set;
+
+	memset(&set, 0, sizeof(struct sqlbox_parmset));
+	set.ps = (struct sqlbox_parm *)ps;
+	set.psz = psz;
+
+	if (sqlbox_rebind_write(box, 
+	    SQLBOX_OP_REBIND, id, 1, &set) == NULL) {
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_rebind_write");
+		return 0;
+	}
 	return 1;
 }
 
+const struct sqlbox_parmset *
+sqlbox_rebind_step(struct sqlbox *box, size_t id,
+	size_t psz, const struct sqlbox_parm *ps)
+{
+	struct sqlbox_stmt	*st;
+	struct sqlbox_parmset	 set;
+
+	memset(&set, 0, sizeof(struct sqlbox_parmset));
+	set.ps = (struct sqlbox_parm *)ps;
+	set.psz = psz;
+
+	if ((st = sqlbox_rebind_write(box, 
+	    SQLBOX_OP_REBIND_STEP, id, 1, &set)) == NULL) {
+		sqlbox_warnx(&box->cfg, "rebind-step: "
+			"sqlbox_rebind_write");
+		return NULL;
+	}
+	return sqlbox_step_read(box, &st->res);
+}
+
 /*
- * Prepare and bind parameters to a statement in one step.
- * Return TRUE on success, FALSE on failure (nothing is allocated).
+ * Keep the backing memory of the batch read into "res", which its
+ * parsed sets point into, in the list of earlier batches so that the
+ * next batch may be read.
+ * Returns FALSE on failure, TRUE on success.
  */
+static int
+sqlbox_res_hold(struct sqlbox *box, struct sqlbox_res *res)
+{
+	struct sqlbox_res	*hold;
+
+	if ((hold = calloc(1, sizeof(struct sqlbox_res))) == NULL) {
+		sqlbox_warn(&box->cfg, "rebind-many: calloc");
+		return 0;
+	}
+	hold->buf = res->buf;
+	hold->bufsz = res->bufsz;
+	hold->map = res->map;
+	hold->mapsz = res->mapsz;
+	hold->prev = res->prev;
+	res->buf = NULL;
+	res->bufsz = 0;
+	res->map = NULL;
+	res->mapsz = 0;
+	res->prev = hold;
+	return 1;
+}
+
 int
-sqlbox_op_rebind(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_rebind_many(struct sqlbox *box, size_t id, size_t setsz,
+	const struct sqlbox_parmset *sets, 
+	const struct sqlbox_parmset **rows, size_t *rowsz)
 {
-	size_t	 		 i, psz, parmsz;
 	struct sqlbox_stmt	*st;
-	int			 c;
-	struct sqlbox_parm	*parms = NULL;
+	const char		*frame;
+	size_t			 framesz, i, ends = 0;
 
-	/* Read the source identifier. */
+	*rows = NULL;
+	*rowsz = 0;
 
-	if (sz < sizeof(uint32_t)) {
-		sqlbox_warnx(&box->cfg, "rebind: bad frame size");
+	if ((st = sqlbox_rebind_write(box, 
+	    SQLBOX_OP_REBIND_MANY, id, setsz, sets)) == NULL) {
+		sqlbox_warnx(&box->cfg, "rebind-many: "
+			"sqlbox_rebind_write");
 		return 0;
 	}
-	if ((st = sqlbox_stmt_find
-	    (box, le32toh(*(uint32_t *)buf))) == NULL) {
-		sqlbox_warnx(&box->cfg, "rebind: sqlbox_stmt_find");
+
+	/* 
+	 * Results come in batches until each parameter set's rows have
+	 * ended with an empty one.
+	 */
+
+	for (i = 0; ; ) {
+		if (!sqlbox_res_read(box, &st->res, &frame, &framesz)) {
+			sqlbox_warnx(&box->cfg, "rebind-many: "
+				"sqlbox_res_read");
+			return 0;
+		}
+		if (!sqlbox_res_unpack(box, &st->res, frame, framesz)) {
+			sqlbox_warnx(&box->cfg, "rebind-many: "
+				"sqlbox_res_unpack");
+			return 0;
+		}
+		for ( ; i < st->res.setsz; i++)
+			if (st->res.set[i].psz == 0)
+				ends++;
+		if (ends >= setsz)
+			break;
+		if (!sqlbox_res_hold(box, &st->res)) {
+			sqlbox_warnx(&box->cfg, "rebind-many: "
+				"sqlbox_res_hold");
+			return 0;
+		}
+	}
+
+	if (ends != setsz) {
+		sqlbox_warnx(&box->cfg, "rebind-many: "
+			"bad number of results");
 		return 0;
 	}
-	buf += sizeof(uint32_t);
-	sz -= sizeof(uint32_t);
+
+	/* Don't return these from sqlbox_step(). */
+
+	st->res.curset = st->res.setsz;
+	*rows = st->res.set;
+	*rowsz = st->res.setsz;
+	return 1;
+}
+
+/*
+ * Reset "st" and bind the packed parameters at the start of "buf" to
+ * it.
+ * Return the number of bytes read from "buf" on success, zero on
+ * failure (nothing is allocated).
+ */
+static size_t
+sqlbox_rebind_bind(struct sqlbox *box, struct sqlbox_stmt *st,
+	const char *buf, size_t sz)
+{
+	size_t	 		 psz, parmsz;
+	struct sqlbox_parm	*parms = NULL;
 
 	/* 
 	 * Don't check the return code, as this just returns whatever
@@ -142,6 +276,7 @@ sqlbox_op_rebind(struct sqlbox *box, const char *buf, size_t sz)
 	sqlbox_debug(&box->cfg, "sqlite3_reset: %s, %s",
 		st->db->src->fname, st->pstmt->stmt);
 	sqlite3_reset(st->stmt);
+	sqlbox_budget_init(&st->budget, st->pstmt);
 
 	sqlbox_debug(&box->cfg, "sqlite3_clear_bindings: %s, %s",
 		st->db->src->fname, st->pstmt->stmt);
@@ -164,88 +299,193 @@ sqlbox_op_rebind(struct sqlbox *box, const char *buf, size_t sz)
 		free(parms);
 		return 0;
 	}
-	sz -= psz;
-	buf += psz;
-	if (sz != 0) {
-		sqlbox_warnx(&box->cfg, "rebind: bad frame size");
+
+	/* Bind parameters. */
+
+	if (!sqlbox_parm_bind(box, st->db, 
+	    st->pstmt, st->stmt, parms, parmsz)) {
+		sqlbox_warnx(&box->cfg, "%s: rebind: "
+			"sqlbox_parm_bind", st->db->src->fname);
 		free(parms);
 		return 0;
 	}
 
-	/* 
-	 * Bind parameters.
-	 * Note that we mark the strings as SQLITE_TRANSIENT because
-	 * we're probably going to lose the buffer during the next read
-	 * and so it needs to be stored.
-	 */
+	free(parms);
+	return psz;
+}
 
-	for (i = 0; i < (size_t)parmsz; i++) {
-		switch (parms[i].type) {
-		case SQLBOX_PARM_BLOB:
-			c = sqlite3_bind_blob(st->stmt, i + 1,
-				parms[i].bparm, parms[i].sz, 
-				SQLITE_TRANSIENT);
-			sqlbox_debug(&box->cfg, "sqlite3_bind_blob[%zu]: "
-				"%s, %s (%zu bytes)", i, 
-				st->db->src->fname, 
-				st->pstmt->stmt, parms[i].sz - 1);
-			break;
-		case SQLBOX_PARM_FLOAT:
-			c = sqlite3_bind_double
-				(st->stmt, i + 1, parms[i].fparm);
-			sqlbox_debug(&box->cfg, 
-				"sqlite3_bind_double[%zu]: %s, %s", i,
-				st->db->src->fname, st->pstmt->stmt);
-			break;
-		case SQLBOX_PARM_INT:
-			c = sqlite3_bind_int64
-				(st->stmt, i + 1, parms[i].iparm);
-			sqlbox_debug(&box->cfg,
-				"sqlite3_bind_int64[%zu]: %s, %s", i, 
-				st->db->src->fname, st->pstmt->stmt);
-			break;
-		case SQLBOX_PARM_NULL:
-			c = sqlite3_bind_null(st->stmt, i + 1);
-			sqlbox_debug(&box->cfg, 
-				"sqlite3_bind_null[%zu]: %s, %s", i, 
-				st->db->src->fname, st->pstmt->stmt);
-			break;
-		case SQLBOX_PARM_STRING:
-			c = sqlite3_bind_text(st->stmt, i + 1,
-				parms[i].sparm, parms[i].sz - 1, 
-				SQLITE_TRANSIENT);
-			sqlbox_debug(&box->cfg, 
-				"sqlite3_bind_text[%zu]: %s, %s "
-				"(%zu bytes)", i, st->db->src->fname, 
-				st->pstmt->stmt, parms[i].sz - 1);
-			break;
-		default:
-			sqlbox_warnx(&box->cfg, "%s: rebind: "
-				"bad type: %d", st->db->src->fname, 
-				parms[i].type);
-			sqlbox_warnx(&box->cfg, "%s: rebind: "
-				"statement: %s", st->db->src->fname, 
-				st->pstmt->stmt);
-			free(parms);
+/*
+ * Reset a statement and bind new parameters to it.
+ * Return the statement on success, NULL on failure (nothing is
+ * allocated).
+ */
+static struct sqlbox_stmt *
+sqlbox_rebind_stmt(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+	size_t			 psz;
+
+	/* Read the statement identifier. */
+
+	if (sz < sizeof(uint32_t)) {
+		sqlbox_warnx(&box->cfg, "rebind: bad frame size");
+		return NULL;
+	}
+	if ((st = sqlbox_stmt_find
+	    (box, le32toh(*(uint32_t *)buf))) == NULL) {
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_stmt_find");
+		return NULL;
+	}
+	buf += sizeof(uint32_t);
+	sz -= sizeof(uint32_t);
+
+	if ((psz = sqlbox_rebind_bind(box, st, buf, sz)) == 0) {
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_rebind_bind");
+		return NULL;
+	} else if (psz != sz) {
+		sqlbox_warnx(&box->cfg, "rebind: bad frame size");
+		return NULL;
+	}
+	
+	/* Now get ready for new stepping. */
+
+	sqlbox_res_clear(&st->res);
+	return st;
+}
+
+/*
+ * Rebind parameters to a statement.
+ * Return TRUE on success, FALSE on failure (nothing is allocated).
+ */
+int
+sqlbox_op_rebind(struct sqlbox *box, const char *buf, size_t sz)
+{
+
+	return sqlbox_rebind_stmt(box, buf, sz) != NULL;
+}
+
+/*
+ * Rebind parameters to a statement and step it, returning the first
+ * batch of results in the same exchange.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_rebind_step(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+
+	if ((st = sqlbox_rebind_stmt(box, buf, sz)) == NULL) {
+		sqlbox_warnx(&box->cfg, "rebind-step: "
+			"sqlbox_rebind_stmt");
+		return 0;
+	}
+	return sqlbox_step_stmt(box, st);
+}
+
+/*
+ * Write the results of "st" packed up to "pos" as one batch, then
+ * start the next batch.
+ * Return TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_rebind_many_write(struct sqlbox *box,
+	struct sqlbox_stmt *st, size_t *pos)
+{
+	uint32_t	 val;
+
+	val = htole32(*pos - sizeof(uint32_t));
+	memcpy(st->res.buf, (char *)&val, sizeof(uint32_t));
+	if (!sqlbox_res_write(box, st->res.buf, 
+	    *pos > SQLBOX_FRAME ? *pos : SQLBOX_FRAME)) {
+		sqlbox_warnx(&box->cfg, "rebind-many: sqlbox_res_write");
+		return 0;
+	}
+	*pos = sizeof(uint32_t);
+	return 1;
+}
+
+/*
+ * Rebind each of a number of parameter sets to a statement in turn,
+ * stepping it to completion for each, and write back the results.
+ * Each set's results end with the empty terminating row, as would be
+ * returned by sqlbox_op_step().
+ * Results are written in batches of about SQLBOX_CACHE_MAX bytes, a
+ * batch only being written once there's another row to follow, so the
+ * last batch always holds the last terminating row.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_rebind_many(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+	size_t			 i, setsz, psz, pos;
+	int			 rc;
+
+	/* Read the statement identifier and number of sets. */
+
+	if (sz < sizeof(uint32_t) * 2) {
+		sqlbox_warnx(&box->cfg, "rebind-many: bad frame size");
+		return 0;
+	}
+	if ((st = sqlbox_stmt_find
+	    (box, le32toh(*(uint32_t *)buf))) == NULL) {
+		sqlbox_warnx(&box->cfg, "rebind-many: "
+			"sqlbox_stmt_find");
+		return 0;
+	}
+	buf += sizeof(uint32_t);
+	sz -= sizeof(uint32_t);
+
+	setsz = le32toh(*(uint32_t *)buf);
+	buf += sizeof(uint32_t);
+	sz -= sizeof(uint32_t);
+
+	/* Prime the result buffer, skipping the frame size. */
+
+	sqlbox_res_clear(&st->res);
+	st->res.bufsz = SQLBOX_FRAME;
+	if ((st->res.buf = calloc(st->res.bufsz, 1)) == NULL) {
+		sqlbox_warn(&box->cfg, "rebind-many: calloc");
+		return 0;
+	}
+	pos = sizeof(uint32_t);
+
+	for (i = 0; i < setsz; i++) {
+		if ((psz = sqlbox_rebind_bind(box, st, buf, sz)) == 0) {
+			sqlbox_warnx(&box->cfg, "rebind-many: "
+				"sqlbox_rebind_bind (set %zu)", i);
 			return 0;
 		}
-		if (c != SQLITE_OK) {
-			sqlbox_warnx(&box->cfg, "%s: rebind: %s", 
-				st->db->src->fname, 
-				sqlite3_errmsg(st->db->db));
-			sqlbox_warnx(&box->cfg, "%s: rebind: "
-				"statement: %s", 
-				st->db->src->fname, st->pstmt->stmt);
-			free(parms);
+		buf += psz;
+		sz -= psz;
+		for (;;) {
+			if (pos >= SQLBOX_CACHE_MAX &&
+			    !sqlbox_rebind_many_write(box, st, &pos))
+				return 0;
+			if ((rc = sqlbox_pack_step(box, &pos, st)) <= 0)
+				break;
+		}
+		if (rc < 0) {
+			sqlbox_warnx(&box->cfg, "%s: rebind-many: "
+				"sqlbox_pack_step", st->db->src->fname);
+			sqlbox_warnx(&box->cfg, "%s: rebind-many: "
+				"statement: %s", st->db->src->fname, 
+				st->pstmt->stmt);
 			return 0;
 		}
 	}
 
-	free(parms);
-	
-	/* Now get ready for new stepping. */
+	if (sz != 0) {
+		sqlbox_warnx(&box->cfg, "rebind-many: bad frame size");
+		return 0;
+	}
+
+	if (!sqlbox_rebind_many_write(box, st, &pos))
+		return 0;
+
+	/* All results have been consumed. */
 
 	sqlbox_res_clear(&st->res);
+	st->res.done = 1;
 	return 1;
 }
-
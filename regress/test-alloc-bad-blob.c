@@ -0,0 +1,52 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_role	 roles[] = {
+		{ .rolesz = 0,
+		  .stmtsz = 0,
+		  .srcsz = 0,
+		  .wblobs = (size_t[]){ 0 },
+		  .wblobsz = 1 }
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.roles.rolesz = nitems(roles);
+	cfg.roles.roles = roles;
+
+	/* This should fail: we defined a bad blob column. */
+
+	if ((p = sqlbox_alloc(&cfg)) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should be NULL");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+	};
+	struct sqlbox_progparm	 parms[] = {
+		{ .type = SQLBOX_PROGP_LASTID, .idx = 1 },
+	};
+	struct sqlbox_progstep	 steps[] = {
+		{ .stmt = 0, .parms = parms, .parmsz = 1 },
+		{ .stmt = 0, .parms = parms, .parmsz = 1 },
+	};
+	struct sqlbox_prog	 progs[] = {
+		{ .steps = steps, .stepsz = nitems(steps) },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.progs.progsz = nitems(progs);
+	cfg.progs.progs = progs;
+
+	/* This should fail: a step uses its own row identifier. */
+
+	if ((p = sqlbox_alloc(&cfg)) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should be NULL");
+
+	/* This should fail: a step uses a bad statement. */
+
+	parms[0].idx = 0;
+	steps[1].stmt = 1;
+	if ((p = sqlbox_alloc(&cfg)) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should be NULL");
+
+	/* Now it's fine. */
+
+	steps[1].stmt = 0;
+	steps[0].parmsz = 0;
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	sqlbox_free(p);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	BLOBSZ	(300 * 1024)
+#define	ROWS	8
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid, id, i;
+	char			*in, *out;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER, b BLOB)" },
+		{ .stmt = (char *)"INSERT INTO foo (a, b) VALUES (?, ?)" },
+		{ .stmt = (char *)"SELECT a, b FROM foo ORDER BY a" },
+	};
+	struct sqlbox_pblob	 pblobs[] = {
+		{ .table = (char *)"foo",
+		  .column = (char *)"b" },
+	};
+	struct sqlbox_parm	 parms[] = {
+		{ .type = SQLBOX_PARM_INT },
+		{ .sz = BLOBSZ,
+		  .type = SQLBOX_PARM_BLOB },
+	};
+	const struct sqlbox_parmset *res;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.comm.seqpacket = 1;
+	cfg.comm.sndbuf = 16384;
+	cfg.comm.rcvbuf = 16384;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.blobs.blobsz = nitems(pblobs);
+	cfg.blobs.blobs = pblobs;
+
+	if ((in = malloc(BLOBSZ)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	if ((out = malloc(BLOBSZ)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (i = 0; i < BLOBSZ; i++)
+		in[i] = (char)(i % 251);
+	parms[1].bparm = in;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Frames much larger than the socket buffers. */
+
+	for (i = 0; i < ROWS; i++) {
+		parms[0].iparm = i;
+		if (!sqlbox_exec_async
+		    (p, dbid, 1, nitems(parms), parms, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_async");
+	}
+
+	if (!(stmtid = sqlbox_prepare_bind
+	    (p, dbid, 2, 0, NULL, SQLBOX_STMT_MULTI)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	for (i = 0; i < ROWS; i++) {
+		if ((res = sqlbox_step(p, stmtid)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 2 ||
+		    res->ps[0].iparm != (int64_t)i ||
+		    res->ps[1].type != SQLBOX_PARM_BLOB ||
+		    res->ps[1].sz != BLOBSZ ||
+		    memcmp(res->ps[1].bparm, in, BLOBSZ))
+			errx(EXIT_FAILURE, "bad row");
+	}
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 0)
+		errx(EXIT_FAILURE, "res->psz != 0");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	/* Raw blob data in a single write and read. */
+
+	for (i = 0; i < BLOBSZ; i++)
+		in[i] = (char)(i % 239);
+	if (!(id = sqlbox_blob_open(p, dbid, 0, 1, 
+	    SQLBOX_BLOB_WRITE, NULL)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (!sqlbox_blob_write(p, id, in, BLOBSZ, 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_write");
+	if (!sqlbox_blob_read(p, id, out, BLOBSZ, 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_read");
+	if (memcmp(in, out, BLOBSZ))
+		errx(EXIT_FAILURE, "blob mismatch");
+	if (!sqlbox_blob_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+
+	if (!sqlbox_close(p, dbid))
+		errx(EXIT_FAILURE, "sqlbox_close");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	sqlbox_free(p);
+	free(in);
+	free(out);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	BLOBSZ	(100 * 1024)
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, rid, wid;
+	char			*buf;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar BLOB)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (zeroblob(?))" },
+		{ .stmt = (char *)"UPDATE foo SET bar = zeroblob(?)" },
+	};
+	struct sqlbox_pblob	 pblobs[] = {
+		{ .table = (char *)"foo",
+		  .column = (char *)"bar" },
+	};
+	struct sqlbox_parm	 parms[] = {
+		{ .iparm = BLOBSZ,
+		  .type = SQLBOX_PARM_INT },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.blobs.blobsz = nitems(pblobs);
+	cfg.blobs.blobs = pblobs;
+
+	if ((buf = calloc(1, BLOBSZ)) == NULL)
+		err(EXIT_FAILURE, NULL);
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (SQLBOX_CODE_OK != sqlbox_exec
+	    (p, dbid, 1, nitems(parms), parms, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	if (!(rid = sqlbox_blob_open(p, dbid, 0, 1, 
+	    SQLBOX_BLOB_READ, NULL)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (!(wid = sqlbox_blob_open(p, dbid, 0, 1, 
+	    SQLBOX_BLOB_WRITE, NULL)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (!sqlbox_blob_read(p, rid, buf, BLOBSZ, 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_read");
+
+	/* Changing the row expires both handles. */
+
+	if (SQLBOX_CODE_OK != sqlbox_exec
+	    (p, dbid, 2, nitems(parms), parms, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	if (sqlbox_blob_read(p, rid, buf, BLOBSZ, 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_read should fail");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (sqlbox_blob_write(p, wid, buf, BLOBSZ, 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_write should fail");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	/* They're still closed as usual. */
+
+	if (!sqlbox_blob_close(p, rid))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+	if (!sqlbox_blob_close(p, wid))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+	if (!sqlbox_close(p, dbid))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	free(buf);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, id;
+	char			 buf[3];
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar BLOB, baz BLOB)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar, baz) "
+			"VALUES (x'616263', zeroblob(3))" },
+	};
+	struct sqlbox_pblob	 pblobs[] = {
+		{ .table = (char *)"foo",
+		  .column = (char *)"bar" },
+		{ .table = (char *)"foo",
+		  .column = (char *)"baz" },
+	};
+	struct sqlbox_role	 roles[] = {
+		{ .rolesz = 0,
+		  .stmts = (size_t[]){ 0, 1 },
+		  .stmtsz = 2,
+		  .srcs = (size_t[]){ 0 },
+		  .srcsz = 1,
+		  .blobs = (size_t[]){ 0 },
+		  .blobsz = 1,
+		  .wblobs = (size_t[]){ 1 },
+		  .wblobsz = 1 }
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.blobs.blobsz = nitems(pblobs);
+	cfg.blobs.blobs = pblobs;
+	cfg.roles.rolesz = nitems(roles);
+	cfg.roles.roles = roles;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 1, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* The first column may be read. */
+
+	if (!(id = sqlbox_blob_open(p, dbid, 0, 1, 
+	    SQLBOX_BLOB_READ, NULL)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (!sqlbox_blob_read(p, id, buf, sizeof(buf), 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_read");
+	if (memcmp(buf, "abc", 3))
+		errx(EXIT_FAILURE, "bad blob");
+	if (!sqlbox_blob_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+
+	/* The second may be read and written. */
+
+	if (!(id = sqlbox_blob_open(p, dbid, 1, 1, 
+	    SQLBOX_BLOB_READ, NULL)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (!sqlbox_blob_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+	if (!(id = sqlbox_blob_open(p, dbid, 1, 1, 
+	    SQLBOX_BLOB_WRITE, NULL)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (!sqlbox_blob_write(p, id, "xyz", 3, 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_write");
+	if (!sqlbox_blob_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+
+	/* Writing the first is denied. */
+
+	if (sqlbox_blob_open(p, dbid, 0, 1, SQLBOX_BLOB_WRITE, NULL))
+		errx(EXIT_FAILURE, "sqlbox_blob_open should fail");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	BLOBSZ	(300 * 1024)
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, id, sz, off, rowsz;
+	char			*in, *out;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar BLOB)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (zeroblob(?))" },
+		{ .stmt = (char *)"SELECT length(bar), "
+			"substr(bar, 200001, 1) FROM foo" },
+	};
+	struct sqlbox_pblob	 pblobs[] = {
+		{ .table = (char *)"foo",
+		  .column = (char *)"bar" },
+	};
+	struct sqlbox_parm	 parms[] = {
+		{ .iparm = BLOBSZ,
+		  .type = SQLBOX_PARM_INT },
+	};
+	const struct sqlbox_parmset *rows;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.blobs.blobsz = nitems(pblobs);
+	cfg.blobs.blobs = pblobs;
+
+	if ((in = malloc(BLOBSZ)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	if ((out = malloc(BLOBSZ)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (off = 0; off < BLOBSZ; off++)
+		in[off] = (char)(off % 251);
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (SQLBOX_CODE_OK != sqlbox_exec
+	    (p, dbid, 1, nitems(parms), parms, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Write in uneven pieces. */
+
+	if (!(id = sqlbox_blob_open(p, dbid, 0, 1, 
+	    SQLBOX_BLOB_WRITE, &sz)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (sz != BLOBSZ)
+		errx(EXIT_FAILURE, "bad blob size: %zu", sz);
+	for (off = 0; off < sz; off += 70000)
+		if (!sqlbox_blob_write(p, id, in + off,
+		    sz - off < 70000 ? sz - off : 70000, off))
+			errx(EXIT_FAILURE, "sqlbox_blob_write");
+	if (!sqlbox_blob_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+
+	/* Read back all at once and in part. */
+
+	if (!(id = sqlbox_blob_open(p, dbid, 0, 1, 
+	    SQLBOX_BLOB_READ, NULL)))
+		errx(EXIT_FAILURE, "sqlbox_blob_open");
+	if (!sqlbox_blob_read(p, id, out, BLOBSZ, 0))
+		errx(EXIT_FAILURE, "sqlbox_blob_read");
+	if (memcmp(in, out, BLOBSZ))
+		errx(EXIT_FAILURE, "blob mismatch");
+	if (!sqlbox_blob_read(p, id, out, 10, BLOBSZ - 10))
+		errx(EXIT_FAILURE, "sqlbox_blob_read");
+	if (memcmp(in + BLOBSZ - 10, out, 10))
+		errx(EXIT_FAILURE, "blob mismatch");
+	if (!sqlbox_blob_read(p, id, out, 0, BLOBSZ))
+		errx(EXIT_FAILURE, "sqlbox_blob_read");
+	if (!sqlbox_blob_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_blob_close");
+
+	/* Writes are visible to statements. */
+
+	if (SQLBOX_CODE_OK != sqlbox_exec_rows
+	    (p, dbid, 2, 0, NULL, 0, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].psz != 2 ||
+	    rows[0].ps[0].iparm != BLOBSZ ||
+	    rows[0].ps[1].type != SQLBOX_PARM_BLOB ||
+	    rows[0].ps[1].sz != 1 ||
+	    *(const char *)rows[0].ps[1].bparm != in[200000])
+		errx(EXIT_FAILURE, "bad row");
+
+	if (!sqlbox_close(p, dbid))
+		errx(EXIT_FAILURE, "sqlbox_close");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	sqlbox_free(p);
+	free(in);
+	free(out);
+	return EXIT_SUCCESS;
+}
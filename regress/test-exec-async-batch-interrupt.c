@@ -0,0 +1,115 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	char			 db[MAXPATHLEN];
+	size_t		 	 dbid1, dbid2, rowsz;
+	struct sqlbox		*p1, *p2;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC,
+		  .flags = SQLBOX_SRC_BATCH }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	const struct sqlbox_parmset *rows;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p1 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if ((p2 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid1 = sqlbox_open(p1, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p1, dbid1, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!(dbid2 = sqlbox_open(p2, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* 
+	 * Lock out the second box, which waits forever to start its
+	 * batch until interrupted.
+	 */
+
+	if (!sqlbox_trans_exclusive(p1, dbid1, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_exclusive");
+	if (!sqlbox_ping(p1))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (!sqlbox_exec_async(p2, dbid2, 1, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+	if (!sqlbox_interrupt(p2))
+		errx(EXIT_FAILURE, "sqlbox_interrupt");
+	if (!sqlbox_ping(p2))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	/* The interrupted write was dropped. */
+
+	if (!sqlbox_trans_commit(p1, dbid1, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_commit");
+	if (!sqlbox_ping(p1))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (SQLBOX_CODE_OK != sqlbox_exec_rows
+	    (p2, dbid2, 2, 0, NULL, 0, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].ps[0].iparm != 0)
+		errx(EXIT_FAILURE, "expected no rows");
+
+	/* Once released, it works. */
+
+	if (!sqlbox_exec_async(p2, dbid2, 1, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+	if (SQLBOX_CODE_OK != sqlbox_exec_rows
+	    (p2, dbid2, 2, 0, NULL, 0, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].ps[0].iparm != 1)
+		errx(EXIT_FAILURE, "expected one row");
+
+	sqlbox_free(p1);
+	sqlbox_free(p2);
+	unlink(db);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+static int64_t
+count(struct sqlbox *p, size_t dbid)
+{
+	size_t		 	 stmtid;
+	int64_t			 v;
+	const struct sqlbox_parmset *res;
+
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1)
+		errx(EXIT_FAILURE, "bad row");
+	v = res->ps[0].iparm;
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	return v;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char			 db[MAXPATHLEN];
+	size_t		 	 dbid1, dbid2, i;
+	struct sqlbox		*p1, *p2;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC,
+		  .flags = SQLBOX_SRC_BATCH,
+		  .batch = { .maxrows = 10, .maxms = 60000 } }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE IF NOT EXISTS "
+			"foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.comm.window = 4;
+
+	if ((p1 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid1 = sqlbox_open(p1, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p1, dbid1, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	if ((p2 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid2 = sqlbox_open(p2, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* 
+	 * The ninth write reclaims the window for the second time, by
+	 * which the first eight have been run: the pings mustn't have
+	 * committed them.
+	 */
+
+	for (i = 0; i < 9; i++)
+		if (!sqlbox_exec_async(p1, dbid1, 1, 0, NULL, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_async");
+	if (count(p2, dbid2) != 0)
+		errx(EXIT_FAILURE, "batch committed early");
+
+	/* 
+	 * The thirteenth write reclaims the window again, by which
+	 * the first batch of ten has been committed.
+	 */
+
+	for ( ; i < 13; i++)
+		if (!sqlbox_exec_async(p1, dbid1, 1, 0, NULL, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_async");
+	if (count(p2, dbid2) != 10)
+		errx(EXIT_FAILURE, "bad row count");
+
+	sqlbox_free(p2);
+	sqlbox_free(p1);
+
+	if (unlink(db) == -1)
+		err(EXIT_FAILURE, "%s", db);
+	return EXIT_SUCCESS;
+}
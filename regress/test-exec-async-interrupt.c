@@ -0,0 +1,88 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS "
+			"(SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+			"SELECT count(*) FROM c" },
+		{ .stmt = (char *)"SELECT 1" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* This never finishes on its own. */
+
+	if (!sqlbox_exec_async(p, dbid, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+
+	/* The control channel answers while we're busy. */
+
+	if (!sqlbox_ping_oob(p))
+		errx(EXIT_FAILURE, "sqlbox_ping_oob");
+
+	/* 
+	 * This stops the statement whether or not it has started, as
+	 * interrupts are held until consumed.
+	 */
+
+	if (!sqlbox_interrupt(p))
+		errx(EXIT_FAILURE, "sqlbox_interrupt");
+
+	/* The server survives to run the next statement. */
+
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 1, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!sqlbox_close(p, dbid))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid, i;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	struct sqlbox_parm	 parms[] = {
+		{ .iparm = 10,
+		  .type = SQLBOX_PARM_INT },
+	};
+	const struct sqlbox_parmset *res;
+	int			 blocked;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.comm.window = 2;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Fill the window, then make sure we'd block. */
+
+	for (i = 0; i < 2; i++) {
+		if (!sqlbox_exec_async_nb(p, dbid, 1, 
+		    nitems(parms), parms, 0, &blocked))
+			errx(EXIT_FAILURE, "sqlbox_exec_async_nb");
+		if (blocked)
+			errx(EXIT_FAILURE, "sqlbox_exec_async_nb: "
+				"blocked with room in window");
+	}
+	if (!sqlbox_exec_async_nb(p, dbid, 1, 
+	    nitems(parms), parms, 0, &blocked))
+		errx(EXIT_FAILURE, "sqlbox_exec_async_nb");
+	if (!blocked)
+		errx(EXIT_FAILURE, "sqlbox_exec_async_nb should block");
+	if (!sqlbox_prepare_bind_async_nb(p, dbid, 2, 
+	    0, NULL, 0, &blocked))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind_async_nb");
+	if (!blocked)
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind_async_nb "
+			"should block");
+
+	/* Synchronising reclaims the window. */
+
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (!sqlbox_exec_async_nb(p, dbid, 1, 
+	    nitems(parms), parms, 0, &blocked))
+		errx(EXIT_FAILURE, "sqlbox_exec_async_nb");
+	if (blocked)
+		errx(EXIT_FAILURE, "sqlbox_exec_async_nb: "
+			"blocked after reclaiming window");
+
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1 || res->ps[0].iparm != 3)
+		errx(EXIT_FAILURE, "bad row count");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+static void *
+interrupter(void *arg)
+{
+
+	usleep(200000);
+	return sqlbox_interrupt(arg) ? arg : NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid;
+	int64_t			 changes;
+	pthread_t		 thr;
+	void			*thrrc;
+	int			 er;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)",
+		  .chunk_ms = 50 },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* 
+	 * The statement always changes rows, so it would run until
+	 * its maximum: have another thread interrupt it once, likely
+	 * while pausing between runs.
+	 */
+
+	if ((er = pthread_create(&thr, NULL, interrupter, p)) != 0)
+		errx(EXIT_FAILURE, "pthread_create: %s", strerror(er));
+
+	if (SQLBOX_CODE_INTERRUPT != sqlbox_exec_chunk
+	    (p, dbid, 1, 0, NULL, 0, &changes))
+		errx(EXIT_FAILURE, "sqlbox_exec_chunk");
+	if ((er = pthread_join(thr, &thrrc)) != 0)
+		errx(EXIT_FAILURE, "pthread_join: %s", strerror(er));
+	if (thrrc == NULL)
+		errx(EXIT_FAILURE, "sqlbox_interrupt");
+	if (changes <= 0)
+		errx(EXIT_FAILURE, "bad changes: %lld", 
+			(long long)changes);
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, rowsz;
+	int64_t			 changes;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS "
+			"(SELECT 0 UNION ALL SELECT x + 1 FROM c "
+			"WHERE x < 999) INSERT INTO foo SELECT x FROM c" },
+		{ .stmt = (char *)"DELETE FROM foo WHERE rowid IN "
+			"(SELECT rowid FROM foo WHERE bar < ? LIMIT ?)",
+		  .chunk_ms = 1 },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	struct sqlbox_parm	 parms[] = {
+		{ .iparm = 700,
+		  .type = SQLBOX_PARM_INT },
+		{ .iparm = 64,
+		  .type = SQLBOX_PARM_INT },
+	};
+	const struct sqlbox_parmset *rows;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 1, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Delete in chunks smaller than the total. */
+
+	if (SQLBOX_CODE_OK != sqlbox_exec_chunk
+	    (p, dbid, 2, nitems(parms), parms, 0, &changes))
+		errx(EXIT_FAILURE, "sqlbox_exec_chunk");
+	if (changes != 700)
+		errx(EXIT_FAILURE, "bad changes: %lld", 
+			(long long)changes);
+
+	/* Nothing left to delete. */
+
+	if (SQLBOX_CODE_OK != sqlbox_exec_chunk
+	    (p, dbid, 2, nitems(parms), parms, 0, &changes))
+		errx(EXIT_FAILURE, "sqlbox_exec_chunk");
+	if (changes != 0)
+		errx(EXIT_FAILURE, "bad changes: %lld", 
+			(long long)changes);
+
+	/* Read-only statements run once. */
+
+	if (SQLBOX_CODE_OK != sqlbox_exec_chunk
+	    (p, dbid, 3, 0, NULL, 0, &changes))
+		errx(EXIT_FAILURE, "sqlbox_exec_chunk");
+	if (changes != 0)
+		errx(EXIT_FAILURE, "bad changes: %lld", 
+			(long long)changes);
+
+	if (SQLBOX_CODE_OK != sqlbox_exec_rows
+	    (p, dbid, 3, 0, NULL, 0, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].psz != 1 || 
+	    rows[0].ps[0].iparm != 300)
+		errx(EXIT_FAILURE, "bad row count");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
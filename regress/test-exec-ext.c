@@ -0,0 +1,91 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox			*p;
+	struct sqlbox_cfg		 cfg;
+	struct sqlbox_src		 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(id INTEGER PRIMARY KEY, bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"UPDATE foo SET bar = bar + 1" },
+	};
+	struct sqlbox_parm		 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+	size_t				 i, id;
+	int64_t				 changes, lastid;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.srcs.srcs = srcs;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(id = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec_ext(p, id, 0, 0, NULL, 0, 
+	    NULL, NULL) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_ext");
+
+	for (i = 1; i <= 3; i++) {
+		parm.iparm = i;
+		if (sqlbox_exec_ext(p, id, 1, 1, &parm, 0, 
+		    &changes, &lastid) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec_ext");
+		if (changes != 1)
+			errx(EXIT_FAILURE, "sqlbox_exec_ext: "
+				"bad changes");
+		if (lastid != (int64_t)i)
+			errx(EXIT_FAILURE, "sqlbox_exec_ext: "
+				"bad lastid");
+	}
+
+	/* Without parameters and only asking for changes. */
+
+	if (sqlbox_exec_ext(p, id, 2, 0, NULL, 0, 
+	    &changes, NULL) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_ext");
+	if (changes != 3)
+		errx(EXIT_FAILURE, "sqlbox_exec_ext: bad changes");
+
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	BLOBSZ	(100 * 1024)
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, i, rowsz;
+	char			*blob;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(a INTEGER, b BLOB, c TEXT, d BLOB)" },
+		{ .stmt = (char *)"INSERT INTO foo "
+			"(a, b, c, d) VALUES (?, ?, ?, ?)" },
+		{ .stmt = (char *)"SELECT a, b, c, d FROM foo "
+			"ORDER BY a" },
+	};
+	struct sqlbox_parm	 parms[] = {
+		{ .type = SQLBOX_PARM_INT },
+		{ .type = SQLBOX_PARM_BLOB,
+		  .sz = BLOBSZ },
+		{ .sparm = "hello",
+		  .type = SQLBOX_PARM_STRING },
+		{ .bparm = "xyz",
+		  .sz = 3,
+		  .type = SQLBOX_PARM_BLOB },
+	};
+	const struct sqlbox_parmset *rows;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.comm.memfd = 4096;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((blob = malloc(BLOBSZ)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (i = 0; i < BLOBSZ; i++)
+		blob[i] = (char)(i % 253);
+	parms[1].bparm = blob;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Interleave synchronous and asynchronous writes. */
+
+	for (i = 0; i < 4; i++) {
+		parms[0].iparm = i;
+		if (i % 2 == 0 && SQLBOX_CODE_OK != sqlbox_exec
+		    (p, dbid, 1, nitems(parms), parms, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		if (i % 2 == 1 && !sqlbox_exec_async
+		    (p, dbid, 1, nitems(parms), parms, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_async");
+	}
+
+	if (SQLBOX_CODE_OK != sqlbox_exec_rows
+	    (p, dbid, 2, 0, NULL, SQLBOX_STMT_MULTI, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 4)
+		errx(EXIT_FAILURE, "bad row count: %zu", rowsz);
+	for (i = 0; i < rowsz; i++) {
+		if (rows[i].psz != 4)
+			errx(EXIT_FAILURE, "bad column count");
+		if (rows[i].ps[0].iparm != (int64_t)i)
+			errx(EXIT_FAILURE, "bad integer");
+		if (rows[i].ps[1].type != SQLBOX_PARM_BLOB ||
+		    rows[i].ps[1].sz != BLOBSZ ||
+		    memcmp(rows[i].ps[1].bparm, blob, BLOBSZ))
+			errx(EXIT_FAILURE, "bad large blob");
+		if (rows[i].ps[2].type != SQLBOX_PARM_STRING ||
+		    strcmp(rows[i].ps[2].sparm, "hello"))
+			errx(EXIT_FAILURE, "bad string");
+		if (rows[i].ps[3].type != SQLBOX_PARM_BLOB ||
+		    rows[i].ps[3].sz != 3 ||
+		    memcmp(rows[i].ps[3].bparm, "xyz", 3))
+			errx(EXIT_FAILURE, "bad small blob");
+	}
+
+	sqlbox_free(p);
+	free(blob);
+	return EXIT_SUCCESS;
+}
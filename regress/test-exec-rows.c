@@ -0,0 +1,116 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox			*p;
+	struct sqlbox_cfg		 cfg;
+	struct sqlbox_src		 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(id INTEGER PRIMARY KEY, bar TEXT UNIQUE)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) "
+			"VALUES (?) RETURNING id, upper(bar)" },
+		{ .stmt = (char *)"SELECT id FROM foo ORDER BY id" },
+	};
+	struct sqlbox_parm		 parm = {
+		.type = SQLBOX_PARM_STRING
+	};
+	const struct sqlbox_parmset	*rows;
+	size_t				 rowsz, id;
+	enum sqlbox_code		 code;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.srcs.srcs = srcs;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(id = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* No rows. */
+
+	code = sqlbox_exec_rows(p, id, 0, 0, NULL, 0, &rows, &rowsz);
+	if (code != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 0)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: bad rows");
+
+	/* One row from the RETURNING clause. */
+
+	parm.sparm = "abc";
+	code = sqlbox_exec_rows(p, id, 1, 1, &parm, 0, &rows, &rowsz);
+	if (code != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].psz != 2)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: bad rows");
+	if (rows[0].ps[0].type != SQLBOX_PARM_INT ||
+	    rows[0].ps[0].iparm != 1)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: bad id");
+	if (rows[0].ps[1].type != SQLBOX_PARM_STRING ||
+	    strcmp(rows[0].ps[1].sparm, "ABC"))
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: bad value");
+
+	parm.sparm = "def";
+	code = sqlbox_exec_rows(p, id, 1, 1, &parm, 0, &rows, &rowsz);
+	if (code != SQLBOX_CODE_OK || rowsz != 1)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rows[0].ps[0].iparm != 2)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: bad id");
+
+	/* Constraint violations still report the code. */
+
+	code = sqlbox_exec_rows(p, id, 1, 1, &parm, 
+		SQLBOX_STMT_CONSTRAINT, &rows, &rowsz);
+	if (code != SQLBOX_CODE_CONSTRAINT)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: not constraint");
+	if (rowsz != 0)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: bad rows");
+
+	/* Multiple rows. */
+
+	code = sqlbox_exec_rows(p, id, 2, 0, NULL, 0, &rows, &rowsz);
+	if (code != SQLBOX_CODE_OK || rowsz != 2)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rows[0].ps[0].iparm != 1 || rows[1].ps[0].iparm != 2)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows: bad ids");
+
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Export statement "idx" in format "fmt" after stepping "skip" rows and
+ * compare the output to "want".
+ */
+static void
+check(struct sqlbox *p, size_t dbid, size_t idx, unsigned long flags,
+	size_t skip, enum sqlbox_fmt fmt, const char *want)
+{
+	char		 fname[MAXPATHLEN], buf[1024];
+	int		 fd;
+	ssize_t		 sz;
+	size_t		 stmtid, i;
+
+	strlcpy(fname, tmpnam(NULL), sizeof(fname));
+	if ((fd = open(fname, O_RDWR|O_CREAT|O_EXCL, 0600)) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	if (unlink(fname) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, idx, 0, NULL, flags)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	for (i = 0; i < skip; i++)
+		if (sqlbox_step(p, stmtid) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+	if (sqlbox_export(p, stmtid, fd, fmt) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_export");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(EXIT_FAILURE, "lseek");
+	if ((sz = read(fd, buf, sizeof(buf) - 1)) == -1)
+		err(EXIT_FAILURE, "read");
+	close(fd);
+	buf[sz] = '\0';
+
+	if (strcmp(buf, want))
+		errx(EXIT_FAILURE, "bad export: %s", buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(a INTEGER, b REAL, c TEXT, d BLOB)" },
+		{ .stmt = (char *)"INSERT INTO foo VALUES "
+			"(1, 0.5, 'plain', NULL),"
+			"(2, NULL, 'a, \"b\"', x'0aff'),"
+			"(3, -2.0, '', NULL)" },
+		{ .stmt = (char *)"SELECT * FROM foo ORDER BY a" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 1, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	check(p, dbid, 2, 0, 0, SQLBOX_FMT_CSV,
+		"1,0.5,plain,\r\n"
+		"2,,\"a, \"\"b\"\"\",\"\n\xff\"\r\n"
+		"3,-2,\"\",\r\n");
+	check(p, dbid, 2, 0, 0, SQLBOX_FMT_JSON,
+		"[1,0.5,\"plain\",null]\n"
+		"[2,null,\"a, \\\"b\\\"\",\"0aff\"]\n"
+		"[3,-2,\"\",null]\n");
+
+	/* Rows cached by multi-stepping are exported. */
+
+	check(p, dbid, 2, SQLBOX_STMT_MULTI, 1, SQLBOX_FMT_JSON,
+		"[2,null,\"a, \\\"b\\\"\",\"0aff\"]\n"
+		"[3,-2,\"\",null]\n");
+	check(p, dbid, 2, 0, 3, SQLBOX_FMT_CSV, "");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Return an unlinked temporary file holding "sz" bytes of "buf".
+ */
+static int
+tmpfd(const char *buf, size_t sz)
+{
+	char	 fname[MAXPATHLEN];
+	int	 fd;
+
+	strlcpy(fname, tmpnam(NULL), sizeof(fname));
+	if ((fd = open(fname, O_RDWR|O_CREAT|O_EXCL, 0600)) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	if (unlink(fname) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	if (write(fd, buf, sz) != (ssize_t)sz)
+		err(EXIT_FAILURE, "write");
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(EXIT_FAILURE, "lseek");
+	return fd;
+}
+
+/*
+ * Import "sz" bytes of "buf" in "fmt", expecting it to fail at row
+ * "bad" having committed "committed" rows.
+ */
+static void
+import_bad(struct sqlbox *p, size_t dbid, const char *buf, size_t sz,
+	enum sqlbox_fmt fmt, size_t committed, size_t bad)
+{
+	size_t	 nrows, conflict;
+	int	 fd;
+
+	fd = tmpfd(buf, sz);
+	if (sqlbox_import(p, dbid, 1, fd, fmt, 
+	    2, &nrows, &conflict) != SQLBOX_CODE_ERROR)
+		errx(EXIT_FAILURE, "sqlbox_import should fail");
+	close(fd);
+	if (nrows != committed)
+		errx(EXIT_FAILURE, "bad imported rows: %zu", nrows);
+	if (conflict != bad)
+		errx(EXIT_FAILURE, "bad failing row: %zu", conflict);
+}
+
+/*
+ * Make sure the table has "want" rows.
+ */
+static void
+check(struct sqlbox *p, size_t dbid, int64_t want)
+{
+	const struct sqlbox_parmset *rows;
+	size_t			 rowsz;
+
+	if (sqlbox_exec_rows(p, dbid, 2, 
+	    0, NULL, 0, &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].ps[0].iparm != want)
+		errx(EXIT_FAILURE, "bad row count");
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER, b TEXT)" },
+		{ .stmt = (char *)"INSERT INTO foo VALUES (?,?)" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	const char		*csv = 
+		"1,a\n"
+		"2,b\n"
+		"3,c\n"
+		"4,d,x\n"
+		"5,e\n";
+	char			 bin[sizeof(uint32_t) * 2];
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* 
+	 * The fourth row has too many columns: the first batch of two
+	 * stays, the third row is rolled back.
+	 */
+
+	import_bad(p, dbid, csv, strlen(csv), SQLBOX_FMT_CSV, 2, 4);
+	check(p, dbid, 2);
+
+	/* A bogus row length is refused without reading on. */
+
+	memset(bin, 0xff, sizeof(uint32_t));
+	memset(bin + sizeof(uint32_t), 0, sizeof(uint32_t));
+	import_bad(p, dbid, bin, sizeof(bin), SQLBOX_FMT_BINARY, 0, 1);
+
+	/* So is a truncated row (the length is little-endian). */
+
+	memset(bin, 0, sizeof(uint32_t));
+	bin[0] = 64;
+	import_bad(p, dbid, bin, sizeof(bin), SQLBOX_FMT_BINARY, 0, 1);
+
+	/* The database process is still serving. */
+
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	check(p, dbid, 2);
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
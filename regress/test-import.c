@@ -0,0 +1,163 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Return an unlinked temporary file.
+ */
+static int
+tmpfd(void)
+{
+	char	 fname[MAXPATHLEN];
+	int	 fd;
+
+	strlcpy(fname, tmpnam(NULL), sizeof(fname));
+	if ((fd = open(fname, O_RDWR|O_CREAT|O_EXCL, 0600)) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	if (unlink(fname) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	return fd;
+}
+
+/*
+ * Make sure statement "idx" returns the rows imported from the CSV.
+ */
+static void
+check(struct sqlbox *p, size_t dbid, size_t idx)
+{
+	const struct sqlbox_parmset *rows;
+	size_t			 rowsz;
+
+	if (sqlbox_exec_rows(p, dbid, idx, 
+	    0, NULL, 0, &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 4)
+		errx(EXIT_FAILURE, "bad row count");
+	if (rows[0].ps[0].iparm != 1 ||
+	    strcmp(rows[0].ps[1].sparm, "hello"))
+		errx(EXIT_FAILURE, "bad row 1");
+	if (rows[1].ps[0].iparm != 2 ||
+	    strcmp(rows[1].ps[1].sparm, "a, \"b\"\nc"))
+		errx(EXIT_FAILURE, "bad row 2");
+	if (rows[2].ps[0].iparm != 3 ||
+	    rows[2].ps[1].type != SQLBOX_PARM_NULL)
+		errx(EXIT_FAILURE, "bad row 3");
+	if (rows[3].ps[0].iparm != 4 ||
+	    strcmp(rows[3].ps[1].sparm, ""))
+		errx(EXIT_FAILURE, "bad row 4");
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid, nrows, conflict;
+	int			 fd;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(a INTEGER UNIQUE, b TEXT)" },
+		{ .stmt = (char *)"CREATE TABLE bar "
+			"(a INTEGER UNIQUE, b TEXT)" },
+		{ .stmt = (char *)"INSERT INTO foo VALUES (?,?)" },
+		{ .stmt = (char *)"INSERT INTO bar VALUES (?,?)" },
+		{ .stmt = (char *)"SELECT * FROM foo ORDER BY a" },
+		{ .stmt = (char *)"SELECT * FROM bar ORDER BY a" },
+	};
+	const char		*csv = 
+		"1,hello\r\n"
+		"2,\"a, \"\"b\"\"\nc\"\n"
+		"\n"
+		"1,duplicate\n"
+		"3,\n"
+		"4,\"\"";
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 1, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Import CSV in small batches, skipping the duplicate. */
+
+	fd = tmpfd();
+	if (write(fd, csv, strlen(csv)) != (ssize_t)strlen(csv))
+		err(EXIT_FAILURE, "write");
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(EXIT_FAILURE, "lseek");
+	if (sqlbox_import(p, dbid, 2, fd, SQLBOX_FMT_CSV, 
+	    2, &nrows, &conflict) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_import");
+	close(fd);
+	if (nrows != 4)
+		errx(EXIT_FAILURE, "bad imported rows: %zu", nrows);
+	if (conflict != 3)
+		errx(EXIT_FAILURE, "bad conflict: %zu", conflict);
+	check(p, dbid, 4);
+
+	/* Round-trip through the binary format. */
+
+	fd = tmpfd();
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 4, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (sqlbox_export(p, stmtid, fd, 
+	    SQLBOX_FMT_BINARY) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_export");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(EXIT_FAILURE, "lseek");
+	if (sqlbox_import(p, dbid, 3, fd, SQLBOX_FMT_BINARY, 
+	    0, &nrows, &conflict) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_import");
+	close(fd);
+	if (nrows != 4 || conflict != 0)
+		errx(EXIT_FAILURE, "bad binary import");
+	check(p, dbid, 5);
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
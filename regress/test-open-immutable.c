@@ -0,0 +1,114 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	char				 db[MAXPATHLEN];
+	struct sqlbox			*p;
+	struct sqlbox_cfg		 cfg;
+	struct sqlbox_src		 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC },
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_IMMUTABLE }
+	};
+	struct sqlbox_pstmt	 	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (42)" },
+		{ .stmt = (char *)"SELECT bar FROM foo" },
+		{ .stmt = (char *)"PRAGMA mmap_size" },
+	};
+	const struct sqlbox_parmset	*res;
+	size_t				 id, stmtid;
+
+	/* Make sure that the filename needs escaping. */
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+	strlcat(db, "%3F?#", sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.srcs.srcs = srcs;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+
+	/* Populate and close the database. */
+
+	if (!(id = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, id, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (sqlbox_exec(p, id, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	/* Now re-open it as immutable. */
+
+	if (!(id = sqlbox_open(p, 1)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	if (!(stmtid = sqlbox_prepare_bind(p, id, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1 || res->ps[0].type != SQLBOX_PARM_INT)
+		errx(EXIT_FAILURE, "sqlbox_step bad result");
+	if (res->ps[0].iparm != 42)
+		errx(EXIT_FAILURE, "sqlbox_step bad value");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	/* We should have a non-zero memory map by default. */
+
+	if (!(stmtid = sqlbox_prepare_bind(p, id, 3, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1 || res->ps[0].type != SQLBOX_PARM_INT)
+		errx(EXIT_FAILURE, "sqlbox_step bad result");
+	if (res->ps[0].iparm <= 0)
+		errx(EXIT_FAILURE, "sqlbox_step bad mmap_size");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	unlink(db);
+	return EXIT_SUCCESS;
+}
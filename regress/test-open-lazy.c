@@ -0,0 +1,94 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	char				 db[MAXPATHLEN];
+	struct sqlbox			*p;
+	struct sqlbox_cfg		 cfg;
+	struct sqlbox_src		 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RO,
+		  .flags = SQLBOX_SRC_LAZY },
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC,
+		  .flags = SQLBOX_SRC_LAZY }
+	};
+	struct sqlbox_pstmt	 	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+	};
+	size_t				 id;
+	int64_t				 lastid;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.srcs.srcs = srcs;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+
+	/* 
+	 * The file doesn't exist, but this is fine as we never use the
+	 * database.
+	 */
+
+	if (!(id = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_lastid(p, id, &lastid))
+		errx(EXIT_FAILURE, "sqlbox_lastid");
+	if (lastid != 0)
+		errx(EXIT_FAILURE, "sqlbox_lastid: bad value");
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	/* This creates the file only when first used. */
+
+	if (!(id = sqlbox_open(p, 1)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (access(db, F_OK) != -1)
+		errx(EXIT_FAILURE, "lazy database opened early");
+	if (sqlbox_exec(p, id, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (access(db, F_OK) == -1)
+		errx(EXIT_FAILURE, "lazy database not opened");
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	unlink(db);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox			*p;
+	struct sqlbox_cfg		 cfg;
+	struct sqlbox_src		 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC,
+		  .flags = SQLBOX_SRC_SHARED }
+	};
+	struct sqlbox_pstmt	 	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT sum(bar) FROM foo" },
+	};
+	struct sqlbox_parm		 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+	const struct sqlbox_parmset	*res;
+	size_t				 i, id1, id2, stmtid;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.srcs.srcs = srcs;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+
+	/* 
+	 * Both in-memory databases are the same connection, so they
+	 * see each other's tables.
+	 */
+
+	if (!(id1 = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!(id2 = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, id1, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Insert repeatedly to exercise the statement cache. */
+
+	for (i = 1; i <= 3; i++) {
+		parm.iparm = i;
+		if (sqlbox_exec(p, i % 2 ? id1 : id2, 
+		    1, 1, &parm, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (!(stmtid = sqlbox_prepare_bind
+		    (p, i ? id1 : id2, 2, 0, NULL, 0)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+		if ((res = sqlbox_step(p, stmtid)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 1 || 
+		    res->ps[0].type != SQLBOX_PARM_INT)
+			errx(EXIT_FAILURE, "sqlbox_step bad result");
+		if (res->ps[0].iparm != 6)
+			errx(EXIT_FAILURE, "sqlbox_step bad value");
+		if (!sqlbox_finalise(p, stmtid))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+	}
+
+	/* Closing one leaves the other's connection intact. */
+
+	if (!sqlbox_close(p, id1))
+		errx(EXIT_FAILURE, "sqlbox_close");
+	if (!(stmtid = sqlbox_prepare_bind(p, id2, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1 || res->ps[0].iparm != 6)
+		errx(EXIT_FAILURE, "sqlbox_step bad value");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	if (!sqlbox_close(p, id2))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox			*p;
+	struct sqlbox_cfg		 cfg;
+	struct sqlbox_src		 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC,
+		  .flags = SQLBOX_SRC_WARM }
+	};
+	struct sqlbox_pstmt	 	 pstmts[] = {
+		{ .stmt = (char *)"SELECT ? + 1" },
+		{ .stmt = (char *)"SELECT * FROM nonexistent" },
+		{ .stmt = (char *)"SELECT 2" },
+	};
+	size_t				 role0[] = { 0, 1 };
+	struct sqlbox_role		 roles[] = {
+		{ .stmts = role0,
+		  .stmtsz = nitems(role0),
+		  .srcs = role0,
+		  .srcsz = 1 }
+	};
+	struct sqlbox_parm		 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+	const struct sqlbox_parmset	*res;
+	size_t				 i, id, stmtid;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.srcs.srcs = srcs;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.roles.roles = roles;
+	cfg.roles.rolesz = nitems(roles);
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+
+	/* 
+	 * The second statement can't be prepared, which is reported but
+	 * doesn't stop us from opening.
+	 */
+
+	if (!(id = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* Use the warmed statement a few times. */
+
+	for (i = 0; i < 3; i++) {
+		parm.iparm = i;
+		if (!(stmtid = sqlbox_prepare_bind
+		    (p, id, 0, 1, &parm, 0)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+		if ((res = sqlbox_step(p, stmtid)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 1 || 
+		    res->ps[0].type != SQLBOX_PARM_INT)
+			errx(EXIT_FAILURE, "sqlbox_step bad result");
+		if (res->ps[0].iparm != (int64_t)i + 1)
+			errx(EXIT_FAILURE, "sqlbox_step bad value");
+		if (!sqlbox_finalise(p, stmtid))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+	}
+
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid, i;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INT)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT count(*), sum(bar) FROM foo "
+			"WHERE bar IN sqlbox_array(?)" },
+	};
+	struct sqlbox_parm	 parm;
+	const struct sqlbox_parmset *res;
+	int64_t			 vals[1000];
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, dbid, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+	for (i = 1; i <= 100; i++) {
+		parm.iparm = i;
+		if (sqlbox_exec(p, dbid, 1, 1, &parm, 0) != 
+		    SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	/* A short list with one value missing. */
+
+	vals[0] = 3;
+	vals[1] = 5;
+	vals[2] = 500;
+	vals[3] = 7;
+	parm.type = SQLBOX_PARM_INT_ARRAY;
+	parm.iaparm = vals;
+	parm.sz = 4;
+
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 2, 1, &parm, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 2 || 
+	    res->ps[0].iparm != 3 || res->ps[1].iparm != 15)
+		errx(EXIT_FAILURE, "bad result");
+
+	/* Rebind with a list larger than a frame. */
+
+	for (i = 0; i < nitems(vals); i++)
+		vals[i] = i + 1;
+	parm.sz = nitems(vals);
+	if ((res = sqlbox_rebind_step(p, stmtid, 1, &parm)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_rebind_step");
+	if (res->psz != 2 || 
+	    res->ps[0].iparm != 100 || res->ps[1].iparm != 5050)
+		errx(EXIT_FAILURE, "bad result");
+
+	/* And an empty list. */
+
+	parm.sz = 0;
+	if ((res = sqlbox_rebind_step(p, stmtid, 1, &parm)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_rebind_step");
+	if (res->psz != 2 || res->ps[0].iparm != 0)
+		errx(EXIT_FAILURE, "bad result");
+
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, i, rowsz;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar TEXT)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT bar FROM foo "
+			"WHERE bar IN sqlbox_array(?) ORDER BY bar" },
+		{ .stmt = (char *)"SELECT value FROM sqlbox_array(?)" },
+	};
+	const char		*names[] = { "aa", "b", "", "dddd", "c" };
+	const char		*find[] = { "dddd", "x", "", "aa" };
+	const char		*expect[] = { "", "aa", "dddd" };
+	struct sqlbox_parm	 parm;
+	const struct sqlbox_parmset *rows;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, dbid, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_STRING;
+	for (i = 0; i < nitems(names); i++) {
+		parm.sparm = names[i];
+		if (sqlbox_exec(p, dbid, 1, 1, &parm, 0) != 
+		    SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	/* Look up a list, including an empty string. */
+
+	parm.type = SQLBOX_PARM_STRING_ARRAY;
+	parm.saparm = find;
+	parm.sz = nitems(find);
+
+	if (sqlbox_exec_rows(p, dbid, 2, 1, &parm, 0, 
+	    &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != nitems(expect))
+		errx(EXIT_FAILURE, "bad row count: %zu", rowsz);
+	for (i = 0; i < rowsz; i++)
+		if (rows[i].psz != 1 ||
+		    rows[i].ps[0].type != SQLBOX_PARM_STRING ||
+		    strcmp(rows[i].ps[0].sparm, expect[i]))
+			errx(EXIT_FAILURE, "bad row %zu", i);
+
+	/* The array as a table, in order. */
+
+	parm.saparm = names;
+	parm.sz = nitems(names);
+
+	if (sqlbox_exec_rows(p, dbid, 3, 1, &parm, 0, 
+	    &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != nitems(names))
+		errx(EXIT_FAILURE, "bad row count: %zu", rowsz);
+	for (i = 0; i < rowsz; i++)
+		if (rows[i].psz != 1 ||
+		    strcmp(rows[i].ps[0].sparm, names[i]))
+			errx(EXIT_FAILURE, "bad row %zu", i);
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
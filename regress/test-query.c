@@ -0,0 +1,138 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox			*p;
+	struct sqlbox_cfg		 cfg;
+	struct sqlbox_src		 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT bar FROM foo WHERE bar = ?" },
+		{ .stmt = (char *)"SELECT bar FROM foo ORDER BY bar" },
+	};
+	struct sqlbox_parm		 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+	const struct sqlbox_parmset	*res;
+	size_t				 i, j, id, stmtid;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.srcs.srcs = srcs;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.msg.func_short = warnx;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(id = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, id, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	for (i = 1; i <= 10; i++) {
+		parm.iparm = i;
+		if (sqlbox_exec(p, id, 1, 1, &parm, 0) != 
+		    SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	/* One-shot lookups, found and not found. */
+
+	parm.iparm = 5;
+	res = sqlbox_query(p, id, 2, 1, &parm, 
+		SQLBOX_STMT_ONESHOT, &stmtid);
+	if (res == NULL)
+		errx(EXIT_FAILURE, "sqlbox_query");
+	if (stmtid != 0)
+		errx(EXIT_FAILURE, "sqlbox_query: one-shot has id");
+	if (res->psz != 1 || res->ps[0].iparm != 5)
+		errx(EXIT_FAILURE, "sqlbox_query: bad result");
+
+	parm.iparm = 11;
+	res = sqlbox_query(p, id, 2, 1, &parm, 
+		SQLBOX_STMT_ONESHOT, &stmtid);
+	if (res == NULL)
+		errx(EXIT_FAILURE, "sqlbox_query");
+	if (res->psz != 0)
+		errx(EXIT_FAILURE, "sqlbox_query: bad result");
+
+	/* Continued with stepping. */
+
+	res = sqlbox_query(p, id, 3, 0, NULL, 
+		SQLBOX_STMT_MULTI, &stmtid);
+	if (res == NULL)
+		errx(EXIT_FAILURE, "sqlbox_query");
+	if (stmtid == 0)
+		errx(EXIT_FAILURE, "sqlbox_query: no id");
+	for (i = 1; i <= 10; i++) {
+		if (res->psz != 1 || res->ps[0].iparm != (int64_t)i)
+			errx(EXIT_FAILURE, "sqlbox_query: bad result");
+		if ((res = sqlbox_step(p, stmtid)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+	}
+	if (res->psz != 0)
+		errx(EXIT_FAILURE, "sqlbox_step: bad result");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	/* One-shot with more than one row stays open. */
+
+	for (j = 0; j < 2; j++) {
+		res = sqlbox_query(p, id, 3, 0, NULL, SQLBOX_STMT_ONESHOT |
+			(j ? SQLBOX_STMT_MULTI : 0), &stmtid);
+		if (res == NULL)
+			errx(EXIT_FAILURE, "sqlbox_query");
+		if (stmtid == 0)
+			errx(EXIT_FAILURE, "sqlbox_query: one-shot "
+				"with more rows has no id");
+		for (i = 1; i <= 10; i++) {
+			if (res->psz != 1 || 
+			    res->ps[0].iparm != (int64_t)i)
+				errx(EXIT_FAILURE, "sqlbox_query: "
+					"bad result");
+			if ((res = sqlbox_step(p, stmtid)) == NULL)
+				errx(EXIT_FAILURE, "sqlbox_step");
+		}
+		if (res->psz != 0)
+			errx(EXIT_FAILURE, "sqlbox_step: bad result");
+		if (!sqlbox_finalise(p, stmtid))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+	}
+
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Run the counting statement for several limits at once, making sure
+ * all rows come back even though they span many batches.
+ */
+static void
+run(size_t memfd)
+{
+	size_t		 	 dbid, stmtid, rowsz, i, j, n;
+	char			 want[128];
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS "
+			"(SELECT 1 UNION ALL SELECT x + 1 FROM c "
+			"WHERE x < ?) SELECT printf('%0100d', x) "
+			"FROM c WHERE ? > 0" }
+	};
+	int64_t			 lims[] = { 2000, 0, 1, 3000 };
+	struct sqlbox_parm	 parms[nitems(lims) * 2];
+	struct sqlbox_parmset	 sets[nitems(lims)];
+	const struct sqlbox_parmset *rows;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.comm.memfd = memfd;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	memset(parms, 0, sizeof(parms));
+	memset(sets, 0, sizeof(sets));
+	for (i = 0; i < nitems(lims); i++) {
+		parms[i * 2].type = SQLBOX_PARM_INT;
+		parms[i * 2].iparm = lims[i];
+		parms[i * 2 + 1].type = SQLBOX_PARM_INT;
+		parms[i * 2 + 1].iparm = lims[i];
+		sets[i].ps = &parms[i * 2];
+		sets[i].psz = 2;
+	}
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 0, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (!sqlbox_rebind_many(p, stmtid, 
+	    nitems(sets), sets, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_rebind_many");
+
+	for (i = j = 0; i < nitems(lims); i++) {
+		for (n = 1; n <= (size_t)lims[i]; n++, j++) {
+			snprintf(want, sizeof(want), "%0100zu", n);
+			if (j >= rowsz || rows[j].psz != 1 ||
+			    rows[j].ps[0].type != SQLBOX_PARM_STRING ||
+			    strcmp(rows[j].ps[0].sparm, want))
+				errx(EXIT_FAILURE, "bad row %zu", j);
+		}
+		if (j >= rowsz || rows[j++].psz != 0)
+			errx(EXIT_FAILURE, "set %zu not terminated", i);
+	}
+	if (j != rowsz)
+		errx(EXIT_FAILURE, "bad row count: %zu", rowsz);
+
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	sqlbox_free(p);
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	run(0);
+	run(4096);
+	return EXIT_SUCCESS;
+}
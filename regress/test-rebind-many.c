@@ -0,0 +1,138 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid, rowsz, i;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(bar INT, baz TEXT)" },
+		{ .stmt = (char *)"INSERT INTO foo "
+			"(bar, baz) VALUES (?,?)" },
+		{ .stmt = (char *)"SELECT baz FROM foo "
+			"WHERE bar = ? ORDER BY baz" }
+	};
+	struct sqlbox_parm	 ins[] = {
+		{ .type = SQLBOX_PARM_INT, .iparm = 1 },
+		{ .type = SQLBOX_PARM_STRING, .sparm = "a" },
+		{ .type = SQLBOX_PARM_INT, .iparm = 2 },
+		{ .type = SQLBOX_PARM_STRING, .sparm = "b" },
+		{ .type = SQLBOX_PARM_INT, .iparm = 2 },
+		{ .type = SQLBOX_PARM_STRING, .sparm = "c" },
+	};
+	struct sqlbox_parm	 sel[] = {
+		{ .type = SQLBOX_PARM_INT, .iparm = 2 },
+		{ .type = SQLBOX_PARM_INT, .iparm = 3 },
+		{ .type = SQLBOX_PARM_INT, .iparm = 1 },
+	};
+	struct sqlbox_parmset	 sets[3];
+	const struct sqlbox_parmset *rows;
+	const char		*expect[] = { "b", "c", NULL, NULL, "a", NULL };
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, dbid, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Insert all rows at once: only terminating rows. */
+
+	memset(sets, 0, sizeof(sets));
+	for (i = 0; i < 3; i++) {
+		sets[i].ps = &ins[i * 2];
+		sets[i].psz = 2;
+	}
+
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 1, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (!sqlbox_rebind_many(p, stmtid, 3, sets, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_rebind_many");
+	if (rowsz != 3)
+		errx(EXIT_FAILURE, "sqlbox_rebind_many: bad rows");
+	for (i = 0; i < rowsz; i++)
+		if (rows[i].psz != 0 || rows[i].code != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_rebind_many: "
+				"bad row %zu", i);
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	/* Look up several keys, one missing, at once. */
+
+	for (i = 0; i < 3; i++) {
+		sets[i].ps = &sel[i];
+		sets[i].psz = 1;
+	}
+
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (!sqlbox_rebind_many(p, stmtid, 3, sets, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_rebind_many");
+	if (rowsz != nitems(expect))
+		errx(EXIT_FAILURE, "sqlbox_rebind_many: bad rows");
+	for (i = 0; i < rowsz; i++) {
+		if (expect[i] == NULL) {
+			if (rows[i].psz != 0)
+				errx(EXIT_FAILURE, "sqlbox_rebind_many: "
+					"row %zu not terminating", i);
+			continue;
+		}
+		if (rows[i].psz != 1 ||
+		    rows[i].ps[0].type != SQLBOX_PARM_STRING ||
+		    strcmp(rows[i].ps[0].sparm, expect[i]))
+			errx(EXIT_FAILURE, "sqlbox_rebind_many: "
+				"bad row %zu", i);
+	}
+
+	/* Again with no sets. */
+
+	if (!sqlbox_rebind_many(p, stmtid, 0, NULL, &rows, &rowsz))
+		errx(EXIT_FAILURE, "sqlbox_rebind_many");
+	if (rowsz != 0)
+		errx(EXIT_FAILURE, "sqlbox_rebind_many: bad rows");
+
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
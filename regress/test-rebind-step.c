@@ -0,0 +1,119 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INT)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT bar FROM foo WHERE bar >= ? "
+			"ORDER BY bar" }
+	};
+	struct sqlbox_parm	 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+	const struct sqlbox_parmset *res;
+	int64_t			 i;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, dbid, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Insert rows by rebinding. */
+
+	parm.iparm = 1;
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 1, 1, &parm, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	for (i = 2; i <= 5; i++) {
+		parm.iparm = i;
+		if ((res = sqlbox_rebind_step(p, stmtid, 1, &parm)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_rebind_step");
+		if (res->psz != 0)
+			errx(EXIT_FAILURE, "res->psz != 0");
+	}
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	/* Repeated lookups, stepping the remainder. */
+
+	parm.iparm = 1;
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 2, 1, &parm, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	for (i = 5; i >= 1; i--) {
+		parm.iparm = i;
+		if ((res = sqlbox_rebind_step(p, stmtid, 1, &parm)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_rebind_step");
+		if (res->psz != 1)
+			errx(EXIT_FAILURE, "res->psz != 1");
+		if (res->ps[0].iparm != i)
+			errx(EXIT_FAILURE, "res->ps[0].iparm != %" 
+				PRId64, i);
+		if ((res = sqlbox_step(p, stmtid)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (i == 5 && res->psz != 0)
+			errx(EXIT_FAILURE, "res->psz != 0");
+		if (i < 5 && res->ps[0].iparm != i + 1)
+			errx(EXIT_FAILURE, "res->ps[0].iparm != %" 
+				PRId64, i + 1);
+	}
+
+	/* Past the end. */
+
+	parm.iparm = 6;
+	if ((res = sqlbox_rebind_step(p, stmtid, 1, &parm)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_rebind_step");
+	if (res->psz != 0)
+		errx(EXIT_FAILURE, "res->psz != 0");
+
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, rowsz;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (x INT)" },
+		{ .stmt = (char *)"INSERT INTO foo (x) VALUES (1)" },
+		{ .stmt = (char *)"INSERT INTO foo (x) "
+			"WITH RECURSIVE c(x) AS "
+			"(SELECT 1 UNION ALL SELECT x + 1 FROM c "
+			"LIMIT 1000000) SELECT x FROM c",
+		  .budget_ops = 5000 },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	struct sqlbox_progstep	 steps[] = {
+		{ .stmt = 1 },
+		{ .stmt = 2 },
+	};
+	struct sqlbox_prog	 progs[] = {
+		{ .steps = steps, .stepsz = nitems(steps) },
+		{ .steps = steps, .stepsz = 1 },
+	};
+	const struct sqlbox_parmset *rows;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.progs.progsz = nitems(progs);
+	cfg.progs.progs = progs;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, dbid, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/*
+	 * The second step runs out of budget, which makes SQLite roll
+	 * back the savepoint along with the first step's row.
+	 * The server must report this and keep running.
+	 */
+
+	if (sqlbox_run_program(p, dbid, 0, 0, NULL, 0) !=
+	    SQLBOX_CODE_BUDGET)
+		errx(EXIT_FAILURE, "sqlbox_run_program");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	if (sqlbox_exec_rows(p, dbid, 3, 0, NULL, 0,
+	    &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].ps[0].iparm != 0)
+		errx(EXIT_FAILURE, "bad count");
+
+	/* Programs still run afterward. */
+
+	if (sqlbox_run_program(p, dbid, 1, 0, NULL, 0) !=
+	    SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_run_program");
+
+	if (sqlbox_exec_rows(p, dbid, 3, 0, NULL, 0,
+	    &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].ps[0].iparm != 1)
+		errx(EXIT_FAILURE, "bad count");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, rowsz;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE parent "
+			"(id INTEGER PRIMARY KEY, name TEXT UNIQUE, "
+			"kids INT DEFAULT 0)" },
+		{ .stmt = (char *)"CREATE TABLE child "
+			"(parent INT REFERENCES parent(id), name TEXT)" },
+		{ .stmt = (char *)"INSERT INTO parent (name) VALUES (?)" },
+		{ .stmt = (char *)"INSERT INTO child "
+			"(parent, name) VALUES (?,?)" },
+		{ .stmt = (char *)"UPDATE parent SET kids = "
+			"(SELECT count(*) FROM child WHERE parent = ?) "
+			"WHERE id = ?" },
+		{ .stmt = (char *)"SELECT name, kids FROM parent" },
+		{ .stmt = (char *)"SELECT count(*) FROM child" },
+	};
+	struct sqlbox_progparm	 pparms[] = {
+		{ .type = SQLBOX_PROGP_INPUT, .idx = 0 },
+	};
+	struct sqlbox_progparm	 c1parms[] = {
+		{ .type = SQLBOX_PROGP_LASTID, .idx = 0 },
+		{ .type = SQLBOX_PROGP_INPUT, .idx = 1 },
+	};
+	struct sqlbox_progparm	 c2parms[] = {
+		{ .type = SQLBOX_PROGP_LASTID, .idx = 0 },
+		{ .type = SQLBOX_PROGP_INPUT, .idx = 2 },
+	};
+	struct sqlbox_progparm	 uparms[] = {
+		{ .type = SQLBOX_PROGP_LASTID, .idx = 0 },
+		{ .type = SQLBOX_PROGP_LASTID, .idx = 0 },
+	};
+	struct sqlbox_progstep	 steps[] = {
+		{ .stmt = 2, .parms = pparms, .parmsz = nitems(pparms) },
+		{ .stmt = 3, .parms = c1parms, .parmsz = nitems(c1parms) },
+		{ .stmt = 3, .parms = c2parms, .parmsz = nitems(c2parms) },
+		{ .stmt = 4, .parms = uparms, .parmsz = nitems(uparms) },
+	};
+	struct sqlbox_prog	 progs[] = {
+		{ .steps = steps, .stepsz = nitems(steps) },
+	};
+	struct sqlbox_parm	 in[] = {
+		{ .type = SQLBOX_PARM_STRING, .sparm = "mom" },
+		{ .type = SQLBOX_PARM_STRING, .sparm = "kid1" },
+		{ .type = SQLBOX_PARM_STRING, .sparm = "kid2" },
+	};
+	const struct sqlbox_parmset *rows;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.progs.progsz = nitems(progs);
+	cfg.progs.progs = progs;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, dbid, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (sqlbox_exec(p, dbid, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Run the whole program at once. */
+
+	if (sqlbox_run_program(p, dbid, 0, 
+	    nitems(in), in, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_run_program");
+
+	if (sqlbox_exec_rows(p, dbid, 5, 0, NULL, 0, 
+	    &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || strcmp(rows[0].ps[0].sparm, "mom") ||
+	    rows[0].ps[1].iparm != 2)
+		errx(EXIT_FAILURE, "bad parent");
+
+	/* 
+	 * Running again violates the unique parent name in the first
+	 * step, so nothing should be changed.
+	 */
+
+	in[1].sparm = "kid3";
+	if (sqlbox_run_program(p, dbid, 0, nitems(in), in, 
+	    SQLBOX_STMT_CONSTRAINT) != SQLBOX_CODE_CONSTRAINT)
+		errx(EXIT_FAILURE, "sqlbox_run_program");
+
+	if (sqlbox_exec_rows(p, dbid, 6, 0, NULL, 0, 
+	    &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].ps[0].iparm != 2)
+		errx(EXIT_FAILURE, "bad children");
+
+	/* A new parent is fine. */
+
+	in[0].sparm = "dad";
+	if (sqlbox_run_program(p, dbid, 0, 
+	    nitems(in), in, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_run_program");
+
+	if (sqlbox_exec_rows(p, dbid, 6, 0, NULL, 0, 
+	    &rows, &rowsz) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_rows");
+	if (rowsz != 1 || rows[0].ps[0].iparm != 4)
+		errx(EXIT_FAILURE, "bad children");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/param.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	char			 db[MAXPATHLEN];
+	size_t		 	 dbid1, dbid2, stmtid;
+	struct sqlbox		*p1, *p2;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_stats	 st;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+	};
+	const struct sqlbox_parmset *res;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p1 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if ((p2 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid1 = sqlbox_open(p1, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p1, dbid1, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!(dbid2 = sqlbox_open(p2, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	if (!(stmtid = sqlbox_prepare_bind(p2, dbid2, 1, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (!sqlbox_trans_deferred(p2, dbid2, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_deferred");
+	if (!sqlbox_trans_exclusive(p1, dbid1, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_exclusive");
+	if (!sqlbox_ping(p1))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	/* 
+	 * Within a transaction, we're told immediately that we're busy
+	 * (without retrying) instead of waiting forever.
+	 */
+
+	if ((res = sqlbox_step(p2, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->code != SQLBOX_CODE_BUSY)
+		errx(EXIT_FAILURE, "sqlbox_step: expected busy");
+	if (!sqlbox_finalise(p2, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	if (!sqlbox_trans_rollback(p2, dbid2, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_rollback");
+	if (!sqlbox_stats(p2, &st))
+		errx(EXIT_FAILURE, "sqlbox_stats");
+	if (st.retries != 0 || st.giveups != 1)
+		errx(EXIT_FAILURE, "bad counters");
+
+	if (!sqlbox_trans_commit(p1, dbid1, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_commit");
+
+	sqlbox_free(p1);
+	sqlbox_free(p2);
+	unlink(db);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	BLOBSZ	(10 * 1024)
+#define	ROWS	64
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid, i, j;
+	char			 blob[BLOBSZ];
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(a INTEGER, b BLOB)" },
+		{ .stmt = (char *)"INSERT INTO foo (a, b) VALUES (?, ?)" },
+		{ .stmt = (char *)"SELECT a, b FROM foo ORDER BY a" },
+		{ .stmt = (char *)"SELECT a FROM foo ORDER BY a" },
+	};
+	struct sqlbox_parm	 parms[] = {
+		{ .type = SQLBOX_PARM_INT },
+		{ .bparm = blob,
+		  .sz = BLOBSZ,
+		  .type = SQLBOX_PARM_BLOB },
+	};
+	const struct sqlbox_parmset *res;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.comm.memfd = 4096;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (SQLBOX_CODE_OK != sqlbox_exec(p, dbid, 0, 0, NULL, 0)) 
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	for (i = 0; i < ROWS; i++) {
+		memset(blob, (int)i, BLOBSZ);
+		parms[0].iparm = i;
+		if (!sqlbox_exec_async
+		    (p, dbid, 1, nitems(parms), parms, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_async");
+	}
+
+	/* Large batches are mapped, small ones read as usual. */
+
+	for (j = 2; j < 4; j++) {
+		if (!(stmtid = sqlbox_prepare_bind
+		    (p, dbid, j, 0, NULL, SQLBOX_STMT_MULTI)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+		for (i = 0; i < ROWS; i++) {
+			if ((res = sqlbox_step(p, stmtid)) == NULL)
+				errx(EXIT_FAILURE, "sqlbox_step");
+			if (res->psz != 4 - j)
+				errx(EXIT_FAILURE, "bad column count");
+			if (res->ps[0].type != SQLBOX_PARM_INT ||
+			    res->ps[0].iparm != (int64_t)i)
+				errx(EXIT_FAILURE, "bad integer");
+			if (j == 3)
+				continue;
+			memset(blob, (int)i, BLOBSZ);
+			if (res->ps[1].type != SQLBOX_PARM_BLOB ||
+			    res->ps[1].sz != BLOBSZ ||
+			    memcmp(res->ps[1].bparm, blob, BLOBSZ))
+				errx(EXIT_FAILURE, "bad blob");
+		}
+		if ((res = sqlbox_step(p, stmtid)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 0)
+			errx(EXIT_FAILURE, "res->psz != 0");
+		if (!sqlbox_finalise(p, stmtid))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+	}
+
+	if (!sqlbox_close(p, dbid))
+		errx(EXIT_FAILURE, "sqlbox_close");
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
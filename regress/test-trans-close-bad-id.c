@@ -46,8 +46,8 @@ main(int argc, char *argv[])
 		errx(EXIT_FAILURE, "sqlbox_alloc");
 	if (!(srcid = sqlbox_open(p, 0)))
 		errx(EXIT_FAILURE, "sqlbox_open");
-	if (!sqlbox_trans_commit(p, srcid, tid))
-		errx(EXIT_FAILURE, "sqlbox_trans_commit");
+	if (sqlbox_trans_commit(p, srcid, tid))
+		errx(EXIT_FAILURE, "sqlbox_trans_commit should fail");
 	if (sqlbox_ping(p))
 		errx(EXIT_FAILURE, "sqlbox_ping should fail");
 
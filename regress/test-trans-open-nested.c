@@ -53,8 +53,8 @@ main(int argc, char *argv[])
 
 	/* Nested transaction! */
 
-	if (!sqlbox_trans_deferred(p, srcid, tid + 1))
-		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_trans_deferred(p, srcid, tid + 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_deferred should fail");
 	if (sqlbox_ping(p))
 		errx(EXIT_FAILURE, "sqlbox_ping should fail");
 
@@ -60,7 +60,10 @@ sqlbox_role(struct sqlbox *box, size_t role)
 {
 	uint32_t	 v = htole32(role);
 
-	if (!sqlbox_write_frame
+	if (!sqlbox_credit(box, 1)) {
+		sqlbox_warnx(&box->cfg, "role: sqlbox_credit");
+		return 0;
+	} else if (!sqlbox_write_frame
 	    (box, SQLBOX_OP_ROLE, (char *)&v, sizeof(uint32_t))) {
 		sqlbox_warnx(&box->cfg, "role: sqlbox_write_frame");
 		return 0;
@@ -83,6 +83,10 @@ struct	sqlbox_role {
 	size_t	 stmtsz; /* length of stmts */
 	size_t	*srcs; /* databases we can open/close */
 	size_t	 srcsz; /* length of srcs */
+	size_t	*blobs; /* blob columns we can read */
+	size_t	 blobsz; /* length of blobs */
+	size_t	*wblobs; /* blob columns we can read/write */
+	size_t	 wblobsz; /* length of wblobs */
 };
 
 struct	sqlbox_roles {
@@ -97,6 +101,8 @@ enum	sqlbox_parmt {
 	SQLBOX_PARM_INT = 2,
 	SQLBOX_PARM_NULL = 3,
 	SQLBOX_PARM_STRING = 4,
+	SQLBOX_PARM_INT_ARRAY = 5,
+	SQLBOX_PARM_STRING_ARRAY = 6,
 };
 
 /*
@@ -106,6 +112,10 @@ enum	sqlbox_parmt {
  */
 struct	sqlbox_pstmt {
 	char			*stmt; /* prepared statement */
+	size_t			 budget_ops; /* max. VM steps or 0 */
+	size_t			 budget_ms; /* max. milliseconds or 0 */
+	size_t			 chunk_ms; /* pause between chunks or 0 */
+	size_t			 chunk_max; /* max. chunks or 0 */
 };
 
 /*
@@ -116,6 +126,59 @@ struct	sqlbox_pstmts {
 	size_t		 	 stmtsz; /* no. statements or 0 */
 };
 
+/*
+ * A column of large objects that may be read and written incrementally
+ * with sqlbox_blob_open.
+ */
+struct	sqlbox_pblob {
+	char			*table; /* table name */
+	char			*column; /* column name */
+};
+
+/*
+ * Set of all blob columns.
+ */
+struct	sqlbox_pblobs {
+	struct sqlbox_pblob	*blobs; /* all blob columns or NULL */
+	size_t			 blobsz; /* no. blob columns or 0 */
+};
+
+/*
+ * How to retry operations on a busy or locked database source.
+ * All zero values are the defaults, which retry forever.
+ */
+struct	sqlbox_retry {
+	size_t		 busy_timeout; /* sqlite3_busy_timeout(3) or 0 */
+	size_t		 base; /* min. backoff (ms) or 0 */
+	size_t		 cap; /* max. backoff (ms) or 0 */
+	size_t		 maxwait; /* max. total backoff (ms) or 0 */
+};
+
+/*
+ * Tuning of a database source, applied as PRAGMAs when opened.
+ * Strings are case-insensitive values for the PRAGMA of the same name.
+ * All zero values (or NULL) leave the SQLite defaults.
+ */
+struct	sqlbox_tune {
+	const char	*journal_mode; /* e.g., "WAL", or NULL */
+	const char	*synchronous; /* e.g., "NORMAL", or NULL */
+	const char	*temp_store; /* e.g., "MEMORY", or NULL */
+	int64_t		 cache_size; /* pages or -KiB, or 0 */
+	int64_t		 mmap_size; /* bytes or 0 */
+	int64_t		 wal_autocheckpoint; /* pages, <0 off, or 0 */
+};
+
+/*
+ * Limits of batching asynchronous writes to a database source into one
+ * transaction, committed once any is reached.
+ * Zero row and byte limits don't limit; a zero time uses a default.
+ */
+struct	sqlbox_batch {
+	size_t		 maxrows; /* rows changed or 0 */
+	size_t		 maxbytes; /* bytes written or 0 */
+	size_t		 maxms; /* milliseconds open or 0 */
+};
+
 /*
  * A database source.
  */
@@ -124,7 +187,18 @@ struct	sqlbox_src {
 #define	SQLBOX_SRC_RO	 0 /* open read-only */
 #define	SQLBOX_SRC_RW	 1 /* open read-write */
 #define	SQLBOX_SRC_RWC	 2 /* read-write-create */
+#define	SQLBOX_SRC_IMMUTABLE 3 /* read-only, never changes */
 	int		 mode; /* open mode */
+#define	SQLBOX_SRC_PRELOAD 0x01 /* load into memory on open */
+#define	SQLBOX_SRC_SAVE	 0x02 /* write preloaded back on close */
+#define	SQLBOX_SRC_LAZY	 0x04 /* defer open until first use */
+#define	SQLBOX_SRC_SHARED 0x08 /* share connection between opens */
+#define	SQLBOX_SRC_WARM	 0x10 /* prepare role's statements on open */
+#define	SQLBOX_SRC_BATCH 0x20 /* group commit asynchronous writes */
+	unsigned int	 flags; /* open flags */
+	struct sqlbox_retry retry; /* busy/locked retry policy */
+	struct sqlbox_tune tune; /* tuning pragmas */
+	struct sqlbox_batch batch; /* write batching limits */
 };
 
 /*
@@ -156,6 +230,8 @@ struct	sqlbox_msg {
  * *must include* the NUL terminating character.
  * Binary data must have the size set.
  * Floats and integers ignore the size.
+ * Arrays, which may only be bound, have the size set to the number of
+ * elements and are read with the sqlbox_array table-valued function.
  */
 struct	sqlbox_parm {
 	union {
@@ -163,6 +239,8 @@ struct	sqlbox_parm {
 		int64_t		 iparm; /* integers */
 		const char	*sparm; /* NUL-terminated UTF-8 */
 		const void	*bparm; /* binary data */
+		const int64_t	*iaparm; /* integer array */
+		const char *const *saparm; /* string array */
 	};
 	enum sqlbox_parmt	 type;
 	size_t			 sz; /* data length (bytes) */
@@ -195,6 +273,64 @@ struct	sqlbox_filts {
 	size_t		 	 filtsz;
 };
 
+/*
+ * Tuning of the communication channel between the client and the
+ * database process.
+ * All zero values are the defaults.
+ */
+struct	sqlbox_comm {
+	size_t		 window; /* max. unacknowledged frames or 0 */
+	size_t		 memfd; /* min. blob size to pass by memfd or 0 */
+	size_t		 sndbuf; /* socket send buffer size or 0 */
+	size_t		 rcvbuf; /* socket receive buffer size or 0 */
+	int		 seqpacket; /* use SOCK_SEQPACKET if available */
+};
+
+/*
+ * Where a statement program step gets a parameter.
+ */
+enum	sqlbox_progpt {
+	SQLBOX_PROGP_INPUT = 0, /* program input "idx" */
+	SQLBOX_PROGP_LASTID = 1, /* last insert rowid after step "idx" */
+};
+
+/*
+ * A parameter bound to a statement program step.
+ */
+struct	sqlbox_progparm {
+	enum sqlbox_progpt	 type; /* parameter source */
+	size_t			 idx; /* input or (earlier) step index */
+};
+
+/*
+ * A single step of a statement program: a prepared statement run to
+ * completion with the given parameters.
+ */
+struct	sqlbox_progstep {
+	size_t			 stmt; /* statement index */
+	struct sqlbox_progparm	*parms; /* parameters or NULL */
+	size_t			 parmsz; /* no. parameters or 0 */
+};
+
+/*
+ * A statement program is an ordered list of statements executed by
+ * the server in one operation, by default in its own transaction.
+ */
+struct	sqlbox_prog {
+	struct sqlbox_progstep	*steps; /* all steps */
+	size_t			 stepsz; /* no. steps */
+#define	SQLBOX_PROG_NOTRANS 0x01 /* don't wrap in transaction */
+	unsigned int		 flags; /* program flags */
+};
+
+/*
+ * Set of all statement programs.
+ */
+struct	sqlbox_progs {
+	struct sqlbox_prog	*progs; /* all programs or NULL */
+	size_t			 progsz; /* no. programs or 0 */
+};
+
 /*
  * Contains all data required for an sqlbox configuration.
  */
@@ -204,12 +340,36 @@ struct	sqlbox_cfg {
 	struct sqlbox_srcs	srcs; /* databases */
 	struct sqlbox_filts	filts; /* filters */
 	struct sqlbox_msg	msg; /* message system */
+	struct sqlbox_comm	comm; /* communication channel */
+	struct sqlbox_progs	progs; /* statement programs */
+	struct sqlbox_pblobs	blobs; /* blob columns */
 };
 
 enum	sqlbox_code {
 	SQLBOX_CODE_OK = 0, /* success */
 	SQLBOX_CODE_CONSTRAINT = 1, /* constraint violation */
-	SQLBOX_CODE_ERROR /* never returned */
+	SQLBOX_CODE_ERROR = 2, /* never returned */
+	SQLBOX_CODE_INTERRUPT = 3, /* interrupted by sqlbox_interrupt */
+	SQLBOX_CODE_BUDGET = 4, /* execution budget exceeded */
+	SQLBOX_CODE_BUSY = 5, /* gave up on busy database */
+};
+
+/*
+ * Row formats for sqlbox_export and sqlbox_import.
+ */
+enum	sqlbox_fmt {
+	SQLBOX_FMT_BINARY = 0, /* packed parameters */
+	SQLBOX_FMT_CSV = 1, /* RFC 4180 */
+	SQLBOX_FMT_JSON = 2, /* JSON array per line */
+};
+
+/*
+ * Counters kept by the database process for monitoring.
+ */
+struct	sqlbox_stats {
+	uint64_t		 retries; /* retries of busy database */
+	uint64_t		 giveups; /* SQLBOX_CODE_BUSY et al. */
+	uint64_t		 waited; /* milliseconds backing off */
 };
 
 /*
@@ -225,11 +385,20 @@ struct	sqlbox_parmset {
 
 /*
  * Flag bit values for sqlbox_exec, sqlbox_exec_async,
- * sqlbox_preapre_bind, and sqlbox_prepare_bind_async.
+ * sqlbox_exec_async_nb, sqlbox_exec_chunk, sqlbox_exec_ext,
+ * sqlbox_exec_rows, sqlbox_preapre_bind, sqlbox_prepare_bind_async,
+ * sqlbox_prepare_bind_async_nb, and sqlbox_query.
  */
 #define	SQLBOX_STMT_NORMAL	0x00
 #define	SQLBOX_STMT_CONSTRAINT	0x01
 #define	SQLBOX_STMT_MULTI	0x02
+#define	SQLBOX_STMT_ONESHOT	0x08
+
+/*
+ * Flag bit values for sqlbox_blob_open.
+ */
+#define	SQLBOX_BLOB_READ	0x00
+#define	SQLBOX_BLOB_WRITE	0x01
 
 typedef void (*sqlbox_cfg_free)(struct sqlbox_cfg *);
 
@@ -257,15 +426,40 @@ int		 sqlbox_role_hier_start(struct sqlbox_role_hier *, size_t);
 
 struct sqlbox	*sqlbox_alloc(struct sqlbox_cfg *);
 struct sqlbox	*sqlbox_alloc_destructor(struct sqlbox_cfg *, sqlbox_cfg_free);
+int		 sqlbox_blob_close(struct sqlbox *, size_t);
+size_t		 sqlbox_blob_open(struct sqlbox *, size_t, size_t,
+			int64_t, unsigned long, size_t *);
+int		 sqlbox_blob_read(struct sqlbox *, size_t,
+			void *, size_t, size_t);
+int		 sqlbox_blob_write(struct sqlbox *, size_t,
+			const void *, size_t, size_t);
 int		 sqlbox_close(struct sqlbox *, size_t);
 int		 sqlbox_exec_async(struct sqlbox *, size_t, size_t, 
 			size_t, const struct sqlbox_parm *,
 			unsigned long);
+int		 sqlbox_exec_async_nb(struct sqlbox *, size_t, size_t, 
+			size_t, const struct sqlbox_parm *,
+			unsigned long, int *);
 enum sqlbox_code sqlbox_exec(struct sqlbox *, size_t, size_t, 
 			size_t, const struct sqlbox_parm *,
 			unsigned long);
+enum sqlbox_code sqlbox_exec_chunk(struct sqlbox *, size_t, size_t, 
+			size_t, const struct sqlbox_parm *,
+			unsigned long, int64_t *);
+enum sqlbox_code sqlbox_exec_ext(struct sqlbox *, size_t, size_t, 
+			size_t, const struct sqlbox_parm *,
+			unsigned long, int64_t *, int64_t *);
+enum sqlbox_code sqlbox_exec_rows(struct sqlbox *, size_t, size_t, 
+			size_t, const struct sqlbox_parm *,
+			unsigned long, const struct sqlbox_parmset **,
+			size_t *);
+enum sqlbox_code sqlbox_export(struct sqlbox *, size_t, int,
+			enum sqlbox_fmt);
 int		 sqlbox_finalise(struct sqlbox *, size_t);
+enum sqlbox_code sqlbox_import(struct sqlbox *, size_t, size_t, int,
+			enum sqlbox_fmt, size_t, size_t *, size_t *);
 void		 sqlbox_free(struct sqlbox *);
+int		 sqlbox_interrupt(struct sqlbox *);
 int		 sqlbox_lastid(struct sqlbox *, size_t, int64_t *);
 int		 sqlbox_msg_set_dat(struct sqlbox *, 
 			const void *, size_t);
@@ -278,15 +472,33 @@ int		 sqlbox_parm_int(const struct sqlbox_parm *, int64_t *);
 int		 sqlbox_parm_string(const struct sqlbox_parm *, char *, size_t, size_t *);
 int		 sqlbox_parm_string_alloc(const struct sqlbox_parm *, char **, size_t *);
 int		 sqlbox_ping(struct sqlbox *);
+int		 sqlbox_ping_oob(struct sqlbox *);
 size_t		 sqlbox_prepare_bind(struct sqlbox *, size_t,
 			size_t, size_t, const struct sqlbox_parm *,
 			unsigned long);
 int		 sqlbox_prepare_bind_async(struct sqlbox *, size_t,
 			size_t, size_t, const struct sqlbox_parm *,
 			unsigned long);
+int		 sqlbox_prepare_bind_async_nb(struct sqlbox *, size_t,
+			size_t, size_t, const struct sqlbox_parm *,
+			unsigned long, int *);
+const struct sqlbox_parmset
+		*sqlbox_query(struct sqlbox *, size_t,
+			size_t, size_t, const struct sqlbox_parm *,
+			unsigned long, size_t *);
 int		 sqlbox_rebind(struct sqlbox *, size_t,
 			size_t, const struct sqlbox_parm *);
+int		 sqlbox_rebind_many(struct sqlbox *, size_t, size_t,
+			const struct sqlbox_parmset *,
+			const struct sqlbox_parmset **, size_t *);
+const struct sqlbox_parmset
+		*sqlbox_rebind_step(struct sqlbox *, size_t,
+			size_t, const struct sqlbox_parm *);
 int	 	 sqlbox_role(struct sqlbox *, size_t);
+enum sqlbox_code sqlbox_run_program(struct sqlbox *, size_t, size_t,
+			size_t, const struct sqlbox_parm *,
+			unsigned long);
+int		 sqlbox_stats(struct sqlbox *, struct sqlbox_stats *);
 const struct sqlbox_parmset
 		*sqlbox_step(struct sqlbox *, size_t);
 int		 sqlbox_trans_immediate(struct sqlbox *, size_t, size_t);
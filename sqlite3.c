@@ -20,18 +20,131 @@
 # include <sys/queue.h>
 #endif 
 
+#include <sys/stat.h>
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sqlite3.h>
 
 #include "sqlbox.h"
 #include "extern.h"
 
+/*
+ * Serialisation needs 3.36 and 64-bit change counts 3.37.
+ */
+#if SQLITE_VERSION_NUMBER < 3037000
+# error "sqlite3 3.37.0 or newer is required"
+#endif
+
+/*
+ * How many virtual machine instructions between checking a statement's
+ * budget.
+ * This is the granularity of the VM step limit.
+ */
+#define	SQLBOX_BUDGET_OPS 1000
+
+/*
+ * Set the limits of budget "b" from "pst" and zero its usage.
+ * This should be called whenever a statement is (re)bound.
+ */
+void
+sqlbox_budget_init(struct sqlbox_budget *b, const struct sqlbox_pstmt *pst)
+{
+
+	memset(b, 0, sizeof(struct sqlbox_budget));
+	b->maxops = pst->budget_ops;
+	b->maxms = pst->budget_ms;
+}
+
+/*
+ * Monotonic time in microseconds.
+ */
+static uint64_t
+sqlbox_budget_now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * See whether the budget, if any, has been exceeded, including the time
+ * spent in the current step.
+ * Returns non-zero if exceeded.
+ */
+static int
+sqlbox_budget_over(struct sqlbox_budget *b)
+{
+
+	if (b == NULL)
+		return 0;
+	if (!b->over && b->maxops && b->ops >= b->maxops)
+		b->over = 1;
+	if (!b->over && b->maxms && b->us + 
+	    (sqlbox_budget_now() - b->start) >= b->maxms * 1000)
+		b->over = 1;
+	return b->over;
+}
+
+/*
+ * Progress handler invoked by SQLite every SQLBOX_BUDGET_OPS (or fewer)
+ * instructions.
+ * Returns non-zero, interrupting the statement, if over budget.
+ */
+static int
+sqlbox_budget_progress(void *arg)
+{
+	struct sqlbox_budget	*b = arg;
+	size_t			 n = SQLBOX_BUDGET_OPS;
+
+	if (b->maxops && b->maxops < n)
+		n = b->maxops;
+	b->ops += n;
+	return sqlbox_budget_over(b);
+}
+
+/*
+ * Start accounting for budget "b", if any.
+ * Must be matched by sqlbox_budget_leave().
+ */
+static void
+sqlbox_budget_enter(struct sqlbox_db *db, struct sqlbox_budget *b)
+{
+	size_t	 n = SQLBOX_BUDGET_OPS;
+
+	if (b == NULL || (b->maxops == 0 && b->maxms == 0))
+		return;
+	if (b->maxops && b->maxops < n)
+		n = b->maxops;
+	b->start = sqlbox_budget_now();
+	sqlite3_progress_handler(db->db, n, sqlbox_budget_progress, b);
+}
+
+static void
+sqlbox_budget_leave(struct sqlbox_db *db, struct sqlbox_budget *b)
+{
+
+	if (b == NULL || (b->maxops == 0 && b->maxms == 0))
+		return;
+	sqlite3_progress_handler(db->db, 0, NULL, NULL);
+	b->us += sqlbox_budget_now() - b->start;
+}
+
 /* 
  * Actually prepare a statement "pst".
- * In the usual way we sleep if SQLite gives us a busy, locked, or weird
- * protocol error.
+ * In the usual way we back off if SQLite gives us a busy, locked, or
+ * weird protocol error, giving up as the source's retry policy says.
  * All other errors are real errorrs.
  * Returns the statement or NULL on failure.
  */
@@ -39,25 +152,45 @@ sqlite3_stmt *
 sqlbox_wrap_prep(struct sqlbox *box, struct sqlbox_db *db,
 	const struct sqlbox_pstmt *pst)
 {
-	sqlite3_stmt	*stmt;
-	int		 c;
-	size_t		 attempt = 0;
+	sqlite3_stmt		*stmt;
+	struct sqlbox_cached	*c;
+	struct sqlbox_backoff	 bo;
 
 	assert(pst != NULL && pst->stmt != NULL);
+
+	/* Cached connections may have already prepared this. */
+
+	if (db->conn != NULL)
+		TAILQ_FOREACH(c, &db->conn->cache, entries) {
+			if (c->pstmt != pst)
+				continue;
+			sqlbox_debug(&box->cfg, "%s: cached: %s",
+				db->src->fname, pst->stmt);
+			TAILQ_REMOVE(&db->conn->cache, c, entries);
+			db->conn->cachesz--;
+			stmt = c->stmt;
+			free(c);
+			return stmt;
+		}
+
 	sqlbox_debug(&box->cfg, "%s: sqlite3_prepare_v2: %s",
 		db->src->fname, pst->stmt);
+	sqlbox_backoff_init(&bo, db->src);
 
 again:
 	stmt = NULL;
-	c = sqlite3_prepare_v2(db->db, pst->stmt, -1, &stmt, NULL);
-
-	switch (c) {
+	switch (sqlite3_prepare_v2(db->db, pst->stmt, -1, &stmt, NULL)) {
 	case SQLITE_BUSY:
 	case SQLITE_LOCKED:
 	case SQLITE_PROTOCOL:
 		sqlbox_wrap_finalise(box, db, pst, stmt);
-		sqlbox_sleep(attempt++);
-		goto again;
+		if (sqlbox_backoff(box, &bo))
+			goto again;
+		sqlbox_warnx(&box->cfg, "%s: sqlite3_prepare_v2: "
+			"gave up waiting", db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: statement: %s", 
+			db->src->fname, pst->stmt);
+		return NULL;
 	case SQLITE_OK:
 		assert(stmt != NULL);
 		return stmt;
@@ -74,39 +207,516 @@ again:
 	return NULL;
 }
 
+/*
+ * Build the URI used to open an immutable source, escaping the
+ * characters in "fname" that would otherwise be interpreted.
+ * Absolute paths are given an empty authority.
+ * Returns the URI (must be freed) or NULL on memory exhaustion.
+ */
+static char *
+sqlbox_wrap_uri(const char *fname)
+{
+	static const char	 hex[] = "0123456789ABCDEF";
+	static const char	 pfx[] = "file:";
+	static const char	 sfx[] = "?mode=ro&immutable=1";
+	char			*uri, *cp;
+
+	/* Worst case: "//" authority and every byte escaped. */
+
+	uri = malloc(sizeof(pfx) + 2 + strlen(fname) * 3 + sizeof(sfx));
+	if (uri == NULL)
+		return NULL;
+
+	cp = uri;
+	memcpy(cp, pfx, sizeof(pfx) - 1);
+	cp += sizeof(pfx) - 1;
+	if (fname[0] == '/') {
+		*cp++ = '/';
+		*cp++ = '/';
+	}
+	for ( ; *fname != '\0'; fname++)
+		if (*fname == '%' || *fname == '?' || *fname == '#') {
+			*cp++ = '%';
+			*cp++ = hex[(unsigned char)*fname >> 4];
+			*cp++ = hex[(unsigned char)*fname & 0xf];
+		} else
+			*cp++ = *fname;
+	memcpy(cp, sfx, sizeof(sfx));
+	return uri;
+}
+
+/*
+ * Read the source's file into a private in-memory database.
+ * A missing file is only allowed when the source may be created, in
+ * which case the database starts out empty.
+ * Returns the database or NULL on failure.
+ */
+static sqlite3 *
+sqlbox_wrap_preload(struct sqlbox *box, const struct sqlbox_src *src)
+{
+	sqlite3		*db = NULL;
+	unsigned char	*buf = NULL;
+	struct stat	 st;
+	int		 fd, fl, ofl;
+	size_t		 off = 0;
+	ssize_t		 ssz;
+
+	/*
+	 * Read-only modes open the connection itself read-only, as an
+	 * empty file leaves nothing to deserialise as read-only.
+	 */
+
+	fl = SQLITE_DESERIALIZE_FREEONCLOSE;
+	if (src->mode == SQLBOX_SRC_RO ||
+	    src->mode == SQLBOX_SRC_IMMUTABLE) {
+		fl |= SQLITE_DESERIALIZE_READONLY;
+		ofl = SQLITE_OPEN_READONLY;
+	} else {
+		fl |= SQLITE_DESERIALIZE_RESIZEABLE;
+		ofl = SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE;
+	}
+
+	if ((fd = open(src->fname, O_RDONLY)) == -1) {
+		if (errno != ENOENT || src->mode != SQLBOX_SRC_RWC) {
+			sqlbox_warn(&box->cfg, "%s: open", src->fname);
+			return NULL;
+		}
+	} else if (fstat(fd, &st) == -1) {
+		sqlbox_warn(&box->cfg, "%s: fstat", src->fname);
+		goto err;
+	} else if (st.st_size > 0) {
+		buf = sqlite3_malloc64(st.st_size);
+		if (buf == NULL) {
+			sqlbox_warnx(&box->cfg, "%s: "
+				"sqlite3_malloc64", src->fname);
+			goto err;
+		}
+		while (off < (size_t)st.st_size) {
+			ssz = read(fd, buf + off, st.st_size - off);
+			if (ssz == -1) {
+				sqlbox_warn(&box->cfg, 
+					"%s: read", src->fname);
+				goto err;
+			} else if (ssz == 0) {
+				sqlbox_warnx(&box->cfg, "%s: read: "
+					"short file", src->fname);
+				goto err;
+			}
+			off += ssz;
+		}
+	}
+
+	sqlbox_debug(&box->cfg, "sqlite3_open_v2: %s (preload)", 
+		src->fname);
+	if (sqlite3_open_v2(":memory:", &db, ofl, NULL) != SQLITE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: open: %s", src->fname,
+			db == NULL ? "sqlite3_open_v2" : 
+			sqlite3_errmsg(db));
+		goto err;
+	}
+
+	/* This takes ownership of the buffer, even on failure. */
+
+	if (off > 0) {
+		if (sqlite3_deserialize(db, "main", buf, 
+		    off, off, fl) != SQLITE_OK) {
+			buf = NULL;
+			sqlbox_warnx(&box->cfg, "%s: sqlite3_"
+				"deserialize: %s", src->fname,
+				sqlite3_errmsg(db));
+			goto err;
+		}
+		buf = NULL;
+	}
+
+	if (fd != -1)
+		close(fd);
+	return db;
+err:
+	sqlite3_free(buf);
+	if (db != NULL)
+		sqlite3_close(db);
+	if (fd != -1)
+		close(fd);
+	return NULL;
+}
+
+/*
+ * Write a preloaded database back into its source file.
+ * Writes into a temporary file, then renames over the source, so
+ * the source is never partially written.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_wrap_save(struct sqlbox *box, const struct sqlbox_db *db)
+{
+	unsigned char	*buf;
+	sqlite3_int64	 sz;
+	char		 path[PATH_MAX];
+	struct stat	 st;
+	size_t		 off = 0;
+	ssize_t		 ssz;
+	int		 fd, c;
+
+	c = snprintf(path, sizeof(path), "%s.XXXXXX", db->src->fname);
+	if (c < 0 || (size_t)c >= sizeof(path)) {
+		sqlbox_warnx(&box->cfg, "%s: save: "
+			"path too long", db->src->fname);
+		return 0;
+	}
+
+	if ((buf = sqlite3_serialize(db->db, "main", &sz, 0)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: sqlite3_serialize: %s",
+			db->src->fname, sqlite3_errmsg(db->db));
+		return 0;
+	}
+	if ((fd = mkstemp(path)) == -1) {
+		sqlbox_warn(&box->cfg, "%s: mkstemp", path);
+		sqlite3_free(buf);
+		return 0;
+	}
+
+	/* Keep the permissions of any existing file. */
+
+	if (stat(db->src->fname, &st) != -1 &&
+	    fchmod(fd, st.st_mode & 07777) == -1) {
+		sqlbox_warn(&box->cfg, "%s: fchmod", path);
+		goto err;
+	}
+
+	while (off < (size_t)sz) {
+		if ((ssz = write(fd, buf + off, sz - off)) == -1) {
+			sqlbox_warn(&box->cfg, "%s: write", path);
+			goto err;
+		}
+		off += ssz;
+	}
+
+	if (fsync(fd) == -1) {
+		sqlbox_warn(&box->cfg, "%s: fsync", path);
+		goto err;
+	} else if (close(fd) == -1) {
+		fd = -1;
+		sqlbox_warn(&box->cfg, "%s: close", path);
+		goto err;
+	}
+	fd = -1;
+	if (rename(path, db->src->fname) == -1) {
+		sqlbox_warn(&box->cfg, "%s: rename", path);
+		goto err;
+	}
+
+	sqlite3_free(buf);
+	return 1;
+err:
+	if (fd != -1)
+		close(fd);
+	unlink(path);
+	sqlite3_free(buf);
+	return 0;
+}
+
+/*
+ * A cursor over a bound struct sqlbox_array.
+ */
+struct	sqlbox_array_cursor {
+	sqlite3_vtab_cursor	 base; /* must be first */
+	const struct sqlbox_array *arr; /* bound array or NULL */
+	size_t			 pos; /* current element */
+};
+
+static int
+sqlbox_array_connect(sqlite3 *db, void *arg, int argc,
+	const char *const *argv, sqlite3_vtab **vtab, char **err)
+{
+	int	 c;
+
+	c = sqlite3_declare_vtab(db, 
+		"CREATE TABLE x(value, pointer HIDDEN)");
+	if (c != SQLITE_OK)
+		return c;
+	if ((*vtab = sqlite3_malloc(sizeof(sqlite3_vtab))) == NULL)
+		return SQLITE_NOMEM;
+	memset(*vtab, 0, sizeof(sqlite3_vtab));
+	return SQLITE_OK;
+}
+
+static int
+sqlbox_array_disconnect(sqlite3_vtab *vtab)
+{
+
+	sqlite3_free(vtab);
+	return SQLITE_OK;
+}
+
+/*
+ * The only way to use the table is by constraining the hidden
+ * "pointer" column, i.e., passing the array as an argument.
+ */
+static int
+sqlbox_array_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+	int	 i;
+
+	for (i = 0; i < info->nConstraint; i++)
+		if (info->aConstraint[i].iColumn == 1 &&
+		    info->aConstraint[i].op == 
+		      SQLITE_INDEX_CONSTRAINT_EQ &&
+		    info->aConstraint[i].usable)
+			break;
+
+	if (i == info->nConstraint) {
+		info->idxNum = 0;
+		info->estimatedCost = 2147483647;
+		info->estimatedRows = 2147483647;
+		return SQLITE_OK;
+	}
+
+	info->aConstraintUsage[i].argvIndex = 1;
+	info->aConstraintUsage[i].omit = 1;
+	info->idxNum = 1;
+	info->estimatedCost = 1;
+	info->estimatedRows = 100;
+	return SQLITE_OK;
+}
+
+static int
+sqlbox_array_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cur)
+{
+	struct sqlbox_array_cursor	*c;
+
+	c = sqlite3_malloc(sizeof(struct sqlbox_array_cursor));
+	if (c == NULL)
+		return SQLITE_NOMEM;
+	memset(c, 0, sizeof(struct sqlbox_array_cursor));
+	*cur = &c->base;
+	return SQLITE_OK;
+}
+
+static int
+sqlbox_array_close(sqlite3_vtab_cursor *cur)
+{
+
+	sqlite3_free(cur);
+	return SQLITE_OK;
+}
+
+static int
+sqlbox_array_filter(sqlite3_vtab_cursor *cur, int idxnum, 
+	const char *idxstr, int argc, sqlite3_value **argv)
+{
+	struct sqlbox_array_cursor	*c = 
+		(struct sqlbox_array_cursor *)cur;
+
+	c->pos = 0;
+	c->arr = idxnum == 1 && argc > 0 ? 
+		sqlite3_value_pointer(argv[0], SQLBOX_ARRAY_PTR) : NULL;
+	return SQLITE_OK;
+}
+
+static int
+sqlbox_array_next(sqlite3_vtab_cursor *cur)
+{
+
+	((struct sqlbox_array_cursor *)cur)->pos++;
+	return SQLITE_OK;
+}
+
+static int
+sqlbox_array_eof(sqlite3_vtab_cursor *cur)
+{
+	const struct sqlbox_array_cursor *c = 
+		(const struct sqlbox_array_cursor *)cur;
+
+	return c->arr == NULL || c->pos >= c->arr->sz;
+}
+
+/*
+ * Strings are owned by the bound array, which outlives the cursor.
+ */
+static int
+sqlbox_array_column(sqlite3_vtab_cursor *cur, 
+	sqlite3_context *ctx, int col)
+{
+	const struct sqlbox_array_cursor *c = 
+		(const struct sqlbox_array_cursor *)cur;
+
+	if (col != 0)
+		sqlite3_result_null(ctx);
+	else if (c->arr->type == SQLBOX_PARM_INT)
+		sqlite3_result_int64(ctx, c->arr->ints[c->pos]);
+	else
+		sqlite3_result_text(ctx, 
+			c->arr->strs[c->pos], -1, SQLITE_STATIC);
+	return SQLITE_OK;
+}
+
+static int
+sqlbox_array_rowid(sqlite3_vtab_cursor *cur, sqlite3_int64 *rowid)
+{
+
+	*rowid = ((struct sqlbox_array_cursor *)cur)->pos + 1;
+	return SQLITE_OK;
+}
+
+/*
+ * An eponymous-only table-valued function over an array parameter,
+ * used as "IN sqlbox_array(?)" or "FROM sqlbox_array(?)".
+ */
+static const sqlite3_module sqlbox_array_module = {
+	.xConnect = sqlbox_array_connect,
+	.xBestIndex = sqlbox_array_best_index,
+	.xDisconnect = sqlbox_array_disconnect,
+	.xOpen = sqlbox_array_open,
+	.xClose = sqlbox_array_close,
+	.xFilter = sqlbox_array_filter,
+	.xNext = sqlbox_array_next,
+	.xEof = sqlbox_array_eof,
+	.xColumn = sqlbox_array_column,
+	.xRowid = sqlbox_array_rowid,
+};
+
+/*
+ * Register the sqlbox_array table-valued function with a newly-opened
+ * database.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_wrap_array(struct sqlbox *box, struct sqlbox_db *db)
+{
+
+	sqlbox_debug(&box->cfg, "sqlite3_create_module: %s, %s", 
+		db->src->fname, SQLBOX_ARRAY_PTR);
+	if (sqlite3_create_module(db->db, SQLBOX_ARRAY_PTR,
+	    &sqlbox_array_module, NULL) != SQLITE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: sqlite3_create_module: %s",
+			db->src->fname, sqlite3_errmsg(db->db));
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Close the database, first writing it back to its source file if
+ * it was preloaded and is to be saved.
+ * We don't save if we're still in a transaction, as this is always
+ * rolled back on close.
+ * Returns TRUE on success, FALSE on failure (the database is always
+ * closed).
+ */
+int
+sqlbox_wrap_close(struct sqlbox *box, struct sqlbox_db *db)
+{
+	struct sqlbox_cached	*c;
+	int	 		 rc = 1;
+
+	/* 
+	 * Connections with a cache are only closed by their last user,
+	 * which must first clear out the statement cache.
+	 */
+
+	if (db->conn != NULL) {
+		assert(db->conn->refs > 0);
+		if (--db->conn->refs > 0) {
+			sqlbox_debug(&box->cfg, "%s: close: %zu "
+				"shared remaining", db->src->fname,
+				db->conn->refs);
+			return 1;
+		}
+		while ((c = TAILQ_FIRST(&db->conn->cache)) != NULL) {
+			sqlbox_debug(&box->cfg, "%s: sqlite3_finalize: "
+				"%s", db->src->fname, c->pstmt->stmt);
+			(void)sqlite3_finalize(c->stmt);
+			TAILQ_REMOVE(&db->conn->cache, c, entries);
+			free(c);
+		}
+		free(db->conn);
+		db->conn = NULL;
+	}
+
+	if ((db->src->flags & SQLBOX_SRC_SAVE)) {
+		if (!sqlite3_get_autocommit(db->db)) {
+			sqlbox_warnx(&box->cfg, "%s: not saving "
+				"with open transaction", 
+				db->src->fname);
+			rc = 0;
+		} else if (!sqlbox_wrap_save(box, db)) {
+			sqlbox_warnx(&box->cfg, "%s: "
+				"sqlbox_wrap_save", db->src->fname);
+			rc = 0;
+		}
+	}
+
+	sqlbox_debug(&box->cfg, "sqlite3_close: %s", db->src->fname);
+	if (sqlite3_close(db->db) != SQLITE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: close: %s", 
+			db->src->fname, sqlite3_errmsg(db->db));
+		rc = 0;
+	}
+	return rc;
+}
+
 sqlite3 *
 sqlbox_wrap_open(struct sqlbox *box, const struct sqlbox_src *src)
 {
-	int	 	 fl = SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE;
-	size_t		 attempt = 0;
-	sqlite3		*db;
+	int	 	 	 fl = SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE;
+	struct sqlbox_backoff	 bo;
+	sqlite3			*db;
+	char			*uri = NULL;
+	const char		*fname = src->fname;
+
+	if ((src->flags & SQLBOX_SRC_PRELOAD))
+		return sqlbox_wrap_preload(box, src);
 
 	if (src->mode == SQLBOX_SRC_RO)
 		fl = SQLITE_OPEN_READONLY;
 	else if (src->mode == SQLBOX_SRC_RW)
 		fl = SQLITE_OPEN_READWRITE;
+	else if (src->mode == SQLBOX_SRC_IMMUTABLE) {
+		/*
+		 * The caller guarantees that the file won't change, so
+		 * let SQLite skip locking and change detection.
+		 */
+		if ((uri = sqlbox_wrap_uri(src->fname)) == NULL) {
+			sqlbox_warn(&box->cfg, "%s: open: "
+				"malloc", src->fname);
+			return NULL;
+		}
+		fname = uri;
+		fl = SQLITE_OPEN_READONLY|SQLITE_OPEN_URI;
+	}
 	
 	/*
 	 * We can legit be asked to wait for a while for opening
 	 * especially if the source is stressed.
-	 * Use our usual backing-off algorithm but keep trying ad
-	 * infinitum.
+	 * Use our usual backing-off algorithm and keep trying as long
+	 * as the source allows.
 	 * If we error out, be sure to free all resources.
 	 */
+
+	sqlbox_backoff_init(&bo, src);
 again:
-	sqlbox_debug(&box->cfg, "sqlite3_open_v2: %s", src->fname);
+	sqlbox_debug(&box->cfg, "sqlite3_open_v2: %s", fname);
 	db = NULL;
-	switch (sqlite3_open_v2(src->fname, &db, fl, NULL)) {
+	switch (sqlite3_open_v2(fname, &db, fl, NULL)) {
 	case SQLITE_BUSY:
 	case SQLITE_LOCKED:
 	case SQLITE_PROTOCOL:
 		sqlbox_debug(&box->cfg, 
 			"sqlite3_close: %s", src->fname);
 		sqlite3_close(db);
-		sqlbox_sleep(attempt++);
-		goto again;
+		if (sqlbox_backoff(box, &bo))
+			goto again;
+		sqlbox_warnx(&box->cfg, "%s: open: "
+			"gave up waiting", src->fname);
+		free(uri);
+		return NULL;
 	case SQLITE_OK:
 		assert(db != NULL);
+		if (src->retry.busy_timeout)
+			sqlite3_busy_timeout(db, 
+				(int)src->retry.busy_timeout);
+		free(uri);
 		return db;
 	default:
 		break;
@@ -122,46 +732,67 @@ again:
 		sqlbox_warnx(&box->cfg, "%s: open: "
 			"sqlite3_open_v2", src->fname);
 
+	free(uri);
 	return NULL;
 }
 
 /*
  * Step through statement.
  * Returns SQLBOX_CODE_OK on success, SQLBOX_CODE_CONSTRAINT if
- * allow_cstep is non-zero and there's a constraint violation, or
+ * allow_cstep is non-zero and there's a constraint violation,
+ * SQLBOX_CODE_INTERRUPT if interrupted by the client,
+ * SQLBOX_CODE_BUDGET if the budget "b" (if not NULL) is exceeded,
+ * SQLBOX_CODE_BUSY if the database is busy within a transaction or we
+ * gave up waiting on it, or
  * SQLBOX_CODE_ERROR otherwise.
  * If there are columns in the return of the SQL statement, this sets
  * "cols" but otherwise returns SQLBOX_CODE_OK.
  */
-enum sqlbox_code
-sqlbox_wrap_step(struct sqlbox *box, struct sqlbox_db *db,
+static enum sqlbox_code
+sqlbox_wrap_step_inner(struct sqlbox *box, struct sqlbox_db *db,
 	const struct sqlbox_pstmt *pst, sqlite3_stmt *stmt,
-	size_t *cols, int allow_cstep)
+	size_t *cols, int allow_cstep, struct sqlbox_budget *b)
 {
-	size_t	 attempt = 0;
-	int	 ccount;
+	struct sqlbox_backoff	 bo;
+	int			 ccount;
 
 	*cols = 0;
 
 	assert(pst != NULL && pst->stmt != NULL);
 	sqlbox_debug(&box->cfg, "%s: sqlite3_step: %s",
 		db->src->fname, pst->stmt);
+	sqlbox_backoff_init(&bo, db->src);
 
 again_step:
 	switch (sqlite3_step(stmt)) {
 	case SQLITE_BUSY:
 		/*
-		 * FIXME: according to sqlite3_step(3), this
-		 * should return if we're in a transaction.
+		 * According to sqlite3_step(3), we shouldn't retry
+		 * within an explicit transaction, as whoever has the
+		 * lock may be waiting on us: have the caller roll back.
 		 */
-		sqlbox_sleep(attempt++);
-		goto again_step;
+		if (!sqlite3_get_autocommit(db->db)) {
+			sqlbox_debug(&box->cfg, "%s: sqlite3_step: busy "
+				"in transaction: %s", db->src->fname, 
+				pst->stmt);
+			box->stats.giveups++;
+			return SQLBOX_CODE_BUSY;
+		}
+		/* FALLTHROUGH */
 	case SQLITE_LOCKED:
 	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again_step;
+		if (sqlbox_ctl_interrupted(box) ||
+		    sqlbox_budget_over(b))
+			break;
+		if (sqlbox_backoff(box, &bo))
+			goto again_step;
+		sqlbox_debug(&box->cfg, "%s: sqlite3_step: gave up "
+			"waiting: %s", db->src->fname, pst->stmt);
+		return SQLBOX_CODE_BUSY;
 	case SQLITE_DONE:
 		return SQLBOX_CODE_OK;
+	case SQLITE_INTERRUPT:
+		break;
 	case SQLITE_ROW:
 		if ((ccount = sqlite3_column_count(stmt)) > 0) {
 			*cols = (size_t)ccount;
@@ -180,6 +811,17 @@ again_step:
 		break;
 	}
 
+	if (sqlbox_ctl_interrupted(box)) {
+		sqlbox_debug(&box->cfg, "%s: sqlite3_step: "
+			"interrupted: %s", db->src->fname, pst->stmt);
+		return SQLBOX_CODE_INTERRUPT;
+	}
+	if (sqlbox_budget_over(b)) {
+		sqlbox_debug(&box->cfg, "%s: sqlite3_step: "
+			"over budget: %s", db->src->fname, pst->stmt);
+		return SQLBOX_CODE_BUDGET;
+	}
+
 	sqlbox_warnx(&box->cfg, "%s: sqlite3_step: %s", 
 		db->src->fname, sqlite3_errmsg(db->db));
 	sqlbox_warnx(&box->cfg, "%s: statement: %s", 
@@ -187,6 +829,44 @@ again_step:
 	return SQLBOX_CODE_ERROR;
 }
 
+/*
+ * Step through the statement while accepting interrupts from the
+ * control channel and accounting for the budget "b", if not NULL.
+ * See sqlbox_wrap_step_inner() for return values.
+ */
+enum sqlbox_code
+sqlbox_wrap_step(struct sqlbox *box, struct sqlbox_db *db,
+	const struct sqlbox_pstmt *pst, sqlite3_stmt *stmt,
+	size_t *cols, int allow_cstep, struct sqlbox_budget *b)
+{
+	enum sqlbox_code	 code;
+
+	*cols = 0;
+	/*
+	 * Interrupting a write midway makes SQLite roll back the whole
+	 * transaction, which would silently lose any batched writes.
+	 * So while batching, only interrupt before starting.
+	 */
+
+	sqlbox_ctl_enter(box, db->batch ? NULL : db->db);
+
+	/* Interrupts may have been latched before we started. */
+
+	if (sqlbox_ctl_interrupted(box)) {
+		sqlbox_debug(&box->cfg, "%s: sqlite3_step: interrupted "
+			"before starting: %s", db->src->fname, pst->stmt);
+		sqlbox_ctl_leave(box);
+		return SQLBOX_CODE_INTERRUPT;
+	}
+
+	sqlbox_budget_enter(db, b);
+	code = sqlbox_wrap_step_inner
+		(box, db, pst, stmt, cols, allow_cstep, b);
+	sqlbox_budget_leave(db, b);
+	sqlbox_ctl_leave(box);
+	return code;
+}
+
 /*
  * Log about and finalise the statement.
  * Does nothing if statement is NULL.
@@ -196,44 +876,81 @@ sqlbox_wrap_finalise(struct sqlbox *box, struct sqlbox_db *db,
 	const struct sqlbox_pstmt *pst, sqlite3_stmt *stmt)
 {
 
+	struct sqlbox_cached	*c;
+
 	if (stmt == NULL)
 		return;
 
 	/* 
-	 * This returns the last operation's error code, so we ignore it
-	 * as it may have failed.
+	 * These return the last operation's error code, so we ignore
+	 * them as it may have failed.
+	 * Cached connections keep the statement for reuse if possible.
 	 */
 
+	if (db->conn != NULL && db->conn->cachesz < SQLBOX_STMT_CACHE_MAX &&
+	    (c = malloc(sizeof(struct sqlbox_cached))) != NULL) {
+		sqlbox_debug(&box->cfg, "%s: sqlite3_reset: %s",
+			db->src->fname, pst->stmt);
+		(void)sqlite3_reset(stmt);
+		(void)sqlite3_clear_bindings(stmt);
+		c->stmt = stmt;
+		c->pstmt = pst;
+		TAILQ_INSERT_HEAD(&db->conn->cache, c, entries);
+		db->conn->cachesz++;
+		return;
+	}
+
 	sqlbox_debug(&box->cfg, "%s: sqlite3_finalize: %s",
 		db->src->fname, pst->stmt);
 	(void)sqlite3_finalize(stmt);
 }
 
-enum sqlbox_code
-sqlbox_wrap_exec(struct sqlbox *box, struct sqlbox_db *db,
-	const struct sqlbox_pstmt *pst, int allow_cstep)
+/*
+ * Like sqlbox_wrap_step() but for statements without parameters or
+ * results.
+ */
+static enum sqlbox_code
+sqlbox_wrap_exec_inner(struct sqlbox *box, struct sqlbox_db *db,
+	const struct sqlbox_pstmt *pst, int allow_cstep,
+	struct sqlbox_budget *b)
 {
-	size_t	 attempt = 0;
+	struct sqlbox_backoff	 bo;
 
 	assert(pst != NULL && pst->stmt != NULL);
 	sqlbox_debug(&box->cfg, "%s: sqlite3_exec: %s",
 		db->src->fname, pst->stmt);
+	sqlbox_backoff_init(&bo, db->src);
 
 again_step:
 	switch (sqlite3_exec(db->db, pst->stmt, NULL, NULL, NULL)) {
 	case SQLITE_BUSY:
 		/*
-		 * FIXME: according to sqlite3_step(3), this
-		 * should return if we're in a transaction.
+		 * According to sqlite3_step(3), we shouldn't retry
+		 * within an explicit transaction, as whoever has the
+		 * lock may be waiting on us: have the caller roll back.
 		 */
-		sqlbox_sleep(attempt++);
-		goto again_step;
+		if (!sqlite3_get_autocommit(db->db)) {
+			sqlbox_debug(&box->cfg, "%s: sqlite3_exec: busy "
+				"in transaction: %s", db->src->fname, 
+				pst->stmt);
+			box->stats.giveups++;
+			return SQLBOX_CODE_BUSY;
+		}
+		/* FALLTHROUGH */
 	case SQLITE_LOCKED:
 	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again_step;
+		if (sqlbox_ctl_interrupted(box) ||
+		    sqlbox_budget_over(b))
+			break;
+		if (sqlbox_backoff(box, &bo))
+			goto again_step;
+		sqlbox_debug(&box->cfg, "%s: sqlite3_exec: gave up "
+			"waiting: %s", db->src->fname, pst->stmt);
+		return SQLBOX_CODE_BUSY;
 	case SQLITE_OK:
 		return SQLBOX_CODE_OK;
+	case SQLITE_INTERRUPT:
+		break;
 	case SQLITE_CONSTRAINT:
 		if (allow_cstep)
 			return SQLBOX_CODE_CONSTRAINT;
@@ -242,9 +959,70 @@ again_step:
 		break;
 	}
 
+	if (sqlbox_ctl_interrupted(box)) {
+		sqlbox_debug(&box->cfg, "%s: sqlite3_exec: "
+			"interrupted: %s", db->src->fname, pst->stmt);
+		return SQLBOX_CODE_INTERRUPT;
+	}
+	if (sqlbox_budget_over(b)) {
+		sqlbox_debug(&box->cfg, "%s: sqlite3_exec: "
+			"over budget: %s", db->src->fname, pst->stmt);
+		return SQLBOX_CODE_BUDGET;
+	}
+
 	sqlbox_warnx(&box->cfg, "%s: sqlite3_exec: %s", 
 		db->src->fname, sqlite3_errmsg(db->db));
 	sqlbox_warnx(&box->cfg, "%s: statement: %s", 
 		db->src->fname, pst->stmt);
 	return SQLBOX_CODE_ERROR;
 }
+
+/*
+ * Execute the statement while accepting interrupts from the control
+ * channel and accounting for the budget "b", if not NULL.
+ * See sqlbox_wrap_step_inner() for return values.
+ */
+enum sqlbox_code
+sqlbox_wrap_exec(struct sqlbox *box, struct sqlbox_db *db,
+	const struct sqlbox_pstmt *pst, int allow_cstep,
+	struct sqlbox_budget *b)
+{
+	enum sqlbox_code	 code;
+
+	/*
+	 * Interrupting a write midway makes SQLite roll back the whole
+	 * transaction, which would silently lose any batched writes.
+	 * So while batching, only interrupt before starting.
+	 */
+
+	sqlbox_ctl_enter(box, db->batch ? NULL : db->db);
+
+	/* Interrupts may have been latched before we started. */
+
+	if (sqlbox_ctl_interrupted(box)) {
+		sqlbox_debug(&box->cfg, "%s: sqlite3_exec: interrupted "
+			"before starting: %s", db->src->fname, pst->stmt);
+		sqlbox_ctl_leave(box);
+		return SQLBOX_CODE_INTERRUPT;
+	}
+
+	sqlbox_budget_enter(db, b);
+	code = sqlbox_wrap_exec_inner(box, db, pst, allow_cstep, b);
+	sqlbox_budget_leave(db, b);
+	sqlbox_ctl_leave(box);
+	return code;
+}
+
+/*
+ * Execute one of our own statements, such as pragmas at open.
+ * These aren't subject to interrupts or budgets, so they don't consume
+ * interrupts meant for the caller's statements.
+ * See sqlbox_wrap_step_inner() for return values.
+ */
+enum sqlbox_code
+sqlbox_wrap_exec_sys(struct sqlbox *box, struct sqlbox_db *db,
+	const struct sqlbox_pstmt *pst)
+{
+
+	return sqlbox_wrap_exec_inner(box, db, pst, 0, NULL);
+}
@@ -0,0 +1,72 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+int
+sqlbox_stats(struct sqlbox *box, struct sqlbox_stats *res)
+{
+	uint64_t	 ack[3];
+
+	if (!sqlbox_write_frame(box, SQLBOX_OP_STATS, NULL, 0)) {
+		sqlbox_warnx(&box->cfg, "stats: sqlbox_write_frame");
+		return 0;
+	}
+	if (!sqlbox_read(box, (char *)ack, sizeof(ack))) {
+		sqlbox_warnx(&box->cfg, "stats: sqlbox_read");
+		return 0;
+	}
+	res->retries = le64toh(ack[0]);
+	res->giveups = le64toh(ack[1]);
+	res->waited = le64toh(ack[2]);
+	return 1;
+}
+
+int
+sqlbox_op_stats(struct sqlbox *box, const char *buf, size_t sz)
+{
+	uint64_t	 ack[3];
+
+	if (sz != 0) {
+		sqlbox_warnx(&box->cfg, "stats: "
+			"bad frame size: %zu", sz);
+		return 0;
+	}
+
+	ack[0] = htole64(box->stats.retries);
+	ack[1] = htole64(box->stats.giveups);
+	ack[2] = htole64(box->stats.waited);
+
+	if (!sqlbox_write(box, (char *)ack, sizeof(ack))) {
+		sqlbox_warnx(&box->cfg, "stats: sqlbox_write");
+		return 0;
+	}
+	return 1;
+}
@@ -19,8 +19,11 @@
 #if HAVE_SYS_QUEUE
 # include <sys/queue.h>
 #endif 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include COMPAT_ENDIAN_H
 #include <assert.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,27 +35,222 @@
 #include "extern.h"
 
 /*
- * When we're caching results, cache at most 10 times the frame size.
- * XXX: this will probably end up being tuned or dynamically set.
+ * Read as many result sets as are available in "frame" into "res".
+ * Each is a code followed by packed parameters.
+ * Returns TRUE on success, FALSE on failure.
  */
-#define	SQLBOX_CACHE_MAX (SQLBOX_FRAME * 10)
+int
+sqlbox_res_unpack(struct sqlbox *box, struct sqlbox_res *res,
+	const char *frame, size_t framesz)
+{
+	size_t	 i, psz;
+	void	*pp;
+
+	while (framesz > 0) {
+		if (framesz < sizeof(uint32_t)) {
+			sqlbox_warnx(&box->cfg, 
+				"step: bad frame size");
+			return 0;
+		}
+
+		pp = reallocarray(res->set, res->setsz + 1, 
+			sizeof(struct sqlbox_parmset));
+		if (pp == NULL) {
+			sqlbox_warn(&box->cfg, "step: reallocarray");
+			return 0;
+		}
+		res->set = pp;
+		i = res->setsz++;
+		memset(&res->set[i], 0, sizeof(struct sqlbox_parmset));
+
+		res->set[i].code = le32toh(*(uint32_t *)frame);
+		frame += sizeof(uint32_t);
+		framesz -= sizeof(uint32_t);
+
+		psz = sqlbox_parm_unpack(box, &res->set[i].ps, 
+			&res->set[i].psz, frame, framesz);
+		if (psz == 0) {
+			sqlbox_warnx(&box->cfg, 
+				"step: sqlbox_parm_unpack");
+			return 0;
+		}
+		frame += psz;
+		framesz -= psz;
+	}
+
+	return 1;
+}
+
+/*
+ * Write the batch of results in "buf", which starts with its frame size
+ * and is padded to "sz" bytes.
+ * If at least sqlbox_comm's "memfd" bytes, it's passed in a memory file
+ * instead, with a frame of SQLBOX_RES_MEMFD and its size preceding it.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_res_write(struct sqlbox *box, const char *buf, size_t sz)
+{
+	char		 frame[SQLBOX_FRAME];
+	size_t		 len;
+	uint32_t	 val;
+	uint64_t	 val64;
+	int		 fd;
+
+	len = le32toh(*(const uint32_t *)buf) + sizeof(uint32_t);
+	assert(len <= sz);
+
+	if (box->cfg.comm.memfd == 0 || len < box->cfg.comm.memfd ||
+	    (fd = sqlbox_memfd(box, buf, len)) == -1)
+		return sqlbox_write(box, buf, sz);
+
+	memset(frame, 0, sizeof(frame));
+	val = htole32(sizeof(uint32_t) + sizeof(uint64_t));
+	memcpy(frame, &val, sizeof(uint32_t));
+	val = htole32(SQLBOX_RES_MEMFD);
+	memcpy(frame + sizeof(uint32_t), &val, sizeof(uint32_t));
+	val64 = htole64(len);
+	memcpy(frame + sizeof(uint32_t) * 2, &val64, sizeof(uint64_t));
+
+	if (!sqlbox_write(box, frame, sizeof(frame))) {
+		sqlbox_warnx(&box->cfg, "res-write: sqlbox_write");
+		close(fd);
+		return 0;
+	} else if (!sqlbox_write_fd(box, fd)) {
+		sqlbox_warnx(&box->cfg, "res-write: sqlbox_write_fd");
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	return 1;
+}
+
+/*
+ * Read a batch of results written by sqlbox_res_write() into "res",
+ * setting "frame" and "framesz" as sqlbox_read_frame() does.
+ * Batches in memory files are mapped into "res" and read in place.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_res_read(struct sqlbox *box, struct sqlbox_res *res,
+	const char **frame, size_t *framesz)
+{
+	uint64_t	 val64;
+	size_t		 len;
+	int		 fd;
+	struct stat	 st;
+	void		*pp;
+
+	if (sqlbox_read_frame(box, 
+	    &res->buf, &res->bufsz, frame, framesz) <= 0) {
+		sqlbox_warnx(&box->cfg, "res-read: sqlbox_read_frame");
+		return 0;
+	}
+	box->pending = 0;
+
+	if (*framesz != sizeof(uint32_t) + sizeof(uint64_t) ||
+	    le32toh(*(const uint32_t *)*frame) != SQLBOX_RES_MEMFD)
+		return 1;
+
+	assert(res->map == NULL);
+	memcpy(&val64, *frame + sizeof(uint32_t), sizeof(uint64_t));
+	len = le64toh(val64);
+
+	if (!sqlbox_read_fd(box, &fd)) {
+		sqlbox_warnx(&box->cfg, "res-read: sqlbox_read_fd");
+		return 0;
+	}
+
+#ifdef F_GET_SEALS
+	if ((fcntl(fd, F_GET_SEALS) & (F_SEAL_WRITE|F_SEAL_SHRINK)) !=
+	    (F_SEAL_WRITE|F_SEAL_SHRINK)) {
+		sqlbox_warnx(&box->cfg, "res-read: "
+			"memory file not sealed");
+		close(fd);
+		return 0;
+	} else if (fstat(fd, &st) == -1) {
+		sqlbox_warn(&box->cfg, "res-read: fstat");
+		close(fd);
+		return 0;
+	} else if (len < sizeof(uint32_t) || st.st_size < 0 ||
+	    (uintmax_t)st.st_size < len) {
+		sqlbox_warnx(&box->cfg, "res-read: "
+			"memory file too short");
+		close(fd);
+		return 0;
+	}
+#else
+	sqlbox_warnx(&box->cfg, "res-read: "
+		"memory files not supported");
+	close(fd);
+	return 0;
+#endif
+
+	pp = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pp == MAP_FAILED) {
+		sqlbox_warn(&box->cfg, "res-read: mmap");
+		return 0;
+	}
+	res->map = pp;
+	res->mapsz = len;
+	sqlbox_debug(&box->cfg, "res-read: mapped %zu B", len);
+
+	/* 
+	 * The mapping holds the frame size as well, so the parameters
+	 * are aligned just as in a read frame.
+	 */
+
+	*frame = (const char *)pp + sizeof(uint32_t);
+	*framesz = le32toh(*(const uint32_t *)pp);
+	if (*framesz > len - sizeof(uint32_t)) {
+		sqlbox_warnx(&box->cfg, "res-read: bad frame size");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Read a batch of results from the server into "res", which must have
+ * been cleared.
+ * Returns the first result or NULL on failure.
+ */
+const struct sqlbox_parmset *
+sqlbox_step_read(struct sqlbox *box, struct sqlbox_res *res)
+{
+	const char		*frame;
+	size_t			 framesz;
+
+	/* 
+	 * This will read the entire result set in its binary format
+	 * using the given buffer.
+	 * It will set frame and framesz to be the binary area for the
+	 * packed parameters.
+	 */
 
-struct	freen {
-	void			 *dat;
-	void			(*fp)(void *);
-	TAILQ_ENTRY(freen)	 entries;
-};
+	if (!sqlbox_res_read(box, res, &frame, &framesz)) {
+		sqlbox_warnx(&box->cfg, "step: sqlbox_res_read");
+		return NULL;
+	}
 
-TAILQ_HEAD(freeq, freen);
+	if (!sqlbox_res_unpack(box, res, frame, framesz)) {
+		sqlbox_warnx(&box->cfg, "step: sqlbox_res_unpack");
+		return NULL;
+	} else if (res->setsz == 0) {
+		sqlbox_warnx(&box->cfg, "step: no results");
+		return NULL;
+	}
+
+	/* Return the first cached entry. */
+
+	return &res->set[res->curset++];
+}
 
 const struct sqlbox_parmset *
 sqlbox_step(struct sqlbox *box, size_t stmtid)
 {
 	uint32_t		 val;
-	const char		*frame;
-	size_t			 i, framesz, psz;
 	struct sqlbox_stmt 	*st;
-	void			*pp;
 
 	/* Look up the statement. */
 
@@ -79,113 +277,61 @@ sqlbox_step(struct sqlbox *box, size_t stmtid)
 		return NULL;
 	}
 
-	/* 
-	 * This will read the entire result set in its binary format
-	 * using the given buffer.
-	 * It will set frame and framesz to be the binary area for the
-	 * packed parameters.
-	 */
-
-	if (sqlbox_read_frame(box, 
-	    &st->res.buf, &st->res.bufsz, &frame, &framesz) <= 0) {
-		sqlbox_warnx(&box->cfg, "step: sqlbox_read_frame");
-		return NULL;
-	}
-
-	/* Read as many results sets as are available. */
-
-	while (framesz > 0) {
-		if (framesz < sizeof(uint32_t)) {
-			sqlbox_warnx(&box->cfg, 
-				"step: bad frame size");
-			return NULL;
-		}
-
-		pp = reallocarray(st->res.set, 
-			st->res.setsz + 1, 
-			sizeof(struct sqlbox_parmset));
-		if (pp == NULL) {
-			sqlbox_warn(&box->cfg, "step: reallocarray");
-			return NULL;
-		}
-		st->res.set = pp;
-		i = st->res.setsz++;
-		memset(&st->res.set[i], 0, 
-			sizeof(struct sqlbox_parmset));
+	return sqlbox_step_read(box, &st->res);
+}
 
-		st->res.set[i].code = le32toh(*(uint32_t *)frame);
-		frame += sizeof(uint32_t);
-		framesz -= sizeof(uint32_t);
+/*
+ * Free the row parameters of "row" and any filtered values.
+ */
+void
+sqlbox_row_clear(struct sqlbox_row *row)
+{
+	struct sqlbox_freen	*fn;
 
-		psz = sqlbox_parm_unpack(box, 
-			&st->res.set[i].ps, 
-			&st->res.set[i].psz,
-			frame, framesz);
-		if (psz == 0) {
-			sqlbox_warnx(&box->cfg, 
-				"step: sqlbox_parm_unpack");
-			return NULL;
-		}
-		frame += psz;
-		framesz -= psz;
+	while ((fn = TAILQ_FIRST(&row->fq)) != NULL) {
+		TAILQ_REMOVE(&row->fq, fn, entries);
+		(*fn->fp)(fn->dat);
+		free(fn);
 	}
-
-	/* Return the first cached entry. */
-
-	return &st->res.set[st->res.curset++];
+	free(row->set.ps);
+	row->set.ps = NULL;
+	row->set.psz = 0;
 }
 
 /*
- * Read a single result from the wire and append it to the packed
- * parameters we already have in our buffer.
- * Return <0 on error, 0 if there are no results, >0 if we have a row.
+ * Fill "row" with the "cols" columns of the current row of "st", which
+ * has just been stepped, running any output filters.
+ * Text and blob pointers are only valid until the next step.
+ * The row must be freed with sqlbox_row_clear() in any case.
+ * Returns TRUE on success, FALSE on failure.
  */
-static int
-sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
+int
+sqlbox_row_fill(struct sqlbox *box, struct sqlbox_stmt *st, 
+	size_t cols, struct sqlbox_row *row)
 {
-	enum sqlbox_code	 code;
-	struct sqlbox_parmset	 set;
-	size_t			 cols = 0, i, j;
-	int			 has_cstep = 0, rc = -1;
-	void			*pp, *arg;
-	struct freeq		 fq;
-	struct freen		*fn;
-	uint32_t		 val;
+	size_t			 i, j;
+	void			*arg;
+	struct sqlbox_freen	*fn;
+	struct sqlbox_parmset	*set = &row->set;
 
-	TAILQ_INIT(&fq);
+	memset(row, 0, sizeof(struct sqlbox_row));
+	TAILQ_INIT(&row->fq);
 
-	/* Start with the step itself. */
-
-	code = sqlbox_wrap_step(box, st->db, 
-		st->pstmt, st->stmt, &cols, 
-		(st->flags & SQLBOX_STMT_CONSTRAINT));
-	if (code == SQLBOX_CODE_ERROR) {
-		sqlbox_warnx(&box->cfg, "%s: step: "
-			"sqlbox_wrap_step", st->db->src->fname);
-		return -1;
-	} else if (code == SQLBOX_CODE_CONSTRAINT)
-		has_cstep = 1;
-	
 	if (cols > 0) {
-		set.psz = cols;
-		set.ps = calloc(cols, sizeof(struct sqlbox_parm));
-		if (set.ps == NULL) {
+		set->psz = cols;
+		set->ps = calloc(cols, sizeof(struct sqlbox_parm));
+		if (set->ps == NULL) {
 			sqlbox_warn(&box->cfg, "step: calloc");
-			return -1;
+			return 0;
 		}
-	} else {
-		set.psz = 0;
-		set.ps = NULL;
 	}
 
 	/*
-	 * Text and blob pointers are immediately serialised, so we
-	 * don't need to worry about the return pointers going stale.
 	 * Maintain a list of pointers we need to pass to custom "free"
 	 * routines in "fq".
 	 */
 
-	for (i = 0; i < set.psz; i++) {
+	for (i = 0; i < set->psz; i++) {
 		/*
 		 * See if we have a filter for generating data instead
 		 * of using the database.
@@ -200,7 +346,7 @@ sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
 		if (j < box->cfg.filts.filtsz) {
 			arg = NULL;
 			if (!(*box->cfg.filts.filts[j].filt)
-			    (&set.ps[i], &arg)) {
+			    (&set->ps[i], &arg)) {
 				sqlbox_warn(&box->cfg, "%s: step: "
 					"filter: position %zu",
 					st->db->src->fname, i);
@@ -208,51 +354,51 @@ sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
 					"statement: %s", 
 					st->db->src->fname, 
 					st->pstmt->stmt);
-				goto out;
+				return 0;
 			}
 			if (box->cfg.filts.filts[j].free == NULL) 
 				continue;
 
 			/* Create an exit hook for free. */
 
-			fn = calloc(1, sizeof(struct freen));
+			fn = calloc(1, sizeof(struct sqlbox_freen));
 			if (fn == NULL) {
 				sqlbox_warn(&box->cfg, 
 					"step: calloc");
 				(*box->cfg.filts.filts[j].free)(arg);
-				goto out;
+				return 0;
 			}
 			fn->dat = arg;
 			fn->fp = box->cfg.filts.filts[j].free;
-			TAILQ_INSERT_TAIL(&fq, fn, entries);
+			TAILQ_INSERT_TAIL(&row->fq, fn, entries);
 			continue;
 		}
 
 		switch (sqlite3_column_type(st->stmt, i)) {
 		case SQLITE_BLOB:
-			set.ps[i].type = SQLBOX_PARM_BLOB;
-			set.ps[i].bparm = sqlite3_column_blob(st->stmt, i);
-			set.ps[i].sz = sqlite3_column_bytes(st->stmt, i);
+			set->ps[i].type = SQLBOX_PARM_BLOB;
+			set->ps[i].bparm = sqlite3_column_blob(st->stmt, i);
+			set->ps[i].sz = sqlite3_column_bytes(st->stmt, i);
 			break;
 		case SQLITE_FLOAT:
-			set.ps[i].type = SQLBOX_PARM_FLOAT;
-			set.ps[i].fparm = sqlite3_column_double(st->stmt, i);
-			set.ps[i].sz = sizeof(double);
+			set->ps[i].type = SQLBOX_PARM_FLOAT;
+			set->ps[i].fparm = sqlite3_column_double(st->stmt, i);
+			set->ps[i].sz = sizeof(double);
 			break;
 		case SQLITE_INTEGER:
-			set.ps[i].type = SQLBOX_PARM_INT;
-			set.ps[i].iparm = sqlite3_column_int64(st->stmt, i);
-			set.ps[i].sz = sizeof(int64_t);
+			set->ps[i].type = SQLBOX_PARM_INT;
+			set->ps[i].iparm = sqlite3_column_int64(st->stmt, i);
+			set->ps[i].sz = sizeof(int64_t);
 			break;
 		case SQLITE_TEXT:
-			set.ps[i].type = SQLBOX_PARM_STRING;
-			set.ps[i].sparm = (char *)
+			set->ps[i].type = SQLBOX_PARM_STRING;
+			set->ps[i].sparm = (char *)
 				sqlite3_column_text(st->stmt, i);
-			set.ps[i].sz = sqlite3_column_bytes(st->stmt, i) + 1;
+			set->ps[i].sz = sqlite3_column_bytes(st->stmt, i) + 1;
 			break;
 		case SQLITE_NULL:
-			set.ps[i].type = SQLBOX_PARM_NULL;
-			set.ps[i].sz = 0;
+			set->ps[i].type = SQLBOX_PARM_NULL;
+			set->ps[i].sz = 0;
 			break;
 		default:
 			sqlbox_warnx(&box->cfg, "%s: step: "
@@ -262,10 +408,50 @@ sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
 			sqlbox_warnx(&box->cfg, "%s: step: "
 				"statement: %s", st->db->src->fname, 
 				st->pstmt->stmt);
-			goto out;
+			return 0;
 		}
 	}
 
+	return 1;
+}
+
+/*
+ * Read a single result from the wire and append it to the packed
+ * parameters we already have in our buffer.
+ * Return <0 on error, 0 if there are no results, >0 if we have a row.
+ */
+int
+sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
+{
+	enum sqlbox_code	 code;
+	struct sqlbox_row	 row;
+	size_t			 cols = 0;
+	int			 rc = -1;
+	void			*pp;
+	uint32_t		 val;
+
+	/* Start with the step itself. */
+
+	code = sqlbox_wrap_step(box, st->db, 
+		st->pstmt, st->stmt, &cols, 
+		(st->flags & SQLBOX_STMT_CONSTRAINT), &st->budget);
+	if (code == SQLBOX_CODE_ERROR) {
+		sqlbox_warnx(&box->cfg, "%s: step: "
+			"sqlbox_wrap_step", st->db->src->fname);
+		return -1;
+	}
+
+	/*
+	 * Text and blob pointers are immediately serialised, so we
+	 * don't need to worry about the return pointers going stale.
+	 */
+
+	if (!sqlbox_row_fill(box, st, cols, &row)) {
+		sqlbox_warnx(&box->cfg, "%s: step: "
+			"sqlbox_row_fill", st->db->src->fname);
+		goto out;
+	}
+
 	/* 
 	 * Serialise our results.
 	 * The buffer has already been primed with space for the initial
@@ -290,29 +476,23 @@ sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
 	}
 
 	/* 
-	 * Write our return code (whether we had a constraint violation)
-	 * then the results, if any.  Make room for the size at the
-	 * beginning of the buffer.
+	 * Write our return code (whether we had a constraint violation,
+	 * were interrupted, or went over budget) then the results, if
+	 * any.  Make room for the size at the beginning of the buffer.
 	 */
 
-	val = htole32(has_cstep);
+	val = htole32(code);
 	memcpy(st->res.buf + *bufpos, (char *)&val, sizeof(uint32_t));
 	*bufpos += sizeof(uint32_t);
 
-	if (!sqlbox_parm_pack(box, set.psz, set.ps, 
+	if (!sqlbox_parm_pack(box, row.set.psz, row.set.ps, 
 	    &st->res.buf, bufpos, &st->res.bufsz)) {
 		sqlbox_warnx(&box->cfg, "step: sqlbox_parm_pack");
 		goto out;
 	}
 	rc = (cols > 0);
-
 out:
-	while ((fn = TAILQ_FIRST(&fq)) != NULL) {
-		TAILQ_REMOVE(&fq, fn, entries);
-		(*fn->fp)(fn->dat);
-		free(fn);
-	}
-	free(set.ps);
+	sqlbox_row_clear(&row);
 	return rc;
 }
 
@@ -325,9 +505,6 @@ int
 sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_stmt	*st;
-	size_t			 pos;
-	int			 rc, done, wrote = 0;
-	uint32_t		 val;
 	
 	/* Look up the statement in our global list. */
 
@@ -341,6 +518,21 @@ sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 		return 0;
 	}
 
+	return sqlbox_step_stmt(box, st);
+}
+
+/*
+ * Write back the next batch of results of "st", stepping if it has no
+ * cached results, then cache the batch after it if multi-stepping.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_step_stmt(struct sqlbox *box, struct sqlbox_stmt *st)
+{
+	size_t			 pos;
+	int			 rc, done, wrote = 0;
+	uint32_t		 val;
+
 	/* 
 	 * Immediately write any cached responses.
 	 * Make sure to update our "done" marker after clearing out the
@@ -348,9 +540,9 @@ sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 	 */
 
 	if (st->res.bufsz) {
-		if (!sqlbox_write(box, st->res.buf, st->res.bufsz)) {
+		if (!sqlbox_res_write(box, st->res.buf, st->res.bufsz)) {
 			sqlbox_warnx(&box->cfg, "%s: step: "
-				"sqlbox_write", st->db->src->fname);
+				"sqlbox_res_write", st->db->src->fname);
 			return 0;
 		}
 		wrote = 1;
@@ -400,8 +592,8 @@ sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 		val = htole32(pos - sizeof(uint32_t));
 		memcpy(st->res.buf, (char *)&val, sizeof(uint32_t));
 		pos = pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME;
-		if (!sqlbox_write(box, st->res.buf, pos)) {
-			sqlbox_warnx(&box->cfg, "step: sqlbox_write");
+		if (!sqlbox_res_write(box, st->res.buf, pos)) {
+			sqlbox_warnx(&box->cfg, "step: sqlbox_res_write");
 			return 0;
 		}
 		done = st->res.done;
@@ -22,9 +22,12 @@
 #include COMPAT_ENDIAN_H
 
 #include <assert.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sqlite3.h>
@@ -32,6 +35,11 @@
 #include "sqlbox.h"
 #include "extern.h"
 
+/*
+ * Default time a batch of writes may hold the write lock.
+ */
+#define	SQLBOX_BATCH_MAXMS 100 /* max. batch age (ms) */
+
 enum	transt {
 	SQLBOX_TRANS_DEFERRED = 0,
 	SQLBOX_TRANS_IMMEDIATE = 1,
@@ -49,10 +57,71 @@ static	const char *const transts[SQLBOX_TRANS__MAX] = {
 	"ROLLBACK TRANSACTION", /* SQLBOX_TRANS_ROLLBACK */
 };
 
+/*
+ * Run the transaction statement of "type" on "db", backing off while
+ * the database is busy.
+ * Waiting may be interrupted by the client if "intr" is set, except
+ * when rolling back, which must always finish.
+ * Return <0 if interrupted, 0 on failure, >0 on success.
+ */
+static int
+sqlbox_trans_exec_inner(struct sqlbox *box, struct sqlbox_db *db,
+	enum transt type, int intr)
+{
+	struct sqlbox_backoff	 bo;
+
+	if (type == SQLBOX_TRANS_ROLLBACK)
+		intr = 0;
+	sqlbox_backoff_init(&bo, db->src);
+	bo.nointr = !intr;
+again:
+	sqlbox_debug(&box->cfg, "sqlite3_exec: %s, %s",
+		db->src->fname, transts[type]);
+	switch (sqlite3_exec(db->db, transts[type], NULL, NULL, NULL)) {
+	case SQLITE_BUSY:
+	case SQLITE_LOCKED:
+	case SQLITE_PROTOCOL:
+		if (intr && sqlbox_ctl_interrupted(box)) {
+			sqlbox_debug(&box->cfg, "%s: %s: interrupted",
+				db->src->fname, transts[type]);
+			return -1;
+		}
+		if (sqlbox_backoff(box, &bo))
+			goto again;
+		sqlbox_warnx(&box->cfg, "%s: %s: gave up waiting", 
+			db->src->fname, transts[type]);
+		return 0;
+	case SQLITE_OK:
+		return 1;
+	default:
+		sqlbox_warnx(&box->cfg, "%s: %s: %s", db->src->fname,
+			transts[type], sqlite3_errmsg(db->db));
+		return 0;
+	}
+}
+
+/*
+ * Run sqlbox_trans_exec_inner() accepting interrupts from the control
+ * channel if "intr" is set.
+ * The statement itself isn't interrupted, only waiting on it.
+ */
+static int
+sqlbox_trans_exec(struct sqlbox *box, struct sqlbox_db *db,
+	enum transt type, int intr)
+{
+	int	 c;
+
+	sqlbox_ctl_enter(box, NULL);
+	c = sqlbox_trans_exec_inner(box, db, type, intr);
+	sqlbox_ctl_leave(box);
+	return c;
+}
+
 /*
  * Serialise and send a transaction-open statement of "type" (which must
- * be a closing type) on source "srcid" identified by "tid".
- * Return TRUE on success, FALSE on failure.
+ * be a closing type) on source "srcid" identified by "tid", waiting
+ * for the result.
+ * Return TRUE on success, FALSE on failure or if interrupted.
  */
 static int
 sqlbox_trans_close(struct sqlbox *box,
@@ -78,14 +147,18 @@ sqlbox_trans_close(struct sqlbox *box,
 	    (box, SQLBOX_OP_TRANS_CLOSE, buf, sizeof(buf))) {
 		sqlbox_warnx(&box->cfg, "trans-close: sqlbox_write_frame");
 		return 0;
+	} else if (!sqlbox_read(box, (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "trans-close: sqlbox_read");
+		return 0;
 	}
-	return 1;
+	return le32toh(v) == SQLBOX_CODE_OK;
 }
 
 /*
  * Serialise and send a transaction-open statement of "type" (which must
- * be an opening type) on source "srcid" identified by "tid".
- * Return TRUE on success, FALSE on failure.
+ * be an opening type) on source "srcid" identified by "tid", waiting
+ * for the result.
+ * Return TRUE on success, FALSE on failure or if interrupted.
  */
 static int
 sqlbox_trans_open(struct sqlbox *box, 
@@ -110,8 +183,11 @@ sqlbox_trans_open(struct sqlbox *box,
 	    (box, SQLBOX_OP_TRANS_OPEN, buf, sizeof(buf))) {
 		sqlbox_warnx(&box->cfg, "trans-open: sqlbox_write_frame");
 		return 0;
+	} else if (!sqlbox_read(box, (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "trans-open: sqlbox_read");
+		return 0;
 	}
-	return 1;
+	return le32toh(v) == SQLBOX_CODE_OK;
 }
 
 int
@@ -158,8 +234,10 @@ int
 sqlbox_op_trans_open(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_db	*db;
-	size_t			 id, attempt = 0;
+	size_t			 id;
 	enum transt		 type;
+	uint32_t		 ack;
+	int			 c;
 
 	if (sz != sizeof(uint32_t) * 3) {
 		sqlbox_warnx(&box->cfg, "trans-open: "
@@ -169,15 +247,21 @@ sqlbox_op_trans_open(struct sqlbox *box, const char *buf, size_t sz)
 
 	/* Look up database and check no pending transaction. */
 
-	if ((db = sqlbox_db_find
+	if ((db = sqlbox_db_find_open
 	    (box, le32toh(*(uint32_t *)buf))) == NULL) {
-		sqlbox_warnx(&box->cfg, "trans-open: sqlbox_db_find");
+		sqlbox_warnx(&box->cfg, "trans-open: "
+			"sqlbox_db_find_open");
 		return 0;
 	} else if (db->trans) {
 		sqlbox_warnx(&box->cfg, "%s: trans-open: "
 			"transaction %zu already open",
 			db->src->fname, db->trans);
 		return 0;
+	} else if (db->conn != NULL && db->conn->owner) {
+		sqlbox_warnx(&box->cfg, "%s: trans-open: "
+			"shared connection in transaction "
+			"(id %zu)", db->src->fname, db->conn->owner);
+		return 0;
 	}
 
 	/* Verify transaction identifier. */
@@ -198,24 +282,27 @@ sqlbox_op_trans_open(struct sqlbox *box, const char *buf, size_t sz)
 		return 0;
 	}
 
-again:
-	sqlbox_debug(&box->cfg, "sqlite3_exec: %s, %s",
-		db->src->fname, transts[type]);
-	switch (sqlite3_exec(db->db, transts[type], NULL, NULL, NULL)) {
-	case SQLITE_BUSY:
-	case SQLITE_LOCKED:
-	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again;
-	case SQLITE_OK:
-		break;
-	default:
-		sqlbox_warnx(&box->cfg, "%s: trans-open: %s", 
-			db->src->fname, sqlite3_errmsg(db->db));
+	/* 
+	 * If interrupted waiting on a busy database, report it and
+	 * leave the transaction unopened.
+	 */
+
+	if ((c = sqlbox_trans_exec(box, db, type, 1)) == 0) {
+		sqlbox_warnx(&box->cfg, "%s: trans-open: "
+			"sqlbox_trans_exec", db->src->fname);
 		return 0;
+	} else if (c > 0) {
+		db->trans = id;
+		if (db->conn != NULL)
+			db->conn->owner = db->id;
 	}
 
-	db->trans = id;
+	ack = htole32(c > 0 ? SQLBOX_CODE_OK : SQLBOX_CODE_INTERRUPT);
+	if (!sqlbox_write(box, (char *)&ack, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "%s: trans-open: "
+			"sqlbox_write", db->src->fname);
+		return 0;
+	}
 	return 1;
 }
 
@@ -223,8 +310,10 @@ int
 sqlbox_op_trans_close(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_db	*db;
-	size_t			 id, attempt = 0;
+	size_t			 id;
 	enum transt		 type;
+	uint32_t		 ack;
+	int			 c;
 
 	if (sz != sizeof(uint32_t) * 3) {
 		sqlbox_warnx(&box->cfg, "trans-close: "
@@ -267,23 +356,213 @@ sqlbox_op_trans_close(struct sqlbox *box, const char *buf, size_t sz)
 		return 0;
 	}
 
-again:
-	sqlbox_debug(&box->cfg, "sqlite3_exec: %s, %s",
-		db->src->fname, transts[type]);
-	switch (sqlite3_exec(db->db, transts[type], NULL, NULL, NULL)) {
-	case SQLITE_BUSY:
-	case SQLITE_LOCKED:
-	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again;
-	case SQLITE_OK:
-		break;
-	default:
-		sqlbox_warnx(&box->cfg, "%s: trans-close: %s", 
-			db->src->fname, sqlite3_errmsg(db->db));
+	/*
+	 * An interrupted statement may have already rolled back the
+	 * transaction, in which case there's nothing left to do.
+	 */
+
+	if (type == SQLBOX_TRANS_ROLLBACK &&
+	    sqlite3_get_autocommit(db->db)) {
+		sqlbox_debug(&box->cfg, "%s: trans-close: already "
+			"rolled back", db->src->fname);
+		c = 1;
+	} else if ((c = sqlbox_trans_exec(box, db, type, 1)) == 0) {
+		sqlbox_warnx(&box->cfg, "%s: trans-close: "
+			"sqlbox_trans_exec", db->src->fname);
+		return 0;
+	}
+
+	/* 
+	 * If interrupted waiting on a busy database, report it and
+	 * leave the transaction open.
+	 */
+
+	if (c > 0) {
+		db->trans = 0;
+		if (db->conn != NULL)
+			db->conn->owner = 0;
+	}
+
+	ack = htole32(c > 0 ? SQLBOX_CODE_OK : SQLBOX_CODE_INTERRUPT);
+	if (!sqlbox_write(box, (char *)&ack, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "%s: trans-close: "
+			"sqlbox_write", db->src->fname);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Monotonic time in milliseconds.
+ */
+static uint64_t
+sqlbox_batch_now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Start batching writes to "db" into one transaction, if not otherwise
+ * in a transaction.
+ * Return <0 if interrupted waiting on the database (not batching), 0 on
+ * failure, >0 on success.
+ */
+int
+sqlbox_batch_begin(struct sqlbox *box, struct sqlbox_db *db)
+{
+	int	 c;
+
+	if (db->batch || db->trans || !sqlite3_get_autocommit(db->db))
+		return 1;
+	if ((c = sqlbox_trans_exec(box, db, SQLBOX_TRANS_IMMEDIATE, 1)) < 0)
+		return -1;
+	else if (c == 0) {
+		sqlbox_warnx(&box->cfg, "%s: batch-begin: "
+			"sqlbox_trans_exec", db->src->fname);
+		return 0;
+	}
+	db->batch = 1;
+	db->batchrows = db->batchbytes = 0;
+	db->batchstart = sqlbox_batch_now();
+	return 1;
+}
+
+/*
+ * Commit any batched writes to "db".
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_batch_commit(struct sqlbox *box, struct sqlbox_db *db)
+{
+
+	if (!db->batch)
+		return 1;
+	db->batch = 0;
+
+	/* 
+	 * Asynchronous writes that may abort midway aren't batched and
+	 * imports roll back their own failed batches, so losing the
+	 * transaction here means losing acknowledged writes.
+	 */
+
+	if (sqlite3_get_autocommit(db->db)) {
+		sqlbox_warnx(&box->cfg, "%s: batch-commit: rolled "
+			"back: %zu rows, %zu bytes lost", db->src->fname,
+			db->batchrows, db->batchbytes);
+		return 0;
+	}
+
+	sqlbox_debug(&box->cfg, "%s: batch-commit: %zu rows, "
+		"%zu bytes", db->src->fname, db->batchrows, 
+		db->batchbytes);
+	if (sqlbox_trans_exec(box, db, SQLBOX_TRANS_COMMIT, 0) <= 0) {
+		sqlbox_warnx(&box->cfg, "%s: batch-commit: "
+			"sqlbox_trans_exec", db->src->fname);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Roll back any batched writes to "db".
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_batch_rollback(struct sqlbox *box, struct sqlbox_db *db)
+{
+
+	if (!db->batch)
+		return 1;
+	db->batch = 0;
+	if (sqlite3_get_autocommit(db->db))
+		return 1;
+	if (sqlbox_trans_exec(box, db, SQLBOX_TRANS_ROLLBACK, 0) <= 0) {
+		sqlbox_warnx(&box->cfg, "%s: batch-rollback: "
+			"sqlbox_trans_exec", db->src->fname);
 		return 0;
 	}
+	return 1;
+}
 
-	db->trans = 0;
+/*
+ * Account for an asynchronous write of "sz" frame bytes changing
+ * "rows" rows of "db", committing if this reaches the source's batch
+ * limits.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_batch_add(struct sqlbox *box, struct sqlbox_db *db,
+	size_t rows, size_t sz)
+{
+	const struct sqlbox_batch *b = &db->src->batch;
+
+	if (!db->batch)
+		return 1;
+	db->batchrows += rows;
+	db->batchbytes += sz;
+	if ((b->maxrows && db->batchrows >= b->maxrows) ||
+	    (b->maxbytes && db->batchbytes >= b->maxbytes))
+		return sqlbox_batch_commit(box, db);
+	return 1;
+}
+
+/*
+ * Commit batched writes to all databases.
+ * This must be called before any operation that isn't a batched
+ * write, so that the batching is never visible.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_batch_flush(struct sqlbox *box)
+{
+	struct sqlbox_db	*db;
+
+	TAILQ_FOREACH(db, &box->dbq, entries)
+		if (!sqlbox_batch_commit(box, db)) {
+			sqlbox_warnx(&box->cfg, "%s: "
+				"sqlbox_batch_commit", db->src->fname);
+			return 0;
+		}
+	return 1;
+}
+
+/*
+ * Commit batched writes that have been open for longer than their
+ * source's time limit, as batches hold the database's write lock.
+ * Set "ms" to the milliseconds until the next batch expires or INFTIM
+ * if there are no batches.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_batch_expire(struct sqlbox *box, int *ms)
+{
+	struct sqlbox_db	*db;
+	uint64_t		 now, max, age;
+
+	*ms = INFTIM;
+	now = sqlbox_batch_now();
+
+	TAILQ_FOREACH(db, &box->dbq, entries) {
+		if (!db->batch)
+			continue;
+		max = db->src->batch.maxms ?
+			db->src->batch.maxms : SQLBOX_BATCH_MAXMS;
+		age = now > db->batchstart ? now - db->batchstart : 0;
+		if (age >= max) {
+			sqlbox_debug(&box->cfg, "%s: batch-expire: "
+				"%" PRIu64 " ms", db->src->fname, age);
+			if (!sqlbox_batch_commit(box, db)) {
+				sqlbox_warnx(&box->cfg, "%s: "
+					"sqlbox_batch_commit", 
+					db->src->fname);
+				return 0;
+			}
+		} else if (*ms == INFTIM || (uint64_t)*ms > max - age)
+			*ms = max - age;
+	}
 	return 1;
 }
@@ -22,6 +22,7 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -135,7 +136,10 @@ int
 sqlbox_msg_set_dat(struct sqlbox *box, const void *buf, size_t sz)
 {
 
-	if (!sqlbox_write_frame(box, 
+	if (!sqlbox_credit(box, 1)) {
+		sqlbox_warnx(&box->cfg, "msg-set-dat: sqlbox_credit");
+		return 0;
+	} else if (!sqlbox_write_frame(box, 
 	    SQLBOX_OP_MSG_SET_DAT, buf, sz)) {
 		sqlbox_warnx(&box->cfg, 
 			"msg-set-dat: sqlbox_write_frame");